@@ -0,0 +1,741 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#include "proto.h"
+
+/* Connection to the daemon, -1 when not mounted */
+static int sock = -1;
+
+/* Request ring shared with the daemon */
+static struct fsd_ring *ring;
+
+/*
+ * Serializes every use of the ring, from queueing requests to reading their
+ * results, so that threads can share the connection
+ */
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Completions of asynchronous calls made without a callback, guarded by
+ * completed_lock as threads queue and reap them
+ */
+static pthread_mutex_t completed_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fs_completion *completed;
+static int completed_count;
+static int completed_event = -1;
+
+/* Copies handed out by fs_mmap(), guarded by map_lock */
+struct client_map {
+	const void *addr;
+	size_t length;
+};
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct client_map *maps;
+static int map_count, map_cap;
+
+/* Queue a request, returning its slot. Called with ring_lock held. */
+static int queue(int op, int fd, uint64_t arg, uint32_t len, int flags)
+{
+	uint32_t tail = ring->sq_tail;
+	int slot = tail % FSD_RING_SIZE;
+	struct fsd_sqe *sqe = &ring->sq[slot];
+
+	sqe->op = op;
+	sqe->flags = flags;
+	sqe->fd = fd;
+	sqe->arg = arg;
+	sqe->len = len;
+	sqe->result = -1;
+	__atomic_store_n(&ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	return slot;
+}
+
+/*
+ * Hand every queued request to the daemon and wait until they are done.
+ * Called with ring_lock held.
+ */
+static int submit(int host_fd)
+{
+	int fd;
+
+	if (fsd_send(sock, host_fd) || fsd_recv(sock, &fd) != 1)
+		return -1;
+
+	if (fd != -1)
+		close(fd);
+
+	return __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE) ==
+		ring->sq_tail ? 0 : -1;
+}
+
+/* Run one request that carries no data */
+static int call(int op, int fd, uint64_t arg)
+{
+	int slot, ret = -1;
+
+	if (sock == -1)
+		return -1;
+
+	pthread_mutex_lock(&ring_lock);
+	slot = queue(op, fd, arg, 0, 0);
+	if (!submit(-1))
+		ret = ring->sq[slot].result;
+	pthread_mutex_unlock(&ring_lock);
+
+	return ret;
+}
+
+/* Run one request on a file name */
+static int call_name(int op, const char *filename, uint64_t arg)
+{
+	size_t len;
+	int slot, ret = -1;
+
+	if (sock == -1 || !filename)
+		return -1;
+
+	len = strlen(filename) + 1;
+	if (len > FSD_SLOT_SIZE)
+		return -1;
+
+	pthread_mutex_lock(&ring_lock);
+	slot = queue(op, -1, arg, len, 0);
+	memcpy(ring->data[slot], filename, len);
+	if (!submit(-1))
+		ret = ring->sq[slot].result;
+	pthread_mutex_unlock(&ring_lock);
+
+	return ret;
+}
+
+/* Run one request on a host file descriptor */
+static int call_host(int op, int fd, int host_fd)
+{
+	int slot, ret = -1;
+
+	if (sock == -1)
+		return -1;
+
+	pthread_mutex_lock(&ring_lock);
+	slot = queue(op, fd, 0, 0, 0);
+	if (!submit(host_fd))
+		ret = ring->sq[slot].result;
+	pthread_mutex_unlock(&ring_lock);
+
+	return ret;
+}
+
+int fs_format(const char *diskname, unsigned int data_blocks,
+	      const struct fs_format_options *options)
+{
+	/* Disks are formatted before a daemon serves them, not through it */
+	return -1;
+}
+
+int fs_mount(const char *diskname)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	const char *path = getenv("FSD_SOCKET");
+	int mem;
+
+	if (sock != -1 || !diskname)
+		return -1;
+
+	if (path)
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	else
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s",
+			 diskname, FSD_SOCKET_SUFFIX);
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+
+	/* Hello: our stdout for fs_info() and fs_ls(), the ring in return */
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    fsd_send(sock, STDOUT_FILENO) || fsd_recv(sock, &mem) != 1 ||
+	    mem == -1)
+		goto fail;
+
+	ring = mmap(NULL, sizeof(struct fsd_ring), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, mem, 0);
+	close(mem);
+	if (ring == MAP_FAILED)
+		goto fail;
+
+	return 0;
+
+fail:
+	close(sock);
+	sock = -1;
+	return -1;
+}
+
+int fs_mount_flags(const char *diskname, int flags)
+{
+	/* The daemon chose how the disk is opened */
+	if (flags & ~(FS_MOUNT_DIRECT | FS_MOUNT_WRITEBACK | FS_MOUNT_PUNCH))
+		return -1;
+
+	return fs_mount(diskname);
+}
+
+int fs_mount_budget(const char *diskname, int flags, size_t budget)
+{
+	/* The daemon's memory is bounded by its own FSD_BUDGET */
+	return fs_mount_flags(diskname, flags);
+}
+
+int fs_umount(void)
+{
+	if (sock == -1)
+		return -1;
+
+	pthread_mutex_lock(&ring_lock);
+	munmap(ring, sizeof(struct fsd_ring));
+	close(sock);
+	sock = -1;
+	pthread_mutex_unlock(&ring_lock);
+
+	/* Mappings end with the mount, as they do in the library */
+	pthread_mutex_lock(&map_lock);
+	while (map_count > 0) {
+		map_count--;
+		munmap((void *)maps[map_count].addr, maps[map_count].length);
+	}
+	pthread_mutex_unlock(&map_lock);
+
+	return 0;
+}
+
+int fs_feature_enable(int features)
+{
+	return call(FSD_FEATURE, -1, features);
+}
+
+int fs_scrub(void)
+{
+	return call(FSD_SCRUB, -1, 0);
+}
+
+int fs_sync(void)
+{
+	return call(FSD_SYNC, -1, 0);
+}
+
+int fs_info(void)
+{
+	fflush(stdout);
+	return call(FSD_INFO, -1, 0);
+}
+
+int fs_memory_usage(struct fs_memory *usage)
+{
+	int slot, ret = -1;
+
+	if (sock == -1 || !usage)
+		return -1;
+
+	pthread_mutex_lock(&ring_lock);
+	slot = queue(FSD_MEMORY, -1, 0, 0, 0);
+	if (!submit(-1) && ring->sq[slot].result == 0) {
+		memcpy(usage, ring->data[slot], sizeof(*usage));
+		ret = 0;
+	}
+	pthread_mutex_unlock(&ring_lock);
+
+	return ret;
+}
+
+int fs_fragmentation(struct fs_fragmentation *frag)
+{
+	int slot, ret = -1;
+
+	if (sock == -1 || !frag)
+		return -1;
+
+	pthread_mutex_lock(&ring_lock);
+	slot = queue(FSD_FRAG, -1, 0, 0, 0);
+	if (!submit(-1) && ring->sq[slot].result == 0) {
+		memcpy(frag, ring->data[slot], sizeof(*frag));
+		ret = 0;
+	}
+	pthread_mutex_unlock(&ring_lock);
+
+	return ret;
+}
+
+int fs_create(const char *filename)
+{
+	return call_name(FSD_CREATE, filename, 0);
+}
+
+int fs_create_mode(const char *filename, int mode)
+{
+	return call_name(FSD_CREATE, filename, mode);
+}
+
+int fs_delete(const char *filename)
+{
+	return call_name(FSD_DELETE, filename, 0);
+}
+
+int fs_mkdir(const char *path)
+{
+	return call_name(FSD_MKDIR, path, 0);
+}
+
+int fs_rmdir(const char *path)
+{
+	return call_name(FSD_RMDIR, path, 0);
+}
+
+int fs_ls(void)
+{
+	fflush(stdout);
+	return call(FSD_LS, -1, 0);
+}
+
+int fs_ls_dir(const char *path)
+{
+	fflush(stdout);
+	return call_name(FSD_LS_DIR, path, 0);
+}
+
+int fs_readdir(const char *path, unsigned int *pos, struct fs_dirent *entries,
+	       int max)
+{
+	size_t len;
+	int slot, ret;
+
+	if (sock == -1 || !path || !pos || !entries || max < 0)
+		return -1;
+
+	len = strlen(path) + 1;
+	if (len > FSD_SLOT_SIZE)
+		return -1;
+
+	if (max > (int)(FSD_SLOT_SIZE / sizeof(struct fs_dirent)))
+		max = FSD_SLOT_SIZE / sizeof(struct fs_dirent);
+
+	pthread_mutex_lock(&ring_lock);
+	slot = queue(FSD_READDIR, -1, *pos | (uint64_t)max << 32, len, 0);
+	memcpy(ring->data[slot], path, len);
+	ret = submit(-1) ? -1 : ring->sq[slot].result;
+	if (ret > 0) {
+		memcpy(entries, ring->data[slot], ret * sizeof(*entries));
+		*pos = ring->sq[slot].arg;
+	}
+	pthread_mutex_unlock(&ring_lock);
+
+	return ret;
+}
+
+/* Paths go in batches that fit a data slot */
+int fs_stat_many(const char **paths, int count, int *sizes)
+{
+	int found = 0;
+	int done = 0;
+
+	if (sock == -1 || !paths || !sizes || count < 0)
+		return -1;
+
+	while (done < count) {
+		size_t used = 0;
+		int n = 0;
+		int slot, ret;
+
+		while (done + n < count) {
+			const char *path = paths[done + n] ? paths[done + n] : "";
+			size_t len = strlen(path) + 1;
+
+			if (used + len > FSD_SLOT_SIZE)
+				break;
+			used += len;
+			n++;
+		}
+
+		/* A path longer than a slot cannot name a file */
+		if (n == 0) {
+			sizes[done++] = -1;
+			continue;
+		}
+
+		pthread_mutex_lock(&ring_lock);
+		slot = queue(FSD_STAT_MANY, -1, n, used, 0);
+		used = 0;
+		for (int i = 0; i < n; i++) {
+			const char *path = paths[done + i] ? paths[done + i] : "";
+			size_t len = strlen(path) + 1;
+
+			memcpy(ring->data[slot] + used, path, len);
+			used += len;
+		}
+
+		ret = submit(-1) ? -1 : ring->sq[slot].result;
+		if (ret >= 0)
+			memcpy(sizes + done, ring->data[slot], n * sizeof(int));
+		pthread_mutex_unlock(&ring_lock);
+
+		if (ret < 0)
+			return -1;
+		found += ret;
+		done += n;
+	}
+
+	return found;
+}
+
+int fs_open(const char *filename)
+{
+	return call_name(FSD_OPEN, filename, 0);
+}
+
+int fs_open_flags(const char *filename, int flags)
+{
+	return call_name(FSD_OPEN, filename, flags);
+}
+
+int fs_set_open_max(unsigned int max)
+{
+	return call(FSD_OPEN_MAX, -1, max);
+}
+
+int fs_close(int fd)
+{
+	return call(FSD_CLOSE, fd, 0);
+}
+
+int fs_stat(int fd)
+{
+	return call(FSD_STAT, fd, 0);
+}
+
+int fs_lseek(int fd, size_t offset)
+{
+	return call(FSD_LSEEK, fd, offset);
+}
+
+/*
+ * Large transfers are split into one request per data slot and submitted as a
+ * single linked batch, so that the daemon stops at the first short transfer.
+ * Positional requests carry the file offset of each slot, starting at @offset.
+ */
+static int transfer_locked(int op, int fd, char *buf, size_t count,
+			   size_t offset)
+{
+	size_t done = 0;
+
+	if (sock == -1 || !buf)
+		return -1;
+
+	while (done < count) {
+		int slots[FSD_RING_SIZE];
+		size_t queued = 0;
+		int n = 0;
+		int stop = 0;
+
+		while (n < FSD_RING_SIZE && done + queued < count) {
+			size_t len = count - done - queued;
+
+			if (len > FSD_SLOT_SIZE)
+				len = FSD_SLOT_SIZE;
+			slots[n] = queue(op, fd, offset + done + queued, len,
+					 n ? FSD_LINK : 0);
+			if (op == FSD_WRITE || op == FSD_PWRITE)
+				memcpy(ring->data[slots[n]], buf + done + queued,
+				       len);
+			queued += len;
+			n++;
+		}
+
+		if (submit(-1))
+			return done ? (int)done : -1;
+
+		for (int i = 0; i < n && !stop; i++) {
+			struct fsd_sqe *sqe = &ring->sq[slots[i]];
+
+			if (sqe->result < 0)
+				return done ? (int)done : -1;
+
+			if (op == FSD_READ || op == FSD_PREAD)
+				memcpy(buf + done, ring->data[slots[i]],
+				       sqe->result);
+			done += sqe->result;
+			stop = (uint32_t)sqe->result < sqe->len;
+		}
+
+		if (stop)
+			break;
+	}
+
+	return done;
+}
+
+static int transfer(int op, int fd, char *buf, size_t count, size_t offset)
+{
+	int ret;
+
+	pthread_mutex_lock(&ring_lock);
+	ret = transfer_locked(op, fd, buf, count, offset);
+	pthread_mutex_unlock(&ring_lock);
+
+	return ret;
+}
+
+int fs_write(int fd, void *buf, size_t count)
+{
+	return transfer(FSD_WRITE, fd, buf, count, 0);
+}
+
+int fs_read(int fd, void *buf, size_t count)
+{
+	return transfer(FSD_READ, fd, buf, count, 0);
+}
+
+int fs_pread(int fd, void *buf, size_t count, size_t offset)
+{
+	return transfer(FSD_PREAD, fd, buf, count, offset);
+}
+
+int fs_pwrite(int fd, const void *buf, size_t count, size_t offset)
+{
+	return transfer(FSD_PWRITE, fd, (char *)buf, count, offset);
+}
+
+/*
+ * One transfer per buffer under a single hold of ring_lock, so that the
+ * buffers land next to each other, stopping at the first short one
+ */
+static int transferv(int op, int fd, const struct iovec *iov, int iovcnt)
+{
+	size_t total = 0;
+	size_t done = 0;
+
+	if (iovcnt < 0 || (iovcnt > 0 && !iov))
+		return -1;
+
+	/* The byte count must fit the return value */
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > INT_MAX - total)
+			return -1;
+		total += iov[i].iov_len;
+	}
+
+	pthread_mutex_lock(&ring_lock);
+	for (int i = 0; i < iovcnt; i++) {
+		int ret;
+
+		if (iov[i].iov_len == 0)
+			continue;
+
+		ret = transfer_locked(op, fd, iov[i].iov_base, iov[i].iov_len,
+				      0);
+		if (ret < 0) {
+			pthread_mutex_unlock(&ring_lock);
+			return done ? (int)done : -1;
+		}
+
+		done += ret;
+		if ((size_t)ret < iov[i].iov_len)
+			break;
+	}
+	pthread_mutex_unlock(&ring_lock);
+
+	return done;
+}
+
+int fs_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	return transferv(FSD_READ, fd, iov, iovcnt);
+}
+
+int fs_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	return transferv(FSD_WRITE, fd, iov, iovcnt);
+}
+
+/* The disk of the daemon cannot be mapped from here, the range is copied */
+const void *fs_mmap(int fd, size_t offset, size_t len)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t length = (len + page - 1) / page * page;
+	void *addr;
+
+	if (len == 0 || len > INT_MAX)
+		return NULL;
+
+	addr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	if (fs_pread(fd, addr, len, offset) != (int)len ||
+	    mprotect(addr, length, PROT_READ))
+		goto fail;
+
+	pthread_mutex_lock(&map_lock);
+	if (map_count == map_cap) {
+		int cap = map_cap ? map_cap * 2 : 16;
+		struct client_map *grown = realloc(maps, cap * sizeof(*maps));
+
+		if (!grown) {
+			pthread_mutex_unlock(&map_lock);
+			goto fail;
+		}
+		maps = grown;
+		map_cap = cap;
+	}
+	maps[map_count].addr = addr;
+	maps[map_count].length = length;
+	map_count++;
+	pthread_mutex_unlock(&map_lock);
+
+	return addr;
+
+fail:
+	munmap(addr, length);
+	return NULL;
+}
+
+int fs_munmap(const void *addr)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&map_lock);
+	for (int i = 0; i < map_count; i++) {
+		if (maps[i].addr != addr)
+			continue;
+
+		ret = munmap((void *)addr, maps[i].length);
+		maps[i] = maps[--map_count];
+		break;
+	}
+	pthread_mutex_unlock(&map_lock);
+
+	return ret;
+}
+
+int fs_fallocate(int fd, size_t size)
+{
+	return call(FSD_FALLOCATE, fd, size);
+}
+
+int fs_truncate(int fd, size_t size)
+{
+	return call(FSD_TRUNCATE, fd, size);
+}
+
+int fs_export(int fd, int host_fd)
+{
+	return call_host(FSD_EXPORT, fd, host_fd);
+}
+
+int fs_import(int host_fd, int fd)
+{
+	return call_host(FSD_IMPORT, fd, host_fd);
+}
+
+/*
+ * The daemon already runs requests away from the caller, so asynchronous calls
+ * are sent as regular batches and complete before they return: the callback is
+ * called right away, or the completion is queued for fs_async_reap().
+ */
+static int complete(int fd, int result, fs_callback_t callback, void *arg)
+{
+	struct fs_completion *grown;
+	uint64_t one = 1;
+	int ret = 0;
+
+	if (callback) {
+		callback(fd, result, arg);
+		return 0;
+	}
+
+	pthread_mutex_lock(&completed_lock);
+	grown = realloc(completed, (completed_count + 1) * sizeof(*completed));
+	if (!grown) {
+		pthread_mutex_unlock(&completed_lock);
+		return -1;
+	}
+
+	completed = grown;
+	completed[completed_count].fd = fd;
+	completed[completed_count].result = result;
+	completed[completed_count].arg = arg;
+	completed_count++;
+
+	if (completed_event != -1 && write(completed_event, &one, sizeof(one)) < 0)
+		ret = -1;
+	pthread_mutex_unlock(&completed_lock);
+
+	return ret;
+}
+
+int fs_read_async(int fd, void *buf, size_t count, fs_callback_t callback,
+		  void *arg)
+{
+	int ret = transfer(FSD_READ, fd, buf, count, 0);
+
+	if (ret == -1 && sock == -1)
+		return -1;
+
+	return complete(fd, ret, callback, arg);
+}
+
+int fs_write_async(int fd, const void *buf, size_t count,
+		   fs_callback_t callback, void *arg)
+{
+	int ret = transfer(FSD_WRITE, fd, (char *)buf, count, 0);
+
+	if (ret == -1 && sock == -1)
+		return -1;
+
+	return complete(fd, ret, callback, arg);
+}
+
+int fs_async_fd(void)
+{
+	int event;
+
+	pthread_mutex_lock(&completed_lock);
+	if (completed_event == -1)
+		completed_event = eventfd(completed_count, EFD_CLOEXEC | EFD_NONBLOCK |
+				     EFD_SEMAPHORE);
+	event = completed_event;
+	pthread_mutex_unlock(&completed_lock);
+
+	return event;
+}
+
+int fs_async_reap(struct fs_completion *completions, int max)
+{
+	int count;
+	uint64_t one;
+
+	pthread_mutex_lock(&completed_lock);
+	count = completed_count < max ? completed_count : max;
+	if (count < 0)
+		count = 0;
+	memcpy(completions, completed, count * sizeof(*completed));
+	memmove(completed, completed + count, (completed_count - count) * sizeof(*completed));
+	completed_count -= count;
+
+	for (int i = 0; i < count && completed_event != -1; i++)
+		if (read(completed_event, &one, sizeof(one)) < 0)
+			break;
+	pthread_mutex_unlock(&completed_lock);
+
+	return count;
+}
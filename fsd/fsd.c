@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#include "proto.h"
+
+#define fsd_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Most clients served at once */
+#define CLIENT_MAX 64
+
+struct client {
+	/* Connected socket, -1 if the entry is free */
+	int sock;
+	/* Standard output of the client */
+	int out;
+	/* Shared request ring */
+	struct fsd_ring *ring;
+	/* Bitmap of the file descriptors opened by this client */
+	uint64_t *fds;
+	int fd_words;
+};
+
+static struct client clients[CLIENT_MAX];
+
+static volatile sig_atomic_t stopping;
+
+static void stop(int sig)
+{
+	stopping = 1;
+}
+
+/* Whether @fd is one of the client's descriptors */
+static int owned(struct client *c, int fd)
+{
+	if (fd < 0 || fd / 64 >= c->fd_words)
+		return 0;
+
+	return (c->fds[fd / 64] >> (fd % 64)) & 1;
+}
+
+static int own(struct client *c, int fd)
+{
+	if (fd / 64 >= c->fd_words) {
+		int words = fd / 64 + 1;
+		uint64_t *fds = realloc(c->fds, words * sizeof(uint64_t));
+
+		if (!fds)
+			return -1;
+		memset(fds + c->fd_words, 0,
+		       (words - c->fd_words) * sizeof(uint64_t));
+		c->fds = fds;
+		c->fd_words = words;
+	}
+
+	c->fds[fd / 64] |= 1ULL << (fd % 64);
+	return 0;
+}
+
+static void disown(struct client *c, int fd)
+{
+	c->fds[fd / 64] &= ~(1ULL << (fd % 64));
+}
+
+/*
+ * Copy a NULL-terminated file name out of the data slot of an entry into
+ * @name, which the client cannot change behind the daemon's back
+ */
+static const char *slot_name(const char *data, uint32_t len, char *name)
+{
+	if (len == 0 || len > FSD_SLOT_SIZE)
+		return NULL;
+
+	memcpy(name, data, len);
+	if (name[len - 1] != '\0')
+		return NULL;
+
+	return name;
+}
+
+/* Directory listed by ls_dir() */
+static const char *ls_path;
+
+static int ls_dir(void)
+{
+	return fs_ls_dir(ls_path);
+}
+
+/* Run fs_info() or fs_ls() with stdout going to the client */
+static int print_to(struct client *c, int (*func)(void))
+{
+	int saved, ret;
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	dup2(c->out, STDOUT_FILENO);
+	ret = func();
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	return ret;
+}
+
+/* Read directory entries into the data slot the path came in */
+static int readdir_to(struct fsd_sqe *sqe, char *data)
+{
+	char path[FSD_SLOT_SIZE];
+	unsigned int pos = (uint32_t)sqe->arg;
+	int max = sqe->arg >> 32;
+	int ret;
+
+	if (!slot_name(data, sqe->len, path))
+		return -1;
+	if (max > (int)(FSD_SLOT_SIZE / sizeof(struct fs_dirent)))
+		max = FSD_SLOT_SIZE / sizeof(struct fs_dirent);
+
+	ret = fs_readdir(path, &pos, (struct fs_dirent *)data, max);
+	sqe->arg = pos;
+
+	return ret;
+}
+
+/* Look up the sizes of the paths in the data slot, replacing them */
+static int stat_many_to(struct fsd_sqe *sqe, char *data)
+{
+	const char **paths;
+	char *names;
+	int *sizes;
+	int count = sqe->arg;
+	uint32_t off = 0;
+	int ret = -1;
+
+	if (count <= 0 || (uint64_t)count * sizeof(int) > FSD_SLOT_SIZE ||
+	    sqe->len > FSD_SLOT_SIZE)
+		return count == 0 ? 0 : -1;
+
+	/* The paths are split in a copy the client cannot change */
+	paths = malloc(count * sizeof(*paths));
+	sizes = malloc(count * sizeof(*sizes));
+	names = malloc(sqe->len);
+	if (!paths || !sizes || !names)
+		goto out;
+	memcpy(names, data, sqe->len);
+
+	for (int i = 0; i < count; i++) {
+		char *end;
+
+		if (off >= sqe->len ||
+		    !(end = memchr(names + off, '\0', sqe->len - off)))
+			goto out;
+		paths[i] = names + off;
+		off = end - names + 1;
+	}
+
+	ret = fs_stat_many(paths, count, sizes);
+	if (ret >= 0)
+		memcpy(data, sizes, count * sizeof(*sizes));
+
+out:
+	free(paths);
+	free(sizes);
+	free(names);
+	return ret;
+}
+
+/*
+ * Run the request in @sqe, a copy of the entry that the client cannot change
+ * once checked, with @data the entry's data slot
+ */
+static int run(struct client *c, struct fsd_sqe *sqe, char *data, int host_fd)
+{
+	char name_buf[FSD_SLOT_SIZE];
+	const char *name;
+	int fd = sqe->fd;
+	int ret;
+
+	switch (sqe->op) {
+	case FSD_INFO:
+		return print_to(c, fs_info);
+	case FSD_LS:
+		return print_to(c, fs_ls);
+	case FSD_FEATURE:
+		return fs_feature_enable(sqe->arg);
+	case FSD_SCRUB:
+		return fs_scrub();
+	case FSD_SYNC:
+		return fs_sync();
+	case FSD_MEMORY:
+		return fs_memory_usage((struct fs_memory *)data);
+	case FSD_FRAG:
+		return fs_fragmentation((struct fs_fragmentation *)data);
+	case FSD_CREATE:
+		name = slot_name(data, sqe->len, name_buf);
+		return name ? fs_create_mode(name, sqe->arg) : -1;
+	case FSD_DELETE:
+		name = slot_name(data, sqe->len, name_buf);
+		return name ? fs_delete(name) : -1;
+	case FSD_OPEN:
+		name = slot_name(data, sqe->len, name_buf);
+		ret = name ? fs_open_flags(name, sqe->arg) : -1;
+		if (ret >= 0 && own(c, ret)) {
+			fs_close(ret);
+			ret = -1;
+		}
+		return ret;
+	case FSD_OPEN_MAX:
+		return fs_set_open_max(sqe->arg);
+	case FSD_MKDIR:
+		name = slot_name(data, sqe->len, name_buf);
+		return name ? fs_mkdir(name) : -1;
+	case FSD_RMDIR:
+		name = slot_name(data, sqe->len, name_buf);
+		return name ? fs_rmdir(name) : -1;
+	case FSD_LS_DIR:
+		ls_path = slot_name(data, sqe->len, name_buf);
+		return ls_path ? print_to(c, ls_dir) : -1;
+	case FSD_READDIR:
+		return readdir_to(sqe, data);
+	case FSD_STAT_MANY:
+		return stat_many_to(sqe, data);
+	}
+
+	/* Every other operation works on a file descriptor of the client */
+	if (!owned(c, fd))
+		return -1;
+
+	switch (sqe->op) {
+	case FSD_CLOSE:
+		ret = fs_close(fd);
+		if (ret == 0)
+			disown(c, fd);
+		return ret;
+	case FSD_STAT:
+		return fs_stat(fd);
+	case FSD_LSEEK:
+		return fs_lseek(fd, sqe->arg);
+	case FSD_WRITE:
+		return sqe->len <= FSD_SLOT_SIZE ? fs_write(fd, data, sqe->len) : -1;
+	case FSD_READ:
+		return sqe->len <= FSD_SLOT_SIZE ? fs_read(fd, data, sqe->len) : -1;
+	case FSD_PWRITE:
+		return sqe->len <= FSD_SLOT_SIZE ?
+			fs_pwrite(fd, data, sqe->len, sqe->arg) : -1;
+	case FSD_PREAD:
+		return sqe->len <= FSD_SLOT_SIZE ?
+			fs_pread(fd, data, sqe->len, sqe->arg) : -1;
+	case FSD_FALLOCATE:
+		return fs_fallocate(fd, sqe->arg);
+	case FSD_TRUNCATE:
+		return fs_truncate(fd, sqe->arg);
+	case FSD_EXPORT:
+		return host_fd == -1 ? -1 : fs_export(fd, host_fd);
+	case FSD_IMPORT:
+		return host_fd == -1 ? -1 : fs_import(host_fd, fd);
+	}
+
+	return -1;
+}
+
+/* Run every request the client queued, then wake it up */
+static int serve(struct client *c, int host_fd)
+{
+	struct fsd_ring *ring = c->ring;
+	uint32_t head = ring->sq_head;
+	uint32_t tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+	int failed = 0;
+
+	/* A client cannot queue more than the ring holds */
+	if (tail - head > FSD_RING_SIZE)
+		return -1;
+
+	for (; head != tail; head++) {
+		struct fsd_sqe *entry = &ring->sq[head % FSD_RING_SIZE];
+		struct fsd_sqe sqe;
+		int ret;
+
+		/* The client can keep writing to the ring, only a copy is used */
+		memcpy(&sqe, entry, sizeof(sqe));
+
+		/* Linked entries are skipped once an entry falls short */
+		if ((sqe.flags & FSD_LINK) && failed) {
+			entry->result = 0;
+			continue;
+		}
+
+		ret = run(c, &sqe, ring->data[head % FSD_RING_SIZE], host_fd);
+		failed = ret < 0 ||
+			((sqe.op == FSD_READ || sqe.op == FSD_WRITE) &&
+			 (uint32_t)ret < sqe.len);
+
+		/* FSD_READDIR sends the next position back in arg */
+		if (sqe.op == FSD_READDIR)
+			entry->arg = sqe.arg;
+		entry->result = ret;
+	}
+
+	__atomic_store_n(&ring->sq_head, head, __ATOMIC_RELEASE);
+	return fsd_send(c->sock, -1);
+}
+
+static void drop(struct client *c)
+{
+	/* Files left open by the client are closed for it */
+	for (int fd = 0; fd < 64 * c->fd_words; fd++)
+		if (owned(c, fd))
+			fs_close(fd);
+	free(c->fds);
+
+	munmap(c->ring, sizeof(struct fsd_ring));
+	close(c->out);
+	close(c->sock);
+	memset(c, 0, sizeof(*c));
+	c->sock = -1;
+}
+
+static void greet(int listener)
+{
+	struct client *c = NULL;
+	int sock, out, mem;
+
+	sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+	if (sock < 0)
+		return;
+
+	for (int i = 0; i < CLIENT_MAX; i++) {
+		if (clients[i].sock == -1) {
+			c = &clients[i];
+			break;
+		}
+	}
+
+	/* The hello byte carries the client's standard output */
+	if (!c || fsd_recv(sock, &out) != 1 || out == -1) {
+		close(sock);
+		return;
+	}
+
+	mem = memfd_create("fsd-ring", MFD_CLOEXEC);
+	if (mem < 0 || ftruncate(mem, sizeof(struct fsd_ring)) < 0)
+		goto fail;
+
+	c->ring = mmap(NULL, sizeof(struct fsd_ring), PROT_READ | PROT_WRITE,
+		       MAP_SHARED, mem, 0);
+	if (c->ring == MAP_FAILED)
+		goto fail;
+
+	if (fsd_send(sock, mem)) {
+		munmap(c->ring, sizeof(struct fsd_ring));
+		goto fail;
+	}
+
+	close(mem);
+	c->sock = sock;
+	c->out = out;
+	c->fds = NULL;
+	c->fd_words = 0;
+	return;
+
+fail:
+	fsd_error("cannot set up client");
+	if (mem >= 0)
+		close(mem);
+	close(out);
+	close(sock);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct pollfd fds[CLIENT_MAX + 1];
+	struct sigaction sa = { .sa_handler = stop };
+	char path[sizeof(addr.sun_path)];
+	const char *budget;
+	int listener, flags = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <diskname> [<socket>]\n", argv[0]);
+		exit(1);
+	}
+
+	if (argc > 2)
+		snprintf(path, sizeof(path), "%s", argv[2]);
+	else
+		snprintf(path, sizeof(path), "%s%s", argv[1], FSD_SOCKET_SUFFIX);
+
+	/*
+	 * FSD_BUDGET bounds the memory of the mount, see fs_mount_budget(), and
+	 * FSD_WRITEBACK set to 1 writes blocks back in the background and
+	 * FSD_PUNCH set to 1 gives the blocks of deleted files back to the host
+	 */
+	budget = getenv("FSD_BUDGET");
+	if (getenv("FSD_WRITEBACK") && !strcmp(getenv("FSD_WRITEBACK"), "1"))
+		flags |= FS_MOUNT_WRITEBACK;
+	if (getenv("FSD_PUNCH") && !strcmp(getenv("FSD_PUNCH"), "1"))
+		flags |= FS_MOUNT_PUNCH;
+	if (fs_mount_budget(argv[1], flags,
+			    budget ? strtoull(budget, NULL, 0) : 0)) {
+		fsd_error("cannot mount '%s'", argv[1]);
+		exit(1);
+	}
+
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&addr,
+				 sizeof(addr)) < 0 || listen(listener, 16) < 0) {
+		perror("socket");
+		fs_umount();
+		exit(1);
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	for (int i = 0; i < CLIENT_MAX; i++)
+		clients[i].sock = -1;
+
+	while (!stopping) {
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		for (int i = 0; i < CLIENT_MAX; i++) {
+			fds[i + 1].fd = clients[i].sock;
+			fds[i + 1].events = POLLIN;
+		}
+
+		if (poll(fds, CLIENT_MAX + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (fds[0].revents & POLLIN)
+			greet(listener);
+
+		/* Every client with a kick pending gets its batch run */
+		for (int i = 0; i < CLIENT_MAX; i++) {
+			struct client *c = &clients[i];
+			int host_fd;
+
+			if (c->sock == -1 || !fds[i + 1].revents)
+				continue;
+
+			if (fsd_recv(c->sock, &host_fd) != 1 ||
+			    serve(c, host_fd)) {
+				if (host_fd != -1)
+					close(host_fd);
+				drop(c);
+				continue;
+			}
+
+			if (host_fd != -1)
+				close(host_fd);
+		}
+	}
+
+	for (int i = 0; i < CLIENT_MAX; i++)
+		if (clients[i].sock != -1)
+			drop(&clients[i]);
+
+	close(listener);
+	unlink(path);
+
+	if (fs_umount()) {
+		fsd_error("cannot unmount '%s'", argv[1]);
+		exit(1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,106 @@
+#ifndef _PROTO_H
+#define _PROTO_H
+
+#include <stdint.h>
+
+/*
+ * Protocol between fsd.x and the client library.
+ *
+ * A client connects to the daemon's Unix domain socket and sends one byte
+ * carrying its standard output with SCM_RIGHTS, so that fs_info() and fs_ls()
+ * print where the client expects them. The daemon answers with one byte
+ * carrying a memfd holding a struct fsd_ring, which both sides map.
+ *
+ * Requests are queued in the submission ring and the client then sends one
+ * byte (the kick) over the socket, with a host file descriptor attached for
+ * fs_export() and fs_import(). The daemon runs every queued request in order,
+ * stores each result in its entry, moves sq_head up to sq_tail and sends one
+ * byte back. Entry i uses data slot i for file names and file data.
+ */
+
+/* Number of entries in the submission ring */
+#define FSD_RING_SIZE 32
+
+/* Bytes of data that travel with one entry */
+#define FSD_SLOT_SIZE (64 * 1024)
+
+/* Entry only runs if the previous entry completed in full */
+#define FSD_LINK 0x01
+
+enum fsd_op {
+	FSD_INFO,
+	FSD_LS,
+	FSD_FEATURE,
+	FSD_SCRUB,
+	FSD_CREATE,
+	FSD_DELETE,
+	/* FS_OPEN_* flags in arg */
+	FSD_OPEN,
+	FSD_CLOSE,
+	FSD_STAT,
+	FSD_LSEEK,
+	FSD_WRITE,
+	FSD_READ,
+	FSD_FALLOCATE,
+	FSD_TRUNCATE,
+	FSD_EXPORT,
+	FSD_IMPORT,
+	FSD_OPEN_MAX,
+	FSD_MKDIR,
+	FSD_RMDIR,
+	FSD_LS_DIR,
+	/* Position in the low 32 bits of arg, entry count in the high ones */
+	FSD_READDIR,
+	/* Paths one after the other in the data slot, sizes sent back there */
+	FSD_STAT_MANY,
+	/* struct fs_memory sent back in the data slot */
+	FSD_MEMORY,
+	/* File offset in arg, the offset of the fd is left alone */
+	FSD_PREAD,
+	FSD_PWRITE,
+	FSD_SYNC,
+	/* struct fs_fragmentation sent back in the data slot */
+	FSD_FRAG,
+};
+
+struct fsd_sqe {
+	/* Operation, one of enum fsd_op */
+	uint16_t op;
+	/* FSD_LINK or 0 */
+	uint16_t flags;
+	/* File descriptor in the daemon */
+	int32_t fd;
+	/* Size, offset, mode or features depending on the operation */
+	uint64_t arg;
+	/* Bytes used in the data slot */
+	uint32_t len;
+	/* Return value of the operation, set by the daemon */
+	int32_t result;
+};
+
+struct fsd_ring {
+	/* Next entry the client fills, written by the client */
+	uint32_t sq_tail;
+	/* Next entry the daemon runs, written by the daemon */
+	uint32_t sq_head;
+	struct fsd_sqe sq[FSD_RING_SIZE];
+	char data[FSD_RING_SIZE][FSD_SLOT_SIZE];
+};
+
+/* Socket of the daemon serving @diskname when FSD_SOCKET is not set */
+#define FSD_SOCKET_SUFFIX ".sock"
+
+/*
+ * Send one byte over @sock, with @fd attached unless it is -1.
+ * Return -1 on failure, 0 otherwise.
+ */
+int fsd_send(int sock, int fd);
+
+/*
+ * Receive one byte from @sock. An attached file descriptor is stored in @fd,
+ * which is set to -1 when none came with the byte.
+ * Return -1 on failure, 0 if the peer hung up, 1 otherwise.
+ */
+int fsd_recv(int sock, int *fd);
+
+#endif /* _PROTO_H */
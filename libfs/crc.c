@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "crc.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define HAVE_CRC_HW 1
+#endif
+
+/* Reversed CRC32C polynomial */
+#define POLY 0x82F63B78
+
+/* Bytes per stream in one step of the three way hardware loop */
+#define LANE 1360
+
+/* Slicing tables for the software implementation */
+static uint32_t table[8][256];
+
+/* Tables appending LANE zero bytes to a raw checksum register */
+static uint32_t shift[4][256];
+
+static int ready;
+static int hw;
+
+/* Update raw register @crc with @len bytes, one byte at a time */
+static uint32_t raw_bytes(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len--)
+		crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return crc;
+}
+
+/* Update raw register @crc with @len bytes, eight bytes at a time */
+static uint32_t raw_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len >= 8) {
+		uint32_t lo, hi;
+
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+		crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+			table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+			table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+			table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+
+	return raw_bytes(crc, p, len);
+}
+
+/* Raw register after LANE more zero bytes */
+static uint32_t raw_shift(uint32_t crc)
+{
+	return shift[0][crc & 0xFF] ^ shift[1][(crc >> 8) & 0xFF] ^
+		shift[2][(crc >> 16) & 0xFF] ^ shift[3][crc >> 24];
+}
+
+static void init(void)
+{
+	static const uint8_t zeros[LANE];
+
+	for (int i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (POLY & -(crc & 1));
+		table[0][i] = crc;
+	}
+
+	for (int i = 0; i < 256; i++)
+		for (int k = 1; k < 8; k++)
+			table[k][i] = (table[k - 1][i] >> 8) ^
+				table[0][table[k - 1][i] & 0xFF];
+
+	/* Appending zeros is linear in the register, so do it per byte */
+	for (int k = 0; k < 4; k++)
+		for (int i = 0; i < 256; i++)
+			shift[k][i] = raw_sw((uint32_t)i << (8 * k), zeros,
+					     LANE);
+
+#ifdef HAVE_CRC_HW
+	__builtin_cpu_init();
+	hw = !!__builtin_cpu_supports("sse4.2");
+#endif
+	ready = 1;
+}
+
+#ifdef HAVE_CRC_HW
+__attribute__((target("sse4.2")))
+static uint32_t raw_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64_t a = crc;
+
+	/* Three streams in flight hide the latency of crc32 */
+	while (len >= 3 * LANE) {
+		uint64_t b = 0, c = 0;
+		uint64_t x, y, z;
+
+		for (size_t i = 0; i < LANE; i += 8) {
+			memcpy(&x, p + i, 8);
+			memcpy(&y, p + LANE + i, 8);
+			memcpy(&z, p + 2 * LANE + i, 8);
+			a = _mm_crc32_u64(a, x);
+			b = _mm_crc32_u64(b, y);
+			c = _mm_crc32_u64(c, z);
+		}
+
+		a = raw_shift(raw_shift(a) ^ b) ^ c;
+		p += 3 * LANE;
+		len -= 3 * LANE;
+	}
+
+	while (len >= 8) {
+		uint64_t x;
+
+		memcpy(&x, p, 8);
+		a = _mm_crc32_u64(a, x);
+		p += 8;
+		len -= 8;
+	}
+
+	crc = a;
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return crc;
+}
+#endif
+
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+	if (!ready)
+		init();
+
+	return ~raw_sw(~crc, buf, len);
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	if (!ready)
+		init();
+
+#ifdef HAVE_CRC_HW
+	if (hw)
+		return ~raw_hw(~crc, buf, len);
+#endif
+
+	return ~raw_sw(~crc, buf, len);
+}
+
+int crc32c_hw_available(void)
+{
+	if (!ready)
+		init();
+
+	return hw;
+}
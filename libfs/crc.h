@@ -0,0 +1,42 @@
+#ifndef _CRC_H
+#define _CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * crc32c - Compute a CRC32C (Castagnoli) checksum
+ * @crc: Checksum of the preceding data, or 0 to start a new checksum
+ * @buf: Data to checksum
+ * @len: Number of bytes in @buf
+ *
+ * Extend checksum @crc with @len bytes of @buf. On x86 processors with SSE4.2,
+ * the crc32 instruction is used on three independent streams at once so that
+ * its latency is hidden, and the three partial checksums are combined with
+ * precomputed tables. Other processors use a table driven implementation that
+ * consumes eight bytes per step.
+ *
+ * Return: the updated checksum.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * crc32c_sw - Compute a CRC32C checksum without hardware support
+ * @crc: Checksum of the preceding data, or 0 to start a new checksum
+ * @buf: Data to checksum
+ * @len: Number of bytes in @buf
+ *
+ * Same as crc32c() but always uses the table driven implementation.
+ *
+ * Return: the updated checksum.
+ */
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * crc32c_hw_available - Check for hardware CRC32C support
+ *
+ * Return: 1 if crc32c() uses processor instructions. 0 otherwise.
+ */
+int crc32c_hw_available(void);
+
+#endif /* _CRC_H */
@@ -1,11 +1,22 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "crc.h"
 #include "disk.h"
+#include "events.h"
 
 #define block_error(fmt, ...) \
 	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
@@ -13,20 +24,480 @@
 /* Invalid file descriptor */
 #define INVALID_FD -1
 
+/* Alignment required for buffers of direct I/O */
+#define BLOCK_ALIGN 4096
+
+/* Number of free buffers kept around by the buffer pool */
+#define POOL_MAX 16
+
 /* Disk instance description */
 struct disk {
 	/* File descriptor */
 	int fd;
 	/* Block count */
 	size_t bcount;
+	/* Opened with O_DIRECT, bypassing the page cache */
+	int direct;
+};
+
+/* Number of blocks read at once by block_csum_verify() */
+#define VERIFY_BATCH 32
+
+/* Default write-back thresholds */
+#define WB_DIRTY_BYTES (16 * 1024 * 1024)
+#define WB_BACKGROUND_PCT 50
+#define WB_EXPIRE_MS 1000
+
+/* In-memory copy of a block waiting to be written back */
+struct wb_block {
+	/* Index of the block */
+	size_t block;
+	/* When the block was first dirtied, in milliseconds */
+	uint64_t dirtied;
+	/* Next dirty block in dirtying order */
+	struct wb_block *next;
+	/* Being written back, a new write goes to a new copy */
+	int flushing;
+	/* Content of the block, aligned for direct I/O */
+	void *data;
 };
 
 /* Currently open virtual disk (invalid by default) */
 static struct disk disk = { .fd = INVALID_FD };
 
+size_t block_size_current = BLOCK_SIZE_DEFAULT;
+
+/* Size of the virtual disk file in bytes */
+static size_t disk_bytes;
+
+/* Checksum of every block, NULL when blocks are not checked */
+static uint32_t *csum;
+
+/* Write-back state of the open disk, guarded by lock */
+static struct {
+	pthread_mutex_t lock;
+	/* Wakes the flusher up */
+	pthread_cond_t work;
+	/* Signalled each time the flusher finishes a batch */
+	pthread_cond_t done;
+	pthread_t flusher;
+	/* Open disk was opened with BLOCK_DISK_WRITEBACK */
+	int on;
+	/* Flusher exits once nothing is dirty */
+	int stop;
+	/* Callers of block_sync() waiting for the flusher */
+	int syncing;
+	/* Writing back failed since the last block_sync() */
+	int error;
+	/* Newest in-memory copy of each block, NULL if the disk is current */
+	struct wb_block **map;
+	/* Dirty blocks not being written back yet, oldest first */
+	struct wb_block *head, *tail;
+	/* Written back blocks kept for reuse, linked by next */
+	struct wb_block *spare;
+	/* Blocks being written back */
+	size_t flushing;
+	/* Thresholds, a dirty_max of 0 meaning WB_DIRTY_BYTES worth */
+	struct block_writeback tune;
+	struct block_writeback_stats stats;
+} wb = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.tune = {
+		.background_pct = WB_BACKGROUND_PCT,
+		.expire_ms = WB_EXPIRE_MS,
+	},
+};
+
+/* Aligned block buffers ready for reuse */
+static struct {
+	void *free[POOL_MAX];
+	int count;
+} pool;
+
+void *block_buffer_get(void)
+{
+	void *buf;
+
+	if (pool.count > 0)
+		return pool.free[--pool.count];
+
+	if (posix_memalign(&buf, BLOCK_ALIGN, BLOCK_SIZE)) {
+		block_error("cannot allocate aligned buffer");
+		return NULL;
+	}
+
+	return buf;
+}
+
+void block_buffer_put(void *buf)
+{
+	if (!buf)
+		return;
+
+	if (pool.count < POOL_MAX) {
+		pool.free[pool.count++] = buf;
+		return;
+	}
+
+	free(buf);
+}
+
+/* Whether @buf cannot be handed to the kernel as is */
+static int needs_bounce(const void *buf)
+{
+	return disk.direct && ((uintptr_t)buf % BLOCK_ALIGN) != 0;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Dirty blocks at which writers wait for the flusher */
+static size_t wb_dirty_max(void)
+{
+	if (wb.tune.dirty_max)
+		return wb.tune.dirty_max;
+	return WB_DIRTY_BYTES / BLOCK_SIZE;
+}
+
+/* Whether enough blocks are dirty to write them all back right away */
+static int wb_background(void)
+{
+	return wb.stats.dirty * 100 >= wb_dirty_max() * wb.tune.background_pct;
+}
+
+static int wb_compare(const void *a, const void *b)
+{
+	const struct wb_block *x = *(struct wb_block * const *)a;
+	const struct wb_block *y = *(struct wb_block * const *)b;
+
+	return (x->block > y->block) - (x->block < y->block);
+}
+
+/*
+ * Write @n blocks sorted by index back to the disk with one system call per
+ * run of consecutive blocks, counting the calls in @writes
+ */
+static int wb_write(struct wb_block **batch, size_t n, size_t *writes)
+{
+	struct iovec iov[IOV_MAX];
+	size_t i = 0;
+	int ret = 0;
+	EVENT_SCOPE(__func__);
+
+	while (i < n) {
+		size_t run = 1;
+
+		while (i + run < n && run < IOV_MAX &&
+		       batch[i + run]->block == batch[i]->block + run)
+			run++;
+
+		for (size_t j = 0; j < run; j++) {
+			iov[j].iov_base = batch[i + j]->data;
+			iov[j].iov_len = BLOCK_SIZE;
+		}
+
+		if (pwritev(disk.fd, iov, run, batch[i]->block * BLOCK_SIZE) !=
+		    (ssize_t)(run * BLOCK_SIZE)) {
+			perror("write");
+			ret = -1;
+		}
+
+		(*writes)++;
+		i += run;
+	}
+
+	return ret;
+}
+
+/* Sleep until @ms milliseconds from now, or until woken up */
+static void wb_wait(uint64_t ms)
+{
+	struct timespec until;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += ms / 1000;
+	until.tv_nsec += (ms % 1000) * 1000000;
+	if (until.tv_nsec >= 1000000000) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&wb.work, &wb.lock, &until);
+}
+
+/*
+ * Flusher thread: write back expired blocks in age order or, past the
+ * background threshold, every dirty block, in batches sorted by block index
+ */
+static void *wb_flusher(void *arg)
+{
+	pthread_mutex_lock(&wb.lock);
+	for (;;) {
+		struct wb_block **batch, *b;
+		int all = wb.stop || wb.syncing || wb_background();
+		uint64_t now = now_ms();
+		size_t n = 0, writes = 0;
+		int ret;
+
+		if (!wb.head) {
+			if (wb.stop)
+				break;
+			pthread_cond_wait(&wb.work, &wb.lock);
+			continue;
+		}
+
+		if (!all && wb.head->dirtied + wb.tune.expire_ms > now) {
+			wb_wait(wb.head->dirtied + wb.tune.expire_ms - now);
+			continue;
+		}
+
+		/* The whole list, or its expired head */
+		for (b = wb.head; b; b = b->next) {
+			if (!all && b->dirtied + wb.tune.expire_ms > now)
+				break;
+			n++;
+		}
+
+		batch = malloc(n * sizeof(*batch));
+		if (!batch) {
+			wb_wait(wb.tune.expire_ms);
+			continue;
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			batch[i] = wb.head;
+			batch[i]->flushing = 1;
+			wb.head = wb.head->next;
+		}
+		if (!wb.head)
+			wb.tail = NULL;
+		wb.stats.dirty -= n;
+		wb.flushing = n;
+		pthread_cond_broadcast(&wb.done);
+		pthread_mutex_unlock(&wb.lock);
+
+		qsort(batch, n, sizeof(*batch), wb_compare);
+		ret = wb_write(batch, n, &writes);
+
+		pthread_mutex_lock(&wb.lock);
+		for (size_t i = 0; i < n; i++) {
+			if (wb.map[batch[i]->block] == batch[i])
+				wb.map[batch[i]->block] = NULL;
+			batch[i]->next = wb.spare;
+			wb.spare = batch[i];
+		}
+		free(batch);
+
+		wb.flushing = 0;
+		wb.stats.blocks += n;
+		wb.stats.writes += writes;
+		wb.stats.batches++;
+		if (ret)
+			wb.error = 1;
+		pthread_cond_broadcast(&wb.done);
+	}
+	pthread_mutex_unlock(&wb.lock);
+
+	return NULL;
+}
+
+/* Free the blocks kept for reuse, which all have the current block size */
+static void wb_drain(void)
+{
+	while (wb.spare) {
+		struct wb_block *b = wb.spare;
+
+		wb.spare = b->next;
+		free(b->data);
+		free(b);
+	}
+}
+
+/* Copy @buf into the newest in-memory copy of @block, dirtying it */
+static int wb_store(size_t block, const void *buf)
+{
+	struct wb_block *b;
+	int throttled = 0;
+
+	pthread_mutex_lock(&wb.lock);
+	b = wb.map[block];
+	if (!b || b->flushing) {
+		/* A new dirty block needs room */
+		while (wb.stats.dirty >= wb_dirty_max()) {
+			throttled = 1;
+			pthread_cond_signal(&wb.work);
+			pthread_cond_wait(&wb.done, &wb.lock);
+		}
+		wb.stats.throttled += throttled;
+
+		if (wb.spare) {
+			b = wb.spare;
+			wb.spare = b->next;
+		} else if (!(b = malloc(sizeof(*b))) ||
+			   posix_memalign(&b->data, BLOCK_ALIGN, BLOCK_SIZE)) {
+			pthread_mutex_unlock(&wb.lock);
+			free(b);
+			block_error("cannot allocate dirty block");
+			return -1;
+		}
+
+		b->block = block;
+		b->dirtied = now_ms();
+		b->flushing = 0;
+		b->next = NULL;
+		if (wb.tail)
+			wb.tail->next = b;
+		else
+			wb.head = b;
+		wb.tail = b;
+		wb.map[block] = b;
+		wb.stats.dirty++;
+
+		/* The flusher sleeps without a deadline on an empty list */
+		if (wb.head == b || wb_background())
+			pthread_cond_signal(&wb.work);
+	}
+
+	memcpy(b->data, buf, BLOCK_SIZE);
+	if (csum)
+		csum[block] = crc32c(0, buf, BLOCK_SIZE);
+	pthread_mutex_unlock(&wb.lock);
+
+	return 0;
+}
+
+/* Copy the in-memory copy of @block into @buf, -1 if the disk is current */
+static int wb_load(size_t block, void *buf)
+{
+	struct wb_block *b;
+
+	pthread_mutex_lock(&wb.lock);
+	b = wb.map[block];
+	if (b)
+		memcpy(buf, b->data, BLOCK_SIZE);
+	pthread_mutex_unlock(&wb.lock);
+
+	return b ? 0 : -1;
+}
+
+/* Start write-back on the open disk */
+static int wb_start(void)
+{
+	wb.map = calloc(disk.bcount, sizeof(*wb.map));
+	if (!wb.map) {
+		block_error("cannot allocate write-back map");
+		return -1;
+	}
+
+	memset(&wb.stats, 0, sizeof(wb.stats));
+	wb.stop = 0;
+	wb.error = 0;
+	if (pthread_create(&wb.flusher, NULL, wb_flusher, NULL)) {
+		block_error("cannot start flusher");
+		free(wb.map);
+		wb.map = NULL;
+		return -1;
+	}
+	wb.on = 1;
+
+	return 0;
+}
+
+/* Write every dirty block back and stop the flusher */
+static int wb_stop(void)
+{
+	int error;
+
+	pthread_mutex_lock(&wb.lock);
+	wb.stop = 1;
+	pthread_cond_signal(&wb.work);
+	pthread_mutex_unlock(&wb.lock);
+	pthread_join(wb.flusher, NULL);
+
+	error = wb.error;
+	wb_drain();
+	free(wb.map);
+	wb.map = NULL;
+	wb.on = 0;
+
+	return error ? -1 : 0;
+}
+
+int block_writeback_tune(const struct block_writeback *tune)
+{
+	if (tune && (tune->dirty_max == 0 || tune->background_pct > 100)) {
+		block_error("invalid write-back thresholds");
+		return -1;
+	}
+
+	pthread_mutex_lock(&wb.lock);
+	if (tune) {
+		wb.tune = *tune;
+	} else {
+		wb.tune.dirty_max = 0;
+		wb.tune.background_pct = WB_BACKGROUND_PCT;
+		wb.tune.expire_ms = WB_EXPIRE_MS;
+	}
+	pthread_cond_signal(&wb.work);
+	pthread_mutex_unlock(&wb.lock);
+
+	return 0;
+}
+
+int block_writeback_stats(struct block_writeback_stats *stats)
+{
+	if (disk.fd == INVALID_FD || !wb.on) {
+		block_error("no write-back disk currently open");
+		return -1;
+	}
+
+	pthread_mutex_lock(&wb.lock);
+	*stats = wb.stats;
+	pthread_mutex_unlock(&wb.lock);
+
+	return 0;
+}
+
+int block_sync(void)
+{
+	int ret;
+
+	if (disk.fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (!wb.on)
+		return 0;
+
+	pthread_mutex_lock(&wb.lock);
+	wb.syncing++;
+	pthread_cond_signal(&wb.work);
+	while (wb.head || wb.flushing)
+		pthread_cond_wait(&wb.done, &wb.lock);
+	wb.syncing--;
+	ret = wb.error ? -1 : 0;
+	wb.error = 0;
+	pthread_mutex_unlock(&wb.lock);
+
+	return ret;
+}
+
 int block_disk_open(const char *diskname)
+{
+	return block_disk_open_flags(diskname, 0);
+}
+
+int block_disk_open_flags(const char *diskname, int flags)
 {
 	int fd;
+	int oflags = O_RDWR;
 	struct stat st;
 
 	if (!diskname) {
@@ -39,7 +510,10 @@ int block_disk_open(const char *diskname)
 		return -1;
 	}
 
-	if ((fd = open(diskname, O_RDWR, 0644)) < 0) {
+	if (flags & BLOCK_DISK_DIRECT)
+		oflags |= O_DIRECT;
+
+	if ((fd = open(diskname, oflags, 0644)) < 0) {
 		perror("open");
 		return -1;
 	}
@@ -49,31 +523,104 @@ int block_disk_open(const char *diskname)
 		return -1;
 	}
 
-	/* The disk image's size should be a multiple of the block size */
-	if (st.st_size % BLOCK_SIZE != 0) {
+	/*
+	 * The disk image's size should be a multiple of the smallest block
+	 * size, block_disk_set_size() checks it against the actual one
+	 */
+	if (st.st_size % BLOCK_SIZE_MIN != 0) {
 		block_error("size '%zu' is not multiple of '%d'",
-			    st.st_size, BLOCK_SIZE);
+			    st.st_size, BLOCK_SIZE_MIN);
+		close(fd);
 		return -1;
 	}
 
 	disk.fd = fd;
+	disk_bytes = st.st_size;
 	disk.bcount = st.st_size / BLOCK_SIZE;
+	disk.direct = !!(flags & BLOCK_DISK_DIRECT);
+
+	if ((flags & BLOCK_DISK_WRITEBACK) && wb_start()) {
+		close(fd);
+		disk.fd = INVALID_FD;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Free the pooled buffers, which all have the current block size */
+static void pool_drain(void)
+{
+	while (pool.count > 0)
+		free(pool.free[--pool.count]);
+}
+
+int block_disk_set_size(size_t size)
+{
+	if (disk.fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (size < BLOCK_SIZE_MIN || size > BLOCK_SIZE_MAX ||
+	    (size & (size - 1)) != 0) {
+		block_error("invalid block size '%zu'", size);
+		return -1;
+	}
+
+	if (disk_bytes % size != 0) {
+		block_error("size '%zu' is not multiple of '%zu'",
+			    disk_bytes, size);
+		return -1;
+	}
+
+	if (size != block_size_current) {
+		/* The write-back map is indexed by block */
+		if (wb.on) {
+			struct wb_block **map;
+
+			if (block_sync())
+				return -1;
+			map = calloc(disk_bytes / size, sizeof(*map));
+			if (!map) {
+				block_error("cannot allocate write-back map");
+				return -1;
+			}
+			free(wb.map);
+			wb.map = map;
+			wb_drain();
+		}
+
+		pool_drain();
+		block_size_current = size;
+	}
+	disk.bcount = disk_bytes / size;
 
 	return 0;
 }
 
 int block_disk_close(void)
 {
+	int ret = 0;
+
 	if (disk.fd == INVALID_FD) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
+	if (wb.on)
+		ret = wb_stop();
+	csum = NULL;
+
 	close(disk.fd);
 
 	disk.fd = INVALID_FD;
 
-	return 0;
+	/* Give the pooled buffers back */
+	pool_drain();
+	block_size_current = BLOCK_SIZE_DEFAULT;
+
+	return ret;
 }
 
 int block_disk_count(void)
@@ -88,6 +635,10 @@ int block_disk_count(void)
 
 int block_write(size_t block, const void *buf)
 {
+	void *bounce = NULL;
+	ssize_t ret;
+	EVENT_SCOPE(__func__);
+
 	if (disk.fd == INVALID_FD) {
 		block_error("no disk currently open");
 		return -1;
@@ -99,14 +650,24 @@ int block_write(size_t block, const void *buf)
 		return -1;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
-		return -1;
+	if (wb.on)
+		return wb_store(block, buf);
+
+	/* Direct I/O needs an aligned buffer */
+	if (needs_bounce(buf)) {
+		bounce = block_buffer_get();
+		if (!bounce)
+			return -1;
+		memcpy(bounce, buf, BLOCK_SIZE);
+		buf = bounce;
 	}
 
 	/* Perform the actual write into the disk image */
-	if (write(disk.fd, buf, BLOCK_SIZE) < 0) {
+	ret = pwrite(disk.fd, buf, BLOCK_SIZE, block * BLOCK_SIZE);
+	if (ret >= 0 && csum)
+		csum[block] = crc32c(0, buf, BLOCK_SIZE);
+	block_buffer_put(bounce);
+	if (ret < 0) {
 		perror("write");
 		return -1;
 	}
@@ -116,33 +677,437 @@ int block_write(size_t block, const void *buf)
 
 int block_read(size_t block, void *buf)
 {
+	void *bounce = NULL;
+	ssize_t ret;
+	EVENT_SCOPE(__func__);
+
 	if (disk.fd == INVALID_FD) {
-		printf("woohoo1\n");
 		block_error("no disk currently open");
 		return -1;
 	}
 
 	if (block >= disk.bcount) {
-		printf("woohoo2\n");
 		block_error("block index out of bounds (%zu/%zu)",
 			    block, disk.bcount);
 		return -1;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		printf("woohoo3\n");
-		perror("lseek");
-		return -1;
+	/* A dirty block is newer than the disk */
+	if (wb.on && wb_load(block, buf) == 0)
+		return 0;
+
+	/* Direct I/O needs an aligned buffer */
+	if (needs_bounce(buf)) {
+		bounce = block_buffer_get();
+		if (!bounce)
+			return -1;
 	}
 
 	/* Perform the actual read from the disk image */
-	if (read(disk.fd, buf, BLOCK_SIZE) < 0) {
-		printf("woohoo4\n");
+	ret = pread(disk.fd, bounce ? bounce : buf, BLOCK_SIZE,
+		    block * BLOCK_SIZE);
+	if (ret >= 0 && bounce)
+		memcpy(buf, bounce, BLOCK_SIZE);
+	block_buffer_put(bounce);
+	if (ret < 0) {
 		perror("read");
 		return -1;
 	}
 
+	if (csum && crc32c(0, buf, BLOCK_SIZE) != csum[block]) {
+		block_error("checksum mismatch on block %zu", block);
+		return -1;
+	}
+
 	return 0;
 }
 
+/* Whether the kernel cannot move data between these two descriptors directly */
+static int copy_unsupported(void)
+{
+	return errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+		errno == EOPNOTSUPP || errno == EBADF;
+}
+
+/* Check that a byte range of @len bytes at @offset in @block is on disk */
+static int range_check(size_t block, size_t offset, size_t len)
+{
+	if (disk.fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (block >= disk.bcount ||
+	    block * BLOCK_SIZE + offset + len > disk.bcount * BLOCK_SIZE) {
+		block_error("range out of bounds (%zu+%zu+%zu/%zu)",
+			    block, offset, len, disk.bcount);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Read @count clean blocks into @buf with a single system call */
+static int read_clean(size_t block, size_t count, char *buf)
+{
+	size_t len = count * BLOCK_SIZE;
+	void *bounce = NULL;
+	ssize_t ret;
+
+	/* Not from the pool, which is not shared between threads */
+	if (needs_bounce(buf) && posix_memalign(&bounce, BLOCK_ALIGN, len)) {
+		block_error("cannot allocate aligned buffer");
+		return -1;
+	}
+
+	ret = pread(disk.fd, bounce ? bounce : buf, len, block * BLOCK_SIZE);
+	if (ret == (ssize_t)len && bounce)
+		memcpy(buf, bounce, len);
+	free(bounce);
+	if (ret != (ssize_t)len) {
+		perror("read");
+		return -1;
+	}
+
+	for (size_t i = 0; csum && i < count; i++) {
+		if (crc32c(0, buf + i * BLOCK_SIZE, BLOCK_SIZE) !=
+		    csum[block + i]) {
+			block_error("checksum mismatch on block %zu",
+				    block + i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int block_read_run(size_t block, size_t count, void *buf)
+{
+	char *p = buf;
+	size_t i = 0;
+	EVENT_SCOPE(__func__);
+
+	if (range_check(block, 0, count * BLOCK_SIZE))
+		return -1;
+
+	while (i < count) {
+		size_t clean = 0;
+
+		/*
+		 * Dirty blocks are copied before the disk is read: a block
+		 * found clean stays so, a block found dirty might be written
+		 * back and forgotten right after
+		 */
+		if (wb.on) {
+			pthread_mutex_lock(&wb.lock);
+			while (i < count && wb.map[block + i]) {
+				memcpy(p + i * BLOCK_SIZE,
+				       wb.map[block + i]->data, BLOCK_SIZE);
+				i++;
+			}
+			while (i + clean < count && !wb.map[block + i + clean])
+				clean++;
+			pthread_mutex_unlock(&wb.lock);
+		} else {
+			clean = count - i;
+		}
+
+		if (clean && read_clean(block + i, clean, p + i * BLOCK_SIZE))
+			return -1;
+		i += clean;
+	}
+
+	return 0;
+}
+
+int block_copy_out(size_t block, size_t offset, size_t len, int fd)
+{
+	char *buf = NULL;
+	loff_t pos;
+	size_t done = 0;
+
+	if (range_check(block, offset, len))
+		return -1;
+
+	pos = block * BLOCK_SIZE + offset;
+	while (done < len) {
+		ssize_t ret;
+
+		/* Zero copy first: file to file, then file to pipe */
+		ret = -1;
+		errno = EOPNOTSUPP;
+		if (!csum && !wb.on)
+			ret = copy_file_range(disk.fd, &pos, fd, NULL,
+					      len - done, 0);
+		if (ret < 0 && !csum && !wb.on && copy_unsupported())
+			ret = splice(disk.fd, &pos, fd, NULL, len - done, 0);
+
+		/* Bounded bounce buffer when the kernel cannot do it */
+		if (ret < 0 && copy_unsupported()) {
+			size_t in = pos % BLOCK_SIZE;
+			size_t chunk = BLOCK_SIZE - in;
+
+			if (chunk > len - done)
+				chunk = len - done;
+			ret = -1;
+			if (buf || (buf = block_buffer_get()))
+				ret = block_read(pos / BLOCK_SIZE, buf);
+			if (ret == 0)
+				ret = write(fd, buf + in, chunk);
+			if (ret > 0)
+				pos += ret;
+		}
+
+		if (ret <= 0) {
+			perror("block_copy_out");
+			block_buffer_put(buf);
+			return -1;
+		}
+		done += ret;
+	}
+
+	block_buffer_put(buf);
+	return done;
+}
+
+/*
+ * Read up to @len bytes from @fd, retrying short reads from pipes and sockets.
+ * Return -1 on failure, otherwise the bytes read, less than @len only at the
+ * end of the file.
+ */
+static ssize_t read_full(int fd, char *buf, size_t len)
+{
+	size_t got = 0;
+
+	while (got < len) {
+		ssize_t ret = read(fd, buf + got, len - got);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			break;
+		got += ret;
+	}
+
+	return got;
+}
+
+int block_copy_in(size_t block, size_t offset, size_t len, int fd)
+{
+	char *buf = NULL, *data = NULL;
+	loff_t pos;
+	size_t done = 0;
+
+	if (range_check(block, offset, len))
+		return -1;
+
+	pos = block * BLOCK_SIZE + offset;
+	while (done < len) {
+		ssize_t ret;
+
+		/* Zero copy first: file to file, then pipe to file */
+		ret = -1;
+		errno = EOPNOTSUPP;
+		if (!csum && !wb.on)
+			ret = copy_file_range(fd, NULL, disk.fd, &pos,
+					      len - done, 0);
+		if (ret < 0 && !csum && !wb.on && copy_unsupported())
+			ret = splice(fd, NULL, disk.fd, &pos, len - done, 0);
+
+		/* Bounded bounce buffer when the kernel cannot do it */
+		if (ret < 0 && copy_unsupported()) {
+			size_t in = pos % BLOCK_SIZE;
+			size_t chunk = BLOCK_SIZE - in;
+
+			if (chunk > len - done)
+				chunk = len - done;
+
+			/*
+			 * A whole block goes out as read, anything less is
+			 * merged into the block so the rest of it is kept
+			 */
+			ret = -1;
+			if (data || (data = block_buffer_get()))
+				ret = read_full(fd, data, chunk);
+			if (ret > 0 && ret < BLOCK_SIZE) {
+				if ((buf || (buf = block_buffer_get())) &&
+				    block_read(pos / BLOCK_SIZE, buf) == 0) {
+					memcpy(buf + in, data, ret);
+					if (block_write(pos / BLOCK_SIZE, buf))
+						ret = -1;
+				} else {
+					ret = -1;
+				}
+			} else if (ret > 0 && block_write(pos / BLOCK_SIZE, data)) {
+				ret = -1;
+			}
+			if (ret > 0)
+				pos += ret;
+		}
+
+		if (ret < 0) {
+			perror("block_copy_in");
+			block_buffer_put(buf);
+			block_buffer_put(data);
+			return -1;
+		}
+
+		/* End of the host file */
+		if (ret == 0)
+			break;
+		done += ret;
+	}
+
+	block_buffer_put(buf);
+	block_buffer_put(data);
+	return done;
+}
+
+void *block_map(size_t block, size_t count, void *addr)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	int dirty = 0;
+	char *map;
+
+	if (range_check(block, 0, count * BLOCK_SIZE))
+		return NULL;
+
+	if (count == 0 || BLOCK_SIZE % page != 0) {
+		block_error("cannot map %zu blocks of %d bytes", count,
+			    BLOCK_SIZE);
+		return NULL;
+	}
+
+	/* The mapping shows the disk, dirty blocks have to reach it first */
+	if (wb.on) {
+		pthread_mutex_lock(&wb.lock);
+		for (size_t i = 0; i < count && !dirty; i++)
+			dirty = wb.map[block + i] != NULL;
+		pthread_mutex_unlock(&wb.lock);
+		if (dirty && block_sync())
+			return NULL;
+	}
+
+	map = mmap(addr, count * BLOCK_SIZE, PROT_READ,
+		   MAP_SHARED | (addr ? MAP_FIXED : 0), disk.fd,
+		   block * BLOCK_SIZE);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+
+	/* Checked in place, nothing is copied */
+	for (size_t i = 0; csum && i < count; i++) {
+		if (crc32c(0, map + i * BLOCK_SIZE, BLOCK_SIZE) !=
+		    csum[block + i]) {
+			block_error("checksum mismatch on block %zu",
+				    block + i);
+			/* Leaves the caller's reservation in place */
+			if (addr)
+				mmap(addr, count * BLOCK_SIZE, PROT_NONE,
+				     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+				     -1, 0);
+			else
+				munmap(map, count * BLOCK_SIZE);
+			return NULL;
+		}
+	}
+
+	return map;
+}
+
+int block_punch(size_t block, size_t count)
+{
+	int dirty = 0;
+
+	if (range_check(block, 0, count * BLOCK_SIZE))
+		return -1;
+
+	/* A dirty copy written back later would fill the hole again */
+	if (wb.on) {
+		pthread_mutex_lock(&wb.lock);
+		for (size_t i = 0; i < count && !dirty; i++)
+			dirty = wb.map[block + i] != NULL;
+		pthread_mutex_unlock(&wb.lock);
+		if (dirty && block_sync())
+			return -1;
+	}
+
+	if (fallocate(disk.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      block * BLOCK_SIZE, count * BLOCK_SIZE)) {
+		perror("fallocate");
+		return -1;
+	}
+
+	if (csum) {
+		char *zero = calloc(1, BLOCK_SIZE);
+		uint32_t sum;
+
+		if (!zero) {
+			block_error("cannot allocate zero block");
+			return -1;
+		}
+		sum = crc32c(0, zero, BLOCK_SIZE);
+		free(zero);
+		for (size_t i = 0; i < count; i++)
+			csum[block + i] = sum;
+	}
+
+	return 0;
+}
+
+void block_csum_attach(uint32_t *table)
+{
+	csum = table;
+}
+
+int block_csum_verify(size_t block, size_t count)
+{
+	void *batch;
+	int bad = 0;
+
+	if (!csum) {
+		block_error("no checksum table attached");
+		return -1;
+	}
+
+	if (count == 0)
+		return 0;
+
+	if (range_check(block, 0, count * BLOCK_SIZE) || block_sync())
+		return -1;
+
+	if (posix_memalign(&batch, BLOCK_ALIGN, VERIFY_BATCH * BLOCK_SIZE)) {
+		block_error("cannot allocate aligned buffer");
+		return -1;
+	}
+
+	while (count > 0) {
+		size_t n = count < VERIFY_BATCH ? count : VERIFY_BATCH;
+
+		if (pread(disk.fd, batch, n * BLOCK_SIZE,
+			  block * BLOCK_SIZE) != (ssize_t)(n * BLOCK_SIZE)) {
+			perror("read");
+			free(batch);
+			return -1;
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			char *p = (char *)batch + i * BLOCK_SIZE;
+
+			if (crc32c(0, p, BLOCK_SIZE) != csum[block + i]) {
+				block_error("checksum mismatch on block %zu",
+					    block + i);
+				bad++;
+			}
+		}
+
+		block += n;
+		count -= n;
+	}
+
+	free(batch);
+	return bad;
+}
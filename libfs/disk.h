@@ -2,9 +2,48 @@
 #define _DISK_H
 
 #include <stddef.h> /* for size_t definition */
+#include <stdint.h> /* for uint32_t definition */
 
-/** Size of a disk block in bytes */
-#define BLOCK_SIZE 4096
+/** Smallest, default and largest size of a disk block in bytes */
+#define BLOCK_SIZE_MIN 1024
+#define BLOCK_SIZE_DEFAULT 4096
+#define BLOCK_SIZE_MAX 65536
+
+/** Size of a disk block in bytes, see block_disk_set_size() */
+#define BLOCK_SIZE ((int)block_size_current)
+
+/* Current block size, only changed through block_disk_set_size() */
+extern size_t block_size_current;
+
+/** Open flag: bypass the page cache with direct I/O */
+#define BLOCK_DISK_DIRECT 0x01
+
+/** Open flag: write blocks back from a background flusher thread */
+#define BLOCK_DISK_WRITEBACK 0x02
+
+/** Write-back thresholds, see block_writeback_tune() */
+struct block_writeback {
+	/* Dirty blocks at which block_write() waits for the flusher */
+	size_t dirty_max;
+	/* Percentage of @dirty_max from which the flusher writes every block */
+	unsigned int background_pct;
+	/* Milliseconds after which a dirty block is written back */
+	unsigned int expire_ms;
+};
+
+/** Write-back activity since the disk was opened */
+struct block_writeback_stats {
+	/* Blocks written back */
+	size_t blocks;
+	/* System calls that wrote them, each one a run of consecutive blocks */
+	size_t writes;
+	/* Batches of the flusher */
+	size_t batches;
+	/* Times block_write() waited for the flusher */
+	size_t throttled;
+	/* Dirty blocks right now */
+	size_t dirty;
+};
 
 /**
  * block_disk_open - Open virtual disk file
@@ -19,10 +58,84 @@
  */
 int block_disk_open(const char *diskname);
 
+/**
+ * block_disk_open_flags - Open virtual disk file with options
+ * @diskname: Name of the virtual disk file
+ * @flags: Bitwise OR of %BLOCK_DISK_* flags, or 0
+ *
+ * Same as block_disk_open(). With %BLOCK_DISK_DIRECT, the virtual disk file is
+ * opened with O_DIRECT so that blocks are not cached by the kernel on top of
+ * any cache of the caller. Buffers that are not suitably aligned for direct
+ * I/O are transparently bounced through the buffer pool. With
+ * %BLOCK_DISK_WRITEBACK, writes are cached and written back in the background,
+ * see block_writeback_tune().
+ *
+ * Return: -1 if @diskname is invalid, if the virtual disk file cannot be opened
+ * (for instance if its file system does not support direct I/O) or is already
+ * open. 0 otherwise.
+ */
+int block_disk_open_flags(const char *diskname, int flags);
+
+/**
+ * block_writeback_tune - Set the write-back thresholds
+ * @tune: New thresholds, or NULL to restore the defaults
+ *
+ * On a disk opened with %BLOCK_DISK_WRITEBACK, block_write() only copies the
+ * block into memory and marks it dirty. A flusher thread writes dirty blocks
+ * back once they are @expire_ms old, or all of them as soon as there are
+ * @background_pct percent of @dirty_max, sorted by block index so that runs of
+ * consecutive blocks go out with one system call. A block_write() that would
+ * make more than @dirty_max blocks dirty waits for the flusher first. The
+ * defaults are 16 MiB worth of blocks, 50 percent and 1000 milliseconds. The
+ * thresholds apply from the next decision of the flusher.
+ *
+ * Return: -1 if @dirty_max is 0 or @background_pct larger than 100. 0
+ * otherwise.
+ */
+int block_writeback_tune(const struct block_writeback *tune);
+
+/**
+ * block_writeback_stats - Report write-back activity
+ * @stats: Filled with the activity of the open disk
+ *
+ * Return: -1 if no virtual disk file is open or if it was not opened with
+ * %BLOCK_DISK_WRITEBACK. 0 otherwise.
+ */
+int block_writeback_stats(struct block_writeback_stats *stats);
+
+/**
+ * block_sync - Write every dirty block back
+ *
+ * Wake the flusher up and wait until no block is dirty. Does nothing on a disk
+ * opened without %BLOCK_DISK_WRITEBACK.
+ *
+ * Return: -1 if no virtual disk file is open or if writing a block back
+ * failed since the last call. 0 otherwise.
+ */
+int block_sync(void);
+
+/**
+ * block_disk_set_size - Change the block size of the open disk
+ * @size: New block size in bytes, a power of two from %BLOCK_SIZE_MIN to
+ * %BLOCK_SIZE_MAX
+ *
+ * A virtual disk file is opened with blocks of %BLOCK_SIZE_DEFAULT bytes, and
+ * goes back to that size when it is closed. Block numbers, block_disk_count()
+ * and the size of the buffers of the buffer pool all follow the new size. No
+ * buffer obtained with block_buffer_get() may be held across the change.
+ *
+ * Return: -1 if no virtual disk file is open, if @size is invalid or if the
+ * size of the virtual disk file is not a multiple of @size. 0 otherwise.
+ */
+int block_disk_set_size(size_t size);
+
 /**
  * block_disk_close - Close virtual disk file
  *
- * Return: -1 if there was no virtual disk file opened. 0 otherwise.
+ * Dirty blocks are written back first, then the checksum table is detached.
+ *
+ * Return: -1 if there was no virtual disk file opened or if writing blocks
+ * back failed. 0 otherwise.
  */
 int block_disk_close(void);
 
@@ -60,5 +173,131 @@ int block_write(size_t block, const void *buf);
  */
 int block_read(size_t block, void *buf);
 
+/**
+ * block_read_run - Read consecutive blocks from disk
+ * @block: Index of the first block to read from
+ * @count: Number of consecutive blocks to read
+ * @buf: Data buffer to be filled with @count blocks
+ *
+ * Same as block_read() for @count blocks, with one positional read per run of
+ * blocks that are not dirty. Unlike the other calls, it takes nothing from the
+ * buffer pool and can run on several threads at once, as long as no block of
+ * the disk is written meanwhile.
+ *
+ * Return: -1 if the range is out of bounds or inaccessible, if the reading
+ * operation fails or if a block does not match its checksum. 0 otherwise.
+ */
+int block_read_run(size_t block, size_t count, void *buf);
+
+/**
+ * block_buffer_get - Get a block buffer from the buffer pool
+ *
+ * Get a %BLOCK_SIZE bytes buffer aligned for direct I/O. Buffers given back
+ * with block_buffer_put() are reused, so block sized temporaries cost no
+ * allocation in steady state.
+ *
+ * Return: NULL if no buffer could be allocated, the buffer otherwise.
+ */
+void *block_buffer_get(void);
+
+/**
+ * block_buffer_put - Give a block buffer back to the buffer pool
+ * @buf: Buffer obtained with block_buffer_get(), or NULL
+ */
+void block_buffer_put(void *buf);
+
+/**
+ * block_copy_out - Copy a byte range of the disk to a host file
+ * @block: Index of the block where the range starts
+ * @offset: Offset of the range inside block @block
+ * @len: Number of bytes to copy, possibly spanning several blocks
+ * @fd: Host file descriptor to write to, at its current file offset
+ *
+ * Move @len bytes starting at byte @offset of block @block to @fd without
+ * staging them in user memory when the kernel allows it (copy_file_range() to
+ * regular files, splice() to pipes). Otherwise the bytes go through a bounce
+ * buffer of one block.
+ *
+ * Return: -1 if the range is out of bounds or if the copy fails. Otherwise the
+ * number of bytes copied, which is always @len.
+ */
+int block_copy_out(size_t block, size_t offset, size_t len, int fd);
+
+/**
+ * block_copy_in - Copy a host file into a byte range of the disk
+ * @block: Index of the block where the range starts
+ * @offset: Offset of the range inside block @block
+ * @len: Maximum number of bytes to copy, possibly spanning several blocks
+ * @fd: Host file descriptor to read from, at its current file offset
+ *
+ * Same as block_copy_out() in the other direction. The copy stops early when
+ * the end of the host file is reached.
+ *
+ * Return: -1 if the range is out of bounds or if the copy fails. Otherwise the
+ * number of bytes copied.
+ */
+int block_copy_in(size_t block, size_t offset, size_t len, int fd);
+
+/**
+ * block_map - Map blocks of the disk read-only
+ * @block: Index of the first block
+ * @count: Number of consecutive blocks to map
+ * @addr: Page aligned address to map them at, replacing whatever is mapped
+ * there, or NULL to let the system choose
+ *
+ * The blocks are mapped straight from the disk image, shared with it: later
+ * writes to them show up in the mapping. Dirty blocks of the range are written
+ * back first and, if a checksum table is attached, the mapped blocks are
+ * checked against it. The mapping is released with munmap().
+ *
+ * Return: NULL if the range is out of bounds, if the block size is smaller
+ * than a page, if a block does not match its checksum or if the mapping
+ * fails. Otherwise the address of the mapping.
+ */
+void *block_map(size_t block, size_t count, void *addr);
+
+/**
+ * block_punch - Give the space of blocks back to the host
+ * @block: Index of the first block
+ * @count: Number of consecutive blocks
+ *
+ * Punch a hole in the virtual disk file over the blocks, which then read as
+ * zeros and take no space on the host file system. Dirty blocks of the range
+ * are written back first and, if a checksum table is attached, the blocks get
+ * the checksum of a block of zeros.
+ *
+ * Return: -1 if the range is out of bounds or if the host file system cannot
+ * punch holes. 0 otherwise.
+ */
+int block_punch(size_t block, size_t count);
+
+/**
+ * block_csum_attach - Start checking blocks against a checksum table
+ * @table: Array of one CRC32C checksum per block of the disk, or NULL
+ *
+ * Once a table is attached, block_write() records the checksum of every block
+ * it writes in @table and block_read() fails if the block it reads does not
+ * match its checksum (dirty blocks still in memory are not checked).
+ * block_copy_out() and block_copy_in() then go through block_read() and
+ * block_write() instead of copying in the kernel, as they do on a disk opened
+ * with %BLOCK_DISK_WRITEBACK. Passing NULL detaches the table. The table is
+ * owned by the caller.
+ */
+void block_csum_attach(uint32_t *table);
+
+/**
+ * block_csum_verify - Check a range of blocks against the checksum table
+ * @block: Index of the first block to check
+ * @count: Number of consecutive blocks to check
+ *
+ * Read blocks @block to @block + @count - 1 several at a time with one system
+ * call per batch and compare each of them with its checksum, reporting every
+ * mismatch on stderr. Dirty blocks are written back first.
+ *
+ * Return: -1 if no checksum table is attached, if the range is out of bounds or
+ * if reading fails. Otherwise the number of blocks that do not match.
+ */
+int block_csum_verify(size_t block, size_t count);
+
 #endif /* _DISK_H */
 
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "events.h"
+
+#define event_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#ifdef FS_EVENTS
+
+struct event {
+	/* CLOCK_MONOTONIC time, in nanoseconds */
+	uint64_t ns;
+	const char *name;
+	/* 'B' or 'E' */
+	char phase;
+};
+
+/* Events of one thread, written by that thread only */
+struct event_ring {
+	struct event events[EVENT_RING_SIZE];
+	/* Events recorded so far, published after each event is complete */
+	uint64_t head;
+	/* Thread the ring belongs to */
+	pid_t tid;
+	/* Next ring of the list */
+	struct event_ring *next;
+};
+
+/* Every ring, newest first, pushed without a lock */
+static struct event_ring *rings;
+
+/* Ring of the calling thread, NULL until its first event */
+static __thread struct event_ring *ring;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void event_exit(void)
+{
+	event_dump(getenv("FS_EVENTS"));
+}
+
+/* Dump at exit if FS_EVENTS names a file */
+static void event_start(void)
+{
+	const char *path = getenv("FS_EVENTS");
+
+	if (path && *path)
+		atexit(event_exit);
+}
+
+static struct event_ring *event_ring_new(void)
+{
+	struct event_ring *r = calloc(1, sizeof(*r));
+
+	pthread_once(&once, event_start);
+	if (!r)
+		return NULL;
+
+	r->tid = gettid();
+	r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	ring = r;
+	return r;
+}
+
+void event_record(const char *name, char phase)
+{
+	struct event_ring *r = ring;
+	struct timespec ts;
+	struct event *e;
+
+	if (!r && !(r = event_ring_new()))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	e = &r->events[r->head % EVENT_RING_SIZE];
+	e->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	e->name = name;
+	e->phase = phase;
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+int event_dump(const char *path)
+{
+	struct event_ring *r;
+	const char *sep = "";
+	FILE *out;
+	int ret = 0;
+
+	if (!path || !*path)
+		return -1;
+
+	out = fopen(path, "w");
+	if (!out) {
+		perror("fopen");
+		return -1;
+	}
+
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t i = head > EVENT_RING_SIZE ? head - EVENT_RING_SIZE : 0;
+
+		for (; i < head; i++) {
+			struct event *e = &r->events[i % EVENT_RING_SIZE];
+
+			/* Timestamps are in microseconds */
+			fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%c\","
+				"\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d}",
+				sep, e->name, e->phase,
+				(unsigned long long)(e->ns / 1000),
+				(unsigned long long)(e->ns % 1000),
+				(int)getpid(), (int)r->tid);
+			sep = ",";
+		}
+	}
+	fprintf(out, "\n]}\n");
+
+	if (ferror(out)) {
+		event_error("cannot write '%s'", path);
+		ret = -1;
+	}
+	if (fclose(out))
+		ret = -1;
+
+	return ret;
+}
+
+#else /* FS_EVENTS */
+
+int event_dump(const char *path)
+{
+	event_error("built without FS_EVENTS");
+	return -1;
+}
+
+#endif /* FS_EVENTS */
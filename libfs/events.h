@@ -0,0 +1,70 @@
+#ifndef _EVENTS_H
+#define _EVENTS_H
+
+/*
+ * Event recorder for latency analysis, built into libfsevents.a: the same
+ * sources as libfs.a compiled with FS_EVENTS defined. Every fs_*() call, FAT
+ * walk, block allocation and block read or write then records a begin and an
+ * end event, with a timestamp, in a ring buffer of the calling thread. Rings
+ * hold the last %EVENT_RING_SIZE events of each thread and are kept after the
+ * thread exits.
+ *
+ * Without FS_EVENTS, the macros below expand to empty statements and nothing
+ * is recorded.
+ */
+
+/** Events kept per thread, older ones being overwritten */
+#define EVENT_RING_SIZE 16384
+
+/**
+ * event_dump - Write the recorded events as a Chrome trace
+ * @path: Name of the file to write
+ *
+ * Write the events of every ring, oldest first, in the trace-event JSON format
+ * read by chrome://tracing and Perfetto. Threads still recording while the
+ * rings are dumped can have their newest events torn. When environment
+ * variable FS_EVENTS names a file, the events are also dumped there when the
+ * program exits.
+ *
+ * Return: -1 if the library was built without FS_EVENTS or if the file cannot
+ * be written. 0 otherwise.
+ */
+int event_dump(const char *path);
+
+#ifdef FS_EVENTS
+
+/**
+ * event_record - Record an event in the ring of the calling thread
+ * @name: Name of the event, a string that outlives the program's rings
+ * @phase: 'B' when the event begins, 'E' when it ends
+ */
+void event_record(const char *name, char phase);
+
+static inline const char *event_scope_begin(const char *name)
+{
+	event_record(name, 'B');
+	return name;
+}
+
+static inline void event_scope_end(const char **name)
+{
+	event_record(*name, 'E');
+}
+
+#define EVENT_BEGIN(name) event_record(name, 'B')
+#define EVENT_END(name) event_record(name, 'E')
+
+/* Begins @name here and ends it when the enclosing block is left */
+#define EVENT_SCOPE(name) \
+	const char *event_scope __attribute__((cleanup(event_scope_end))) = \
+		event_scope_begin(name)
+
+#else /* FS_EVENTS */
+
+#define EVENT_BEGIN(name) do { } while (0)
+#define EVENT_END(name) do { } while (0)
+#define EVENT_SCOPE(name) do { } while (0)
+
+#endif /* FS_EVENTS */
+
+#endif /* _EVENTS_H */
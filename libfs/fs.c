@@ -1,16 +1,72 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "crc.h"
 #include "disk.h"
+#include "events.h"
 #include "fs.h"
+#include "lz.h"
 
 #define FAT_EOC 0xFFFF
 
+#define FD_INDEX_BITS 20 // low bits of an fd index the descriptor table, the bits above hold its generation
+#define FD_SLOTS (1 << FD_INDEX_BITS)
+#define FD_GEN_MASK ((1 << (31 - FD_INDEX_BITS)) - 1)
+#define FD_CHUNK 256 // descriptor slots allocated at once
+#define FD_NONE 0xFFFFFFFF // end of the free list
+
+#define ASYNC_WORKERS 4 // threads running asynchronous reads and writes
+#define READ_WORKERS 4 // threads helping the caller with the block runs of a large read
+#define READ_PARALLEL_MIN (1024 * 1024) // smallest read split into block runs
+#define READ_RUN_MAX (256 * 1024) // largest run read by one thread at a time
+#define RECLAIM_BATCH 1024 // fat entries freed by the reclaimer before letting other callers in
+
+#define ROOT_WORDS (FS_FILE_MAX_COUNT / 32) // words of the root directory occupancy bitmap
+
+#define NODE_BUCKETS 256 // hash buckets of the entries loaded from subdirectories
+#define NODE_NONE -1 // end of a node list, and the root directory as a parent
+
+pthread_mutex_t fsLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP; // guards every global below
+void fsUnlock(pthread_mutex_t **lock);
+
+// holds the library lock until the end of the enclosing function
+#define FS_LOCKED \
+  EVENT_SCOPE(__func__); /* ends once the lock is released */ \
+  pthread_mutex_t *fsGuard __attribute__((cleanup(fsUnlock))) = &fsLock; \
+  pthread_mutex_lock(fsGuard)
+
 int findFileInRootDirec(const char *filename);
+void rootMark(int file, int used);
+int rootNext(int from);
+int writeBack(void);
+int regionRead(unsigned int block, void *buf, size_t len);
+int regionWrite(unsigned int block, const void *buf, size_t len);
+int memorySplit(size_t budget);
+int fatInit(void);
+void fatFree(void);
+int fatEvict(void);
+uint16_t *fatPage(unsigned int page);
+unsigned int fatGet(unsigned int index);
+void fatSet(unsigned int index, unsigned int value);
+int fatFlush(void);
+unsigned int fatFreeBlocks(void);
 int nextOpen();
+int growsInto(int file, unsigned int index);
+unsigned int allocGoal(int file);
+int findFreeRun(unsigned int count);
+int scrubbed(unsigned int index);
 
 typedef struct __attribute__ ((__packed__)) SuperBlock
 {
@@ -20,550 +76,4585 @@ typedef struct __attribute__ ((__packed__)) SuperBlock
   uint16_t dataStartIndex; // index of start of data blocks
   uint16_t totDataBlocks; // total number of data blocks
   uint8_t numFATBlocks; // num of fat blocks
-  char padding[4079];
+  uint32_t features; // FS_FEATURE_* extensions of the format, 0 for the original format
+  uint16_t extIndex; // first data block of the root extension region
+  uint16_t csumIndex; // first data block of the checksum region
+  uint16_t csumBlocks; // number of blocks in the checksum region
+  uint16_t dedupIndex; // first data block of the dedup region
+  uint16_t dedupBlocks; // number of blocks in the dedup region
+  uint8_t blockShift; // log2 of the block size, 0 for the 4096 byte blocks of the original format
+  char padding[4064];
 }SuperBlock, superB_t;
 
-typedef struct __attribute__ ((__packed__)) FATBlock
-{
-  uint16_t word; // one entry in fat
-}FATBlock, *fatB_t;
+#define SUPER_BYTES (sizeof(SuperBlock) < BLOCK_SIZE ? sizeof(SuperBlock) : BLOCK_SIZE) // bytes of the super block kept in block 0
+#define ROOT_BLOCKS ((FS_FILE_MAX_COUNT * sizeof(Root) + BLOCK_SIZE - 1) / BLOCK_SIZE) // blocks holding the root directory
+
+#define FAT_PER_BLOCK (BLOCK_SIZE / sizeof(uint16_t)) // fat entries in one fat block
 
 typedef struct FAT
 {
-  fatB_t blocks; // array fat entries
+  uint16_t **pages; // fat blocks in memory, NULL while paged out
+  uint16_t *freeCount; // free data blocks covered by each fat block
+  uint8_t *dirty; // fat block changed since it was read
+  uint8_t *used; // fat block used since the clock hand last passed it
+  unsigned int resident; // fat blocks in memory
+  unsigned int limit; // most fat blocks kept in memory
+  unsigned int hand; // next fat block looked at for eviction
+  unsigned int faults; // fat blocks read back after being paged out
 }FAT, FAT_t;
 
 typedef struct __attribute__((__packed__)) Root
 {
   char name[FS_FILENAME_LEN]; // name of file
   uint32_t size; // size of file
-  uint16_t firstIndex; // start index of file in fat
-  char padding[10];
+  uint16_t firstIndex; // start index of file in fat (extent block for extent-mapped files)
+  uint8_t flags; // FS_MODE_* layout flags of the file
+  char padding[9];
 }Root, root_t;
 
+typedef struct __attribute__((__packed__)) Extent
+{
+  uint32_t fileBlock; // index of the first file block covered by the extent
+  uint16_t start; // first data block of the extent
+  uint16_t length; // number of contiguous data blocks in the extent
+}Extent, extent_t;
+
+#define EXTENT_MAX ((BLOCK_SIZE - 8) / sizeof(Extent))
+
+typedef struct __attribute__((__packed__)) ExtentBlock
+{
+  uint16_t count; // number of extents in use
+  char padding[6];
+  extent_t extents[]; // extents sorted by fileBlock, EXTENT_MAX of them fill the block
+}ExtentBlock, extB_t;
+
+#define ROOT_INLINE 0x80 // file data lives in its root extension entry
+#define ROOT_TAIL 0x40 // last partial block of the file is packed in a shared tail block
+#define ROOT_DIR 0x20 // entry is a subdirectory, its extent-mapped data is a hashed directory
+
+#define INLINE_MAX 248 // largest file stored inline
+#define TAIL_MAX (BLOCK_SIZE / 2) // largest tail packed in a shared tail block
+
+typedef struct __attribute__((__packed__)) RootExt
+{
+  uint16_t tailBlock; // shared block holding the packed tail of the file
+  uint16_t tailOffset; // offset of the tail inside the shared block
+  char padding[4];
+  char data[INLINE_MAX]; // content of inline files
+}RootExt, rootExt_t;
+
+#define EXT_BLOCKS ((sizeof(RootExt) * FS_FILE_MAX_COUNT + BLOCK_SIZE - 1) / BLOCK_SIZE)
+
+typedef struct TailBlock
+{
+  uint16_t index; // data block holding packed tails
+  uint16_t used; // bytes used at the start of the block
+  uint16_t live; // number of tails still stored in the block
+}TailBlock, tailB_t;
+
+#define DIR_ENTRIES ((BLOCK_SIZE - 8) / sizeof(Root))
+#define DIR_DEPTH_MAX (__builtin_ctz(BLOCK_SIZE) - 2) // most hash bits used to pick a bucket, the table must fit the header block
+
+typedef struct __attribute__((__packed__)) DirHeader
+{
+  uint16_t depth; // hash bits indexing the table
+  char padding[2];
+  uint32_t entries; // entries in the directory
+  uint16_t table[]; // directory block of the bucket for each value of the low hash bits
+}DirHeader, dirH_t;
+
+typedef struct __attribute__((__packed__)) DirBlock
+{
+  uint16_t count; // entries in use
+  uint8_t depth; // low hash bits shared by every entry of the bucket
+  char padding[5];
+  root_t entries[]; // unordered entries of the bucket, DIR_ENTRIES of them fill the block
+}DirBlock, dirB_t;
+
+typedef struct Node
+{
+  int parent; // node of the subdirectory holding the entry, NODE_NONE in the root directory
+  unsigned int refs; // fds, loaded children and path walks holding the entry (subdirectory entries only)
+  unsigned int depth; // subdirectories between the entry and the root directory
+  int next; // next node in the same hash bucket, or in the free list
+  int removed; // entry was deleted from its subdirectory, nothing to write back
+}Node, node_t;
+
+#define DEDUP_SHARED 0xFFFE // dedupWrite() result when the block content already is on disk
+
+#define CHUNK_BLOCKS 16 // blocks of file data compressed together
+#define CHUNK_SIZE (CHUNK_BLOCKS * BLOCK_SIZE)
+
+typedef struct __attribute__((__packed__)) Chunk
+{
+  uint16_t start; // first data block of the run holding the chunk
+  uint16_t blocks; // number of contiguous blocks in the run
+  uint32_t length; // compressed length in bytes, 0 if the chunk is stored raw
+}Chunk, chunk_t;
+
+#define CHUNK_MAX ((BLOCK_SIZE - 8) / sizeof(Chunk))
+
+typedef struct __attribute__((__packed__)) ChunkIndex
+{
+  uint16_t count; // number of chunks stored
+  char padding[6];
+  chunk_t chunks[]; // chunk i holds file bytes [i * CHUNK_SIZE, (i + 1) * CHUNK_SIZE)
+}ChunkIndex, chunkIdx_t;
+
+typedef struct CompFile
+{
+  chunkIdx_t *index; // chunk index block of the file, allocated along with the state
+  int indexDirty; // index block needs to be written back
+  int chunk; // chunk held in data, -1 if none
+  int dirty; // data holds changes that are not compressed yet
+  char *data; // uncompressed content of the chunk, allocated along with the state
+}CompFile, compF_t;
+
+typedef struct __attribute__((__packed__)) DedupEntry
+{
+  uint32_t hash; // CRC32C of the block content, valid if hashed is set
+  uint16_t refs; // references to the block beyond the first one
+  uint8_t hashed; // block content is listed in the fingerprint index
+  uint8_t padding;
+}DedupEntry, dedupE_t;
+
+typedef struct Cursor
+{
+  int file; // index of the file in the root directory
+  unsigned int fileBlock; // index of the current block within the file
+  unsigned int dataIndex; // data block of the current block, FAT_EOC past the end of file
+  unsigned int last; // last data block visited, FAT_EOC if the file has no blocks
+  int extent; // current extent (extent-mapped files only)
+}Cursor, cursor_t;
+
+typedef struct VecCursor
+{
+  const struct iovec *iov; // current segment
+  int left; // segments left, the current one included
+  size_t used; // bytes of the current segment already transferred
+}VecCursor, vecCur_t;
+
 typedef struct FDTable
 {
   unsigned int indexInRoot; // index of file in root directory
   unsigned int offset; // offset of file that is opened
+  unsigned int pending; // asynchronous operations in flight on the fd
+  unsigned int generation; // bumped on close so stale fds are caught
+  unsigned int nextFree; // next slot in the free list
+  int busy; // an asynchronous operation is running, guarded by asyncLock
+  int append; // opened with FS_OPEN_APPEND, writes go to the end of file
 }FDTable, fdt_t;
 
+typedef struct AsyncOp
+{
+  struct AsyncOp *next; // next operation in the queue
+  int write; // write instead of read
+  int fd; // file descriptor given by the caller
+  fdt_t *entry; // descriptor table entry of fd
+  int file; // index of the file in the root directory
+  size_t offset; // file offset captured at submission
+  void *buf; // user buffer
+  size_t count; // bytes to transfer
+  fs_callback_t callback; // called on completion, NULL to use the completion queue
+  void *arg; // passed back on completion
+  int result; // bytes transferred, or -1
+}AsyncOp, asyncOp_t;
+
+typedef struct ReadRun
+{
+  unsigned int block; // first disk block of the run
+  unsigned int count; // consecutive blocks
+  char *buf; // slice of the caller's buffer the run goes to
+  int result; // 0 once read, -1 if reading failed
+}ReadRun, readRun_t;
+
+typedef struct Mapping
+{
+  const char *addr; // address given to the caller
+  void *base; // start of the mapping, page aligned
+  size_t length; // length of the mapping
+}Mapping, mapping_t;
+
 superB_t superBlock;
-FAT_t fat;
-root_t rootDir[FS_FILE_MAX_COUNT];
-fdt_t fdt[FS_OPEN_MAX_COUNT];
+FAT_t fat; // fat blocks paged in on demand, all of them unless the mount has a memory budget
+size_t memoryBudget; // memory budget of the mount, 0 if none
+int mountFlags; // FS_MOUNT_* flags of the mount
+unsigned int dedupCap; // most fingerprint index buckets, 0 if no limit
+root_t *rootDir; // root directory entries, followed by the entries loaded from subdirectories
+uint32_t rootUsed[ROOT_WORDS]; // occupancy bitmap of the root directory entries
+node_t *nodes; // where each entry of rootDir comes from
+unsigned int nodeCount; // entries allocated in rootDir and in every per-file array
+int nodeHeads[NODE_BUCKETS]; // loaded subdirectory entries by parent and name
+int nodeFree = NODE_NONE; // first unused subdirectory entry
+fdt_t *fdt[FD_SLOTS / FD_CHUNK]; // descriptor table, grown one chunk at a time so entries never move
+unsigned int fdtSize; // number of slots allocated
+unsigned int fdtFree = FD_NONE; // first free slot
+unsigned int openMax = FS_OPEN_MAX_COUNT; // most descriptors open at once
+unsigned int openNow; // descriptors currently open
+int *openFiles; // descriptors open on each file
+extB_t **extentCache; // extent blocks of extent-mapped files, loaded on demand
+int *extentDirty; // extent block needs to be written back
+unsigned int *lastBlock; // data block last allocated to each file, FAT_EOC if unknown
+unsigned int *lastFileBlock; // index of lastBlock within its file
+rootExt_t rootExt[FS_FILE_MAX_COUNT]; // root extension entries (FS_FEATURE_INLINE only)
+tailB_t *tailBlocks; // shared tail blocks in use
+int tailCount; // number of shared tail blocks
+compF_t **compCache; // state of compressed files, loaded on demand
+uint32_t *csumTable; // checksum of every disk block, NULL unless FS_FEATURE_CSUM is on
+dedupE_t *dedupTable; // fingerprint and sharing of every data block (FS_FEATURE_DEDUP only)
+uint16_t *dedupHeads; // fingerprint index, first block of each hash bucket
+uint16_t *dedupNext; // next block in the same hash bucket
+unsigned int dedupMask; // number of hash buckets minus one
+mapping_t *mappings; // mappings handed out by fs_mmap
+unsigned int mapCount; // number of mappings
+unsigned int mapCap; // mappings allocated
+unsigned int *reclaimQueue; // next block of the chains of deleted files left to free
+unsigned int reclaimCount; // chains in the queue
+unsigned int reclaimCap; // chains allocated
+int reclaimStarted; // reclaimer thread is running
+int reclaimStopping; // reclaimer thread is asked to exit, see reclaimStop()
+pthread_t reclaimThread; // reclaimer thread, joined by fs_umount
+pthread_cond_t reclaimWork = PTHREAD_COND_INITIALIZER; // chains were queued or the reclaimer is stopping, waited on with fsLock held
+
+extB_t *loadExtents(int file);
+unsigned int cursorSeek(cursor_t *cur, int file, unsigned int fileBlock);
+unsigned int cursorNext(cursor_t *cur);
+unsigned int cursorAppend(cursor_t *cur, unsigned int goal);
+int releaseBlocksFrom(int file, unsigned int fileBlock);
+void freeFileBlocks(int file);
+void reclaimBlocks(int file);
+void reclaimBatch(unsigned int count);
+void reclaimAll(void);
+void reclaimStop(void);
+void dropTail(int file);
+int unpackFile(int file);
+void packFile(int file);
+int openCount(int file);
+int nodeGrow(void);
+int nodeFind(int dir, const char *name);
+int nodeGet(int dir, const char *name);
+void nodePut(int node);
+int nodeSync(int node);
+int nodeFlush(void);
+int pathParent(const char *path, int *dir, char *name);
+int createEntry(int dir, const char *name, int flags);
+int removeEntry(int dir, int file, int isDir);
+uint32_t nameHash(const char *name);
+int dirLookup(int dir, const char *name, dirB_t *bucket, unsigned int *fileBlock);
+int dirInsert(int dir, const root_t *entry);
+int dirRemove(int dir, const char *name);
+int dirUpdate(int dir, const root_t *entry);
+int dirEntries(int dir);
+fdt_t *fdSlot(unsigned int index);
+void fdtReset(void);
+fdt_t *fdEntry(int fd);
+unsigned int blockCount(int file);
+unsigned int storedBlocks(const root_t *entry);
+void fillDirent(struct fs_dirent *dirent, int dir, int file, const root_t *entry);
+void fragFile(int file, struct fs_fragmentation *frag);
+int fragDir(int dir, struct fs_fragmentation *frag);
+int preallocate(int file, size_t size);
+int transferRuns(int file, size_t offset, size_t count, int hostFd, int out);
+void *mapRuns(int file, size_t offset, size_t length);
+int readAt(int file, size_t offset, void *buf, size_t count);
+int writeAt(int file, size_t offset, const void *buf, size_t count);
+int readvAt(int file, size_t offset, const struct iovec *iov, int iovcnt, size_t count);
+int readLarge(int file, size_t offset, char *buf, size_t count);
+void readStop(void);
+int writevAt(int file, size_t offset, const struct iovec *iov, int iovcnt, size_t count);
+size_t vecPeek(vecCur_t *vec, char **ptr);
+void vecAdvance(vecCur_t *vec, size_t len);
+void vecCopy(vecCur_t *vec, char *mem, size_t len, int fill);
+ssize_t vecLength(const struct iovec *iov, int iovcnt);
+compF_t *loadComp(int file);
+int flushChunk(int file);
+int loadChunk(int file, int chunk);
+void releaseChunksFrom(int file, unsigned int chunk);
+int syncComp(int file);
+int compRead(int file, size_t offset, void *buf, size_t count);
+int compWrite(int file, size_t offset, const void *buf, size_t count);
+int dedupInit(void);
+void asyncDrain(void);
+int asyncSubmit(int write, int fd, void *buf, size_t count, fs_callback_t callback, void *arg);
+void dedupInsert(unsigned int index, uint32_t hash);
+void dedupForget(unsigned int index);
+unsigned int dedupLookup(uint32_t hash, const void *data);
+void releaseBlock(unsigned int index);
+int extentRemap(cursor_t *cur, unsigned int index);
+unsigned int dedupWrite(cursor_t *cur, unsigned int index, const void *data, int full);
+
+int fs_format(const char *diskname, unsigned int data_blocks, const struct fs_format_options *options)
+{
+  FS_LOCKED;
+
+  struct fs_format_options defaults;
+  memset(&defaults, 0, sizeof(defaults));
+  if (options == NULL)
+    options = &defaults;
+
+  size_t blockSize = options->block_size ? options->block_size : BLOCK_SIZE_DEFAULT;
+  const char *prefix = options->prefix ? options->prefix : "file";
+
+  if (diskname == NULL || blockSize < BLOCK_SIZE_MIN || blockSize > BLOCK_SIZE_MAX || (blockSize & (blockSize - 1)) != 0) // checks the options
+    return -1;
+
+  if ((options->flags & ~FS_FORMAT_ALLOCATE) || options->files > FS_FILE_MAX_COUNT)
+    return -1;
+
+  if (options->files && snprintf(NULL, 0, "%s%u", prefix, options->files - 1) >= FS_FILENAME_LEN) // longest name must fit an entry
+    return -1;
+
+  if (data_blocks == 0 || data_blocks >= UINT16_MAX) // block indexes are 16 bits wide, FAT_EOC included
+    return -1;
+
+  unsigned int fatBlocks = (data_blocks * sizeof(uint16_t) + blockSize - 1) / blockSize;
+  unsigned int rootBlocks = (FS_FILE_MAX_COUNT * sizeof(Root) + blockSize - 1) / blockSize;
+  unsigned int total = 1 + fatBlocks + rootBlocks + data_blocks;
+
+  if (total > UINT16_MAX)
+    return -1;
+
+  superB_t sb;
+  memset(&sb, 0, sizeof(sb));
+  memcpy(sb.sig, "ECS150FS", sizeof(sb.sig));
+  sb.totBlocks = total;
+  sb.rootIndex = 1 + fatBlocks;
+  sb.dataStartIndex = 1 + fatBlocks + rootBlocks;
+  sb.totDataBlocks = data_blocks;
+  sb.numFATBlocks = fatBlocks;
+  sb.blockShift = (blockSize == BLOCK_SIZE_DEFAULT) ? 0 : __builtin_ctz(blockSize); // disks of the original block size stay as fs_make makes them
+
+  char *meta = (char*) calloc(rootBlocks, blockSize); // holds one block, or the whole root directory
+  int fd = open(diskname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int ret = (meta && fd != -1) ? 0 : -1;
+
+  off_t bytes = (off_t) total * blockSize;
+  if (ret == 0 && (options->flags & FS_FORMAT_ALLOCATE)) // reserves the space, reading back as zeros
+    ret = posix_fallocate(fd, 0, bytes) ? -1 : 0;
+  else if (ret == 0) // leaves a hole, nothing is written past the metadata
+    ret = ftruncate(fd, bytes);
+
+  if (ret == 0) // super block
+  {
+    memcpy(meta, &sb, sizeof(sb) < blockSize ? sizeof(sb) : blockSize);
+    if (pwrite(fd, meta, blockSize, 0) != (ssize_t)blockSize)
+      ret = -1;
+  }
+
+  if (ret == 0) // first fat block, data block 0 is never handed out
+  {
+    memset(meta, 0, blockSize);
+    ((uint16_t*)meta)[0] = FAT_EOC;
+    if (pwrite(fd, meta, blockSize, blockSize) != (ssize_t)blockSize)
+      ret = -1;
+  }
+
+  if (ret == 0 && options->files) // root directory, only needed when it has entries
+  {
+    root_t *root = (root_t*) memset(meta, 0, (size_t) rootBlocks * blockSize);
+    for (unsigned int i = 0; i < options->files; i++)
+    {
+      snprintf(root[i].name, FS_FILENAME_LEN, "%s%u", prefix, i);
+      root[i].firstIndex = FAT_EOC;
+    }
+
+    if (pwrite(fd, meta, (size_t) rootBlocks * blockSize, (off_t) sb.rootIndex * blockSize) != (ssize_t) rootBlocks * blockSize)
+      ret = -1;
+  }
+
+  if (fd != -1 && close(fd) == -1)
+    ret = -1;
+  free(meta);
+  return ret;
+}
 
 int fs_mount(const char *diskname)
 {
-  if (block_disk_open(diskname) == -1) // checks if disk is open
+  return fs_mount_budget(diskname, 0, 0);
+}
+
+int fs_mount_flags(const char *diskname, int flags)
+{
+  return fs_mount_budget(diskname, flags, 0);
+}
+
+int fs_mount_budget(const char *diskname, int flags, size_t budget)
+{
+  FS_LOCKED;
+
+  if (flags & ~(FS_MOUNT_DIRECT | FS_MOUNT_WRITEBACK | FS_MOUNT_PUNCH)) // checks for unknown flags
+    return -1;
+
+  int diskFlags = ((flags & FS_MOUNT_DIRECT) ? BLOCK_DISK_DIRECT : 0) | ((flags & FS_MOUNT_WRITEBACK) ? BLOCK_DISK_WRITEBACK : 0);
+  if (block_disk_open_flags(diskname, diskFlags) == -1) // checks if disk is open
     return -1;
  
-  if (fat.blocks) // checks if disk is mounted already
+  if (fat.pages) // checks if disk is mounted already
+    return -1;
+
+  mountFlags = flags;
+  fdtReset();
+
+  if (nodeCount == 0 && nodeGrow() == -1) // per-file state of the root directory entries
+    return -1;
+
+  memset(&superBlock, 0, sizeof(superBlock));
+  if (block_disk_set_size(BLOCK_SIZE_MIN) == -1 || block_read(0, (void *)&superBlock) == -1) // reads into super block, whose fields fit the smallest block
+    return -1;
+  
+  if (memcmp(superBlock.sig, "ECS150FS", sizeof(superBlock.sig)) != 0) // checks if signature is ECS150FS
+    return -1;
+
+  if (superBlock.blockShift != 0 && (superBlock.blockShift < __builtin_ctz(BLOCK_SIZE_MIN) || superBlock.blockShift > __builtin_ctz(BLOCK_SIZE_MAX)))
+    return -1;
+
+  if (block_disk_set_size(superBlock.blockShift ? (size_t)1 << superBlock.blockShift : BLOCK_SIZE_DEFAULT) == -1) // switches to the block size of the disk
+    return -1;
+
+  if (superBlock.dataStartIndex < superBlock.rootIndex + ROOT_BLOCKS) // root directory must fit before the data blocks
+    return -1;
+
+  if (block_disk_count() != superBlock.totBlocks) // checks if total blocks were read correctly
+    return -1;
+
+  if (memorySplit(budget) == -1) // sizes the fat residency and the fingerprint index
+    return -1;
+
+  if (superBlock.features & FS_FEATURE_CSUM) // reads in the checksum region before anything it covers
+  {
+    csumTable = (uint32_t*) malloc(superBlock.csumBlocks * BLOCK_SIZE);
+    for (int i = 0; i < superBlock.csumBlocks; i++)
+    {
+      if (block_read(superBlock.dataStartIndex + superBlock.csumIndex + i, (char*)csumTable + i * BLOCK_SIZE) == -1)
+        return -1;
+    }
+
+    block_csum_attach(csumTable);
+    if (block_csum_verify(0, 1) != 0) // checks the super block that was read unchecked
+      return -1;
+  }
+
+  if (fatInit() == -1) // reads in the fat, keeping the last blocks read if it does not all fit
+    return -1;
+
+  if (regionRead(superBlock.rootIndex, rootDir, FS_FILE_MAX_COUNT * sizeof(Root)) == -1) // reads in the root directory from the disk
+    return -1;
+
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) // rebuilds the occupancy bitmap
+    rootMark(i, rootDir[i].name[0] != '\0');
+
+  if (superBlock.features & FS_FEATURE_DEDUP) // reads in the dedup region and rebuilds the fingerprint index
+  {
+    dedupTable = (dedupE_t*) malloc(superBlock.dedupBlocks * BLOCK_SIZE);
+    for (int i = 0; i < superBlock.dedupBlocks; i++)
+    {
+      if (block_read(superBlock.dataStartIndex + superBlock.dedupIndex + i, (char*)dedupTable + i * BLOCK_SIZE) == -1)
+        return -1;
+    }
+
+    if (dedupInit() == -1)
+      return -1;
+  }
+
+  if (superBlock.features & FS_FEATURE_INLINE) // reads in the root extension region
+  {
+    if (regionRead(superBlock.dataStartIndex + superBlock.extIndex, rootExt, sizeof(rootExt)) == -1)
+      return -1;
+
+    for (int i = 0; i < FS_FILE_MAX_COUNT; i++) // rebuilds the list of shared tail blocks
+    {
+      if (!(rootDir[i].flags & ROOT_TAIL) || strlen(rootDir[i].name) == 0)
+        continue;
+
+      uint16_t end = rootExt[i].tailOffset + rootDir[i].size % BLOCK_SIZE;
+      int t;
+      for (t = 0; t < tailCount; t++)
+      {
+        if (tailBlocks[t].index == rootExt[i].tailBlock)
+          break;
+      }
+
+      if (t == tailCount)
+      {
+        tailBlocks = (tailB_t*) realloc(tailBlocks, sizeof(TailBlock) * (tailCount + 1));
+        tailBlocks[t].index = rootExt[i].tailBlock;
+        tailBlocks[t].used = 0;
+        tailBlocks[t].live = 0;
+        tailCount++;
+      }
+
+      if (end > tailBlocks[t].used)
+        tailBlocks[t].used = end;
+      tailBlocks[t].live++;
+    }
+  }
+
+  return 0;
+}
+
+int fs_umount(void)
+{
+  asyncDrain(); // lets queued operations finish first
+  FS_LOCKED;
+
+  if(!fat.pages) // checks that disk id mounted
+    return -1;
+  
+  //write everything cached back to the disk
+  if(writeBack() == -1)
+    return -1;
+
+  //close the disk, a failed write-back still lets the state below go
+  int closed = block_disk_close();
+
+  fdtReset(); // fds left open go stale before the per-file state they point at is freed
+
+  free(csumTable); // frees checksum table
+  csumTable = NULL;
+
+  free(dedupTable); // frees dedup table and fingerprint index
+  free(dedupHeads);
+  free(dedupNext);
+  dedupTable = NULL;
+  dedupHeads = NULL;
+  dedupNext = NULL;
+
+  for(int i = 0; i < nodeCount; i++) // frees extent and compression caches
+  {
+    free(extentCache[i]);
+    free(compCache[i]);
+  }
+
+  free(rootDir); // frees every per-file array
+  free(nodes);
+  free(openFiles);
+  free(extentCache);
+  free(extentDirty);
+  free(lastBlock);
+  free(lastFileBlock);
+  free(compCache);
+  rootDir = NULL;
+  nodes = NULL;
+  openFiles = NULL;
+  extentCache = NULL;
+  extentDirty = NULL;
+  lastBlock = NULL;
+  lastFileBlock = NULL;
+  compCache = NULL;
+  nodeCount = 0;
+
+  free(tailBlocks); // frees tail block list
+  tailBlocks = NULL;
+  tailCount = 0;
+
+  for(unsigned int i = 0; i < mapCount; i++) // releases mappings the caller did not
+    munmap(mappings[i].base, mappings[i].length);
+  free(mappings);
+  mappings = NULL;
+  mapCount = 0;
+  mapCap = 0;
+
+  free(reclaimQueue); // emptied by writeBack()
+  reclaimQueue = NULL;
+  reclaimCount = 0;
+  reclaimCap = 0;
+
+  fatFree(); // frees fat
+  memoryBudget = 0;
+  dedupCap = 0;
+  mountFlags = 0;
+
+  reclaimStop(); // the reclaimer does not outlive the mount
+  readStop(); // nor do the readers
+  return closed;
+}
+
+int fs_sync(void)
+{
+  FS_LOCKED;
+
+  if(!fat.pages) // checks that disk is mounted
+    return -1;
+
+  //write everything cached back, then wait for the flusher to write it out
+  if(writeBack() == -1)
+    return -1;
+
+  return block_sync();
+}
+
+int writeBack(void)
+{
+  reclaimAll(); // the fat written below has no queued chains left
+
+  if(regionWrite(0, &superBlock, SUPER_BYTES) == -1) // writes super block back to the disk
+    return -1;
+
+  //write entries still loaded from subdirectories back to their directory
+  if(nodeFlush() == -1)
+    return -1;
+
+  //compress pending chunks and write chunk indexes back to disk
+  for(int i = 0; i < nodeCount; i++)
+  {
+    if(compCache[i] && syncComp(i) == -1)
+      return -1;
+  }
+
+  //write cached extent blocks back to disk
+  for(int i = 0; i < nodeCount; i++)
+  {
+    if(extentCache[i] && extentDirty[i])
+    {
+      if(block_write(superBlock.dataStartIndex + rootDir[i].firstIndex, extentCache[i]) == -1)
+        return -1;
+      extentDirty[i] = 0;
+    }
+  }
+
+  //write changed fat blocks out to disk
+  if(fatFlush() == -1)
+    return -1;
+  
+  //write root directory out to disk
+  if(regionWrite(superBlock.rootIndex, rootDir, FS_FILE_MAX_COUNT * sizeof(Root)) == -1)
     return -1;
 
-  for(int i = 0; i < FS_OPEN_MAX_COUNT; i++) // initializes fd table
+  //write root extension region out to disk
+  if(superBlock.features & FS_FEATURE_INLINE)
+  {
+    if(regionWrite(superBlock.dataStartIndex + superBlock.extIndex, rootExt, sizeof(rootExt)) == -1)
+      return -1;
+  }
+
+  //write dedup region out to disk
+  if(superBlock.features & FS_FEATURE_DEDUP)
+  {
+    for(int i = 0; i < superBlock.dedupBlocks; i++)
+    {
+      if(block_write(superBlock.dataStartIndex + superBlock.dedupIndex + i, (char*)dedupTable + i * BLOCK_SIZE) == -1)
+        return -1;
+    }
+  }
+
+  //write checksum region out to disk, unchecked since it holds the checksums
+  if(superBlock.features & FS_FEATURE_CSUM)
   {
-    fdt[i].indexInRoot = -1;
-    fdt[i].offset = 0;
+    block_csum_attach(NULL);
+    for(int i = 0; i < superBlock.csumBlocks; i++)
+    {
+      if(block_write(superBlock.dataStartIndex + superBlock.csumIndex + i, (char*)csumTable + i * BLOCK_SIZE) == -1)
+        return -1;
+    }
+    block_csum_attach(csumTable);
   }
 
-  if (block_read(0, (void *)&superBlock) == -1) // reads into super block
+  return 0;
+
+}
+
+int fs_info(void)
+{
+  FS_LOCKED;
+
+  if (!fat.pages) // checks if disk is mounted
     return -1;
+
+  reclaimAll(); // counts the blocks of deleted files as free
+
+  int fatRatio = superBlock.totDataBlocks;
+  int rootRatio = 0;
+
+  for (int i = 0; i < superBlock.numFATBlocks; i++) // calculates fat ratio from the free counts, without paging the fat in
+    fatRatio = fatRatio - fat.freeCount[i];
   
-  int temp = superBlock.totBlocks;
-  superBlock.sig[8] = '\0';
-  if (strcmp(superBlock.sig, "ECS150FS") != 0) // checks if signature is ECS150FS
+  for (int i = 0; i < ROOT_WORDS; i++) // calculates root ratio
+    rootRatio = rootRatio + __builtin_popcount(rootUsed[i]);
+
+  int fatCount = 1;
+
+  if (((superBlock.totDataBlocks * 2) / BLOCK_SIZE) != 0) // calculates total fat blocks
+    fatCount = (superBlock.totDataBlocks * 2) / BLOCK_SIZE;
+
+  printf("FS Info:\n");
+  printf("total_blk_count=%d\n", superBlock.totBlocks);
+  printf("fat_blk_count=%d\n", fatCount);
+  printf("rdir_blk=%d\n", superBlock.rootIndex);
+  printf("data_blk=%d\n", superBlock.dataStartIndex);
+  printf("data_blk_count=%d\n", superBlock.totDataBlocks);
+  printf("fat_free_ratio=%d/%d\n",  (superBlock.totDataBlocks-fatRatio), superBlock.totDataBlocks);
+  printf("rdir_free_ratio=%d/%d\n", (FS_FILE_MAX_COUNT-rootRatio), FS_FILE_MAX_COUNT);
+
+  return 0;
+}
+
+int fs_memory_usage(struct fs_memory *usage)
+{
+  FS_LOCKED;
+
+  if (!fat.pages || usage == NULL) // checks if disk is mounted
+    return -1;
+
+  memset(usage, 0, sizeof(*usage));
+  usage->budget = memoryBudget;
+  usage->fat_resident = fat.resident;
+  usage->fat_blocks = superBlock.numFATBlocks;
+  usage->fat_faults = fat.faults;
+  usage->fat = fat.resident * BLOCK_SIZE;
+
+  if (csumTable) // checksum region
+    usage->indexes = usage->indexes + superBlock.csumBlocks * BLOCK_SIZE;
+  if (dedupTable) // dedup region and fingerprint index
+    usage->indexes = usage->indexes + superBlock.dedupBlocks * BLOCK_SIZE + (dedupMask + 1 + superBlock.totDataBlocks) * sizeof(uint16_t);
+
+  usage->files = nodeCount * (sizeof(Root) + sizeof(Node) + 4 * sizeof(int) + sizeof(extB_t*) + sizeof(compF_t*));
+  usage->files = usage->files + sizeof(rootExt) + tailCount * sizeof(TailBlock) + fdtSize * sizeof(FDTable);
+  for (int i = 0; i < nodeCount; i++) // extent and compression caches
+  {
+    if (extentCache[i])
+      usage->files = usage->files + BLOCK_SIZE;
+    if (compCache[i])
+      usage->files = usage->files + sizeof(CompFile) + BLOCK_SIZE + CHUNK_SIZE;
+  }
+
+  struct block_writeback_stats wb;
+  if ((mountFlags & FS_MOUNT_WRITEBACK) && block_writeback_stats(&wb) == 0) // blocks waiting for the flusher
+    usage->dirty = wb.dirty * BLOCK_SIZE;
+
+  usage->total = usage->fat + usage->indexes + usage->files + usage->dirty;
+  return 0;
+}
+
+int fs_fragmentation(struct fs_fragmentation *frag)
+{
+  FS_LOCKED;
+
+  if (!fat.pages || frag == NULL) // checks if disk is mounted
+    return -1;
+
+  reclaimAll(); // free runs include the blocks of deleted files
+  memset(frag, 0, sizeof(*frag));
+  if (fragDir(NODE_NONE, frag) == -1)
     return -1;
 
-  superBlock.totBlocks = temp;
-  if (block_disk_count() != superBlock.totBlocks) // checks if total blocks were read correctly
+  unsigned int run = 0;
+  for (unsigned int i = 1; i <= superBlock.totDataBlocks; i++) // runs of free blocks, the end of the disk closing the last one
+  {
+    if (i < superBlock.totDataBlocks && fatGet(i) == 0)
+    {
+      run++;
+      continue;
+    }
+
+    if (run > 0)
+      frag->free_extents++;
+    if (run > frag->free_largest)
+      frag->free_largest = run;
+    run = 0;
+  }
+
+  return 0;
+}
+
+void fragFile(int file, struct fs_fragmentation *frag)
+{
+  unsigned int runs = 0;
+  unsigned int blocks = 0;
+
+  if (rootDir[file].flags & ROOT_INLINE) // no block at all
+    return;
+
+  if (rootDir[file].flags & FS_MODE_COMPRESS) // chunks are runs of their own, merged when they follow each other
+  {
+    compF_t *comp = loadComp(file);
+    unsigned int end = FAT_EOC;
+    for (int i = 0; comp && i < comp->index->count; i++)
+    {
+      chunk_t *chunk = &comp->index->chunks[i];
+      if (chunk->start == FAT_EOC || chunk->blocks == 0)
+        continue;
+      if (chunk->start != end)
+        runs++;
+      blocks = blocks + chunk->blocks;
+      end = chunk->start + chunk->blocks;
+    }
+  }
+  else
+  {
+    cursor_t cur;
+    unsigned int prev = FAT_EOC;
+    for (unsigned int index = cursorSeek(&cur, file, 0); index != FAT_EOC; index = cursorNext(&cur)) // a block not following the previous one starts a run
+    {
+      if (index != prev + 1)
+        runs++;
+      blocks++;
+      prev = index;
+    }
+  }
+
+  if (blocks == 0)
+    return;
+
+  frag->files++;
+  frag->blocks = frag->blocks + blocks;
+  frag->extents = frag->extents + runs;
+  if (runs > 1)
+    frag->fragmented++;
+}
+
+int fragDir(int dir, struct fs_fragmentation *frag)
+{
+  if (dir == NODE_NONE) // root directory entries are always in memory
+  {
+    for (int i = rootNext(0); i < FS_FILE_MAX_COUNT; i = rootNext(i + 1))
+    {
+      fragFile(i, frag);
+      if ((rootDir[i].flags & ROOT_DIR) && fragDir(i, frag) == -1)
+        return -1;
+    }
+    return 0;
+  }
+
+  dirB_t *bucket = (dirB_t*) block_buffer_get();
+  unsigned int blocks = rootDir[dir].size / BLOCK_SIZE;
+  int result = 0;
+
+  for (unsigned int b = 1; b < blocks && result == 0; b++) // every block past the header is a bucket
+  {
+    if (readAt(dir, (size_t)b * BLOCK_SIZE, bucket, BLOCK_SIZE) != BLOCK_SIZE)
+    {
+      result = -1;
+      break;
+    }
+
+    for (int i = 0; i < bucket->count && result == 0; i++)
+    {
+      int node = nodeGet(dir, bucket->entries[i].name);
+      if (node == -1)
+      {
+        result = -1;
+        break;
+      }
+
+      fragFile(node, frag);
+      if (rootDir[node].flags & ROOT_DIR)
+        result = fragDir(node, frag);
+      nodePut(node);
+    }
+  }
+
+  block_buffer_put(bucket);
+  return result;
+}
+
+int findFileInRootDirec(const char *filename)
+{
+  for(int i = rootNext(0); i < FS_FILE_MAX_COUNT; i = rootNext(i + 1))
+  {
+    if(strcmp(rootDir[i].name, filename) == 0) // checks if file name is in root directory
+      return i; 
+  }
+
+  return -1;
+}
+
+void rootMark(int file, int used)
+{
+  if (used)
+    rootUsed[file / 32] |= 1u << (file % 32);
+  else
+    rootUsed[file / 32] &= ~(1u << (file % 32));
+}
+
+int rootNext(int from)
+{
+  for (int w = from / 32; w < ROOT_WORDS; w++) // skips whole words of empty entries
+  {
+    uint32_t bits = rootUsed[w];
+    if (w == from / 32)
+      bits &= ~0u << (from % 32);
+    if (bits)
+      return w * 32 + __builtin_ctz(bits);
+  }
+
+  return FS_FILE_MAX_COUNT;
+}
+
+int fs_create(const char *filename)
+{
+  return fs_create_mode(filename, 0);
+}
+
+int fs_create_mode(const char *filename, int mode)
+{
+  FS_LOCKED;
+
+  //if mode holds unknown flags
+  if(mode & ~(FS_MODE_EXTENT | FS_MODE_COMPRESS))
+    return -1;
+
+  //compressed files have their own chunk layout
+  if((mode & FS_MODE_EXTENT) && (mode & FS_MODE_COMPRESS))
+    return -1;
+
+  //if path is invalid or goes through a missing directory
+  int dir;
+  char name[FS_FILENAME_LEN];
+  if(pathParent(filename, &dir, name) == -1)
+    return -1;
+
+  int result = createEntry(dir, name, mode);
+  nodePut(dir);
+
+  return result;
+}
+
+int fs_mkdir(const char *path)
+{
+  FS_LOCKED;
+
+  int dir;
+  char name[FS_FILENAME_LEN];
+  if(pathParent(path, &dir, name) == -1)
+    return -1;
+
+  int result = createEntry(dir, name, FS_MODE_EXTENT | ROOT_DIR); // directory blocks are laid out on the first insert
+  nodePut(dir);
+
+  return result;
+}
+
+int createEntry(int dir, const char *name, int flags)
+{
+  if(dir != NODE_NONE) // entry goes into a subdirectory
+  {
+    if(nodeFind(dir, name) != -1) // already loaded, so it exists
+      return -1;
+
+    dirB_t *bucket = (dirB_t*) block_buffer_get();
+    unsigned int fileBlock;
+    int exists = dirLookup(dir, name, bucket, &fileBlock) != -1;
+    block_buffer_put(bucket);
+    if(exists)
+      return -1;
+
+    root_t entry;
+    memset(&entry, 0, sizeof(Root));
+    strcpy(entry.name, name);
+    entry.firstIndex = FAT_EOC;
+    entry.flags = flags;
+    return dirInsert(dir, &entry);
+  }
+
+  //if file name already exists in file directory
+  if(findFileInRootDirec(name) != -1)
+    return -1;
+
+  //find empty entry in root directory
+  int full = 0;
+  for(int w = 0; w < ROOT_WORDS && !full; w++)
+  {
+    if(rootUsed[w] != ~0u)
+    {
+      int i = w * 32 + __builtin_ctz(~rootUsed[w]);
+      rootMark(i, 1);
+      memset(&rootDir[i], 0, sizeof(Root));
+      strcpy(rootDir[i].name, name);
+      rootDir[i].size = 0;
+      rootDir[i].firstIndex = FAT_EOC;
+      rootDir[i].flags = flags;
+      if((superBlock.features & FS_FEATURE_INLINE) && !(flags & ROOT_DIR)) // new files start inline
+        rootDir[i].flags |= ROOT_INLINE;
+      full = 1;
+    }
+  }
+  
+  //if root directory is already full
+  if(!full)
+    return -1;
+  
+  return 0;
+}
+
+int fs_delete(const char *filename)
+{
+  FS_LOCKED;
+
+  //path is invalid or goes through a missing directory
+  int dir;
+  char name[FS_FILENAME_LEN];
+  if(pathParent(filename, &dir, name) == -1)
+    return -1;
+
+  int file = nodeGet(dir, name);
+  int result = removeEntry(dir, file, 0);
+  nodePut(file);
+  nodePut(dir);
+
+  return result;
+}
+
+int fs_rmdir(const char *path)
+{
+  FS_LOCKED;
+
+  int dir;
+  char name[FS_FILENAME_LEN];
+  if(pathParent(path, &dir, name) == -1)
+    return -1;
+
+  int file = nodeGet(dir, name);
+  int result = removeEntry(dir, file, ROOT_DIR);
+  nodePut(file);
+  nodePut(dir);
+
+  return result;
+}
+
+int removeEntry(int dir, int file, int isDir)
+{
+  //no such entry, or not of the kind asked for
+  if(file == -1 || (rootDir[file].flags & ROOT_DIR) != isDir)
+    return -1;
+
+  //file is currently open
+  if(openFiles[file] > 0)
+    return -1;
+
+  //directory still holds entries
+  if(isDir && dirEntries(file) != 0)
+    return -1;
+
+  reclaimBlocks(file);
+
+  if(dir != NODE_NONE) // drops the entry from its subdirectory, the node goes once released
+  {
+    if(dirRemove(dir, rootDir[file].name) == -1)
+      return -1;
+    nodes[file].removed = 1;
+    return 0;
+  }
+
+  memset(&rootDir[file], 0, sizeof(Root)); // this clears the entry from the root directory
+  rootDir[file].firstIndex = FAT_EOC;
+  rootMark(file, 0);
+
+  return 0;
+}
+
+int fs_ls(void)
+{
+  FS_LOCKED;
+
+  if (!fat.pages)
+    return -1;
+
+  printf("FS Ls:\n");
+
+  for (int i = rootNext(0); i < FS_FILE_MAX_COUNT; i = rootNext(i + 1)) // prints info from root directory
+    printf("%s: %s, size: %d, data_blk: %d\n", (rootDir[i].flags & ROOT_DIR) ? "dir" : "file",
+           rootDir[i].name, rootDir[i].size, rootDir[i].firstIndex);
+
+  return 0;
+}
+
+int fs_ls_dir(const char *path)
+{
+  FS_LOCKED;
+
+  if (!fat.pages || path == NULL)
+    return -1;
+
+  if (path[strspn(path, "/")] == '\0') // root directory
+    return fs_ls();
+
+  int dir;
+  char name[FS_FILENAME_LEN];
+  if (pathParent(path, &dir, name) == -1)
+    return -1;
+
+  int node = nodeGet(dir, name);
+  nodePut(dir);
+  if (node == -1 || !(rootDir[node].flags & ROOT_DIR))
+  {
+    nodePut(node);
+    return -1;
+  }
+
+  dirB_t *bucket = (dirB_t*) block_buffer_get();
+  unsigned int blocks = rootDir[node].size / BLOCK_SIZE;
+  int result = 0;
+
+  printf("FS Ls:\n");
+
+  for (unsigned int b = 1; b < blocks; b++) // every block past the header is a bucket
+  {
+    if (readAt(node, (size_t)b * BLOCK_SIZE, bucket, BLOCK_SIZE) != BLOCK_SIZE)
+    {
+      result = -1;
+      break;
+    }
+
+    for (int i = 0; i < bucket->count; i++)
+    {
+      root_t *entry = &bucket->entries[i];
+      int loaded = nodeFind(node, entry->name);
+      if (loaded != -1) // loaded entry may be ahead of the directory block
+        entry = &rootDir[loaded];
+
+      printf("%s: %s, size: %d, data_blk: %d\n", (entry->flags & ROOT_DIR) ? "dir" : "file",
+             entry->name, entry->size, entry->firstIndex);
+    }
+  }
+
+  block_buffer_put(bucket);
+  nodePut(node);
+  return result;
+}
+
+int fs_readdir(const char *path, unsigned int *pos, struct fs_dirent *entries, int max)
+{
+  FS_LOCKED;
+
+  if (!fat.pages || path == NULL || pos == NULL || entries == NULL || max < 0)
+    return -1;
+
+  int count = 0;
+
+  if (path[strspn(path, "/")] == '\0') // root directory, walks the occupancy bitmap
+  {
+    if (*pos >= FS_FILE_MAX_COUNT) // past the last entry
+      return 0;
+
+    int i;
+    for (i = rootNext(*pos); i < FS_FILE_MAX_COUNT && count < max; i = rootNext(i + 1))
+      fillDirent(&entries[count++], NODE_NONE, i, &rootDir[i]);
+
+    *pos = i;
+    return count;
+  }
+
+  int dir;
+  char name[FS_FILENAME_LEN];
+  if (pathParent(path, &dir, name) == -1)
+    return -1;
+
+  int node = nodeGet(dir, name);
+  nodePut(dir);
+  if (node == -1 || !(rootDir[node].flags & ROOT_DIR))
+  {
+    nodePut(node);
+    return -1;
+  }
+
+  dirB_t *bucket = (dirB_t*) block_buffer_get();
+  unsigned int blocks = rootDir[node].size / BLOCK_SIZE;
+  unsigned int b = *pos / DIR_ENTRIES + 1; // position counts entry slots of the buckets past the header
+  unsigned int slot = *pos % DIR_ENTRIES;
+
+  while (count < max && b < blocks)
+  {
+    if (readAt(node, (size_t)b * BLOCK_SIZE, bucket, BLOCK_SIZE) != BLOCK_SIZE)
+    {
+      count = -1;
+      break;
+    }
+
+    for (; slot < bucket->count && count < max; slot++)
+      fillDirent(&entries[count++], node, nodeFind(node, bucket->entries[slot].name), &bucket->entries[slot]);
+
+    if (slot >= bucket->count) // moves on to the next bucket
+    {
+      b++;
+      slot = 0;
+    }
+  }
+
+  if (count != -1)
+    *pos = (b - 1) * DIR_ENTRIES + slot;
+
+  block_buffer_put(bucket);
+  nodePut(node);
+  return count;
+}
+
+void fillDirent(struct fs_dirent *dirent, int dir, int file, const root_t *entry)
+{
+  if (file != -1) // loaded entry may be ahead of its directory block
+    entry = &rootDir[file];
+
+  memcpy(dirent->name, entry->name, FS_FILENAME_LEN);
+  dirent->name[FS_FILENAME_LEN - 1] = '\0';
+  dirent->size = entry->size;
+  dirent->first_block = entry->firstIndex;
+  dirent->block_count = file != -1 ? blockCount(file) : storedBlocks(entry);
+  dirent->is_dir = (entry->flags & ROOT_DIR) != 0;
+}
+
+unsigned int storedBlocks(const root_t *entry)
+{
+  if ((entry->flags & ROOT_INLINE) || entry->firstIndex == FAT_EOC) // no block at all
+    return 0;
+
+  if (!(entry->flags & (FS_MODE_EXTENT | FS_MODE_COMPRESS))) // walks the fat chain
+  {
+    unsigned int count = 0;
+    for (unsigned int index = entry->firstIndex; index != FAT_EOC; index = fatGet(index))
+      count++;
+    return count;
+  }
+
+  char *block = (char*) block_buffer_get(); // extent or chunk index block, up to date since the entry is not loaded
+  unsigned int count = 0;
+
+  if (block_read(superBlock.dataStartIndex + entry->firstIndex, block) == 0)
+  {
+    if (entry->flags & FS_MODE_COMPRESS)
+    {
+      chunkIdx_t *index = (chunkIdx_t*) block;
+      for (int i = 0; i < index->count; i++)
+        count = count + index->chunks[i].blocks;
+    }
+    else
+    {
+      extB_t *ext = (extB_t*) block;
+      if (ext->count > 0)
+        count = ext->extents[ext->count - 1].fileBlock + ext->extents[ext->count - 1].length;
+    }
+  }
+
+  block_buffer_put(block);
+  return count;
+}
+
+int fs_stat_many(const char **paths, int count, int *sizes)
+{
+  FS_LOCKED;
+
+  if (!fat.pages || paths == NULL || sizes == NULL || count < 0)
+    return -1;
+
+  dirB_t *bucket = (dirB_t*) block_buffer_get();
+  const char *prevPath = NULL;
+  size_t prevLen = 0;
+  int dir = NODE_NONE;
+  int dirValid = 0;
+  int found = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    const char *path = paths[i];
+    sizes[i] = -1;
+    if (path == NULL)
+      continue;
+
+    const char *slash = strrchr(path, '/');
+    size_t len = slash ? (size_t)(slash - path) : 0;
+
+    if (!dirValid || len != prevLen || strncmp(path, prevPath, len) != 0) // resolves the directory only when it changes
+    {
+      char name[FS_FILENAME_LEN];
+      if (dirValid)
+        nodePut(dir);
+      dirValid = pathParent(path, &dir, name) == 0;
+      if (!dirValid)
+        continue;
+      prevPath = path;
+      prevLen = len;
+    }
+
+    const char *name = slash ? slash + 1 : path;
+    if (*name == '\0' || strlen(name) >= FS_FILENAME_LEN)
+      continue;
+
+    int file = dir == NODE_NONE ? findFileInRootDirec(name) : nodeFind(dir, name);
+    unsigned int fileBlock;
+    if (file != -1)
+      sizes[i] = rootDir[file].size;
+    else if (dir != NODE_NONE && (file = dirLookup(dir, name, bucket, &fileBlock)) != -1) // reads the entry without loading it
+      sizes[i] = bucket->entries[file].size;
+
+    if (sizes[i] != -1)
+      found++;
+  }
+
+  if (dirValid)
+    nodePut(dir);
+  block_buffer_put(bucket);
+  return found;
+}
+
+int fs_open(const char *filename)
+{
+  return fs_open_flags(filename, 0);
+}
+
+int fs_open_flags(const char *filename, int flags)
+{
+  FS_LOCKED;
+
+  if (flags & ~FS_OPEN_APPEND) // checks for unknown flags
+    return -1;
+
+  if (openNow >= openMax) // checks if the fd table has reached its max
+    return -1;
+
+  if (fdtFree == FD_NONE) // no free slot left, grows the table by a chunk
+  {
+    if (fdtSize == FD_SLOTS)
+      return -1;
+
+    fdt_t *chunk = (fdt_t*) calloc(FD_CHUNK, sizeof(FDTable));
+    if (!chunk)
+      return -1;
+
+    fdt[fdtSize / FD_CHUNK] = chunk;
+    for (int i = FD_CHUNK - 1; i >= 0; i--)
+    {
+      chunk[i].indexInRoot = -1;
+      chunk[i].nextFree = fdtFree;
+      fdtFree = fdtSize + i;
+    }
+    fdtSize = fdtSize + FD_CHUNK;
+  }
+
+  int dir;
+  char name[FS_FILENAME_LEN];
+  if (pathParent(filename, &dir, name) == -1) // checks if path is valid and every directory on it exists
+    return -1;
+
+  int check = nodeGet(dir, name); // finds the entry of the file, the fd keeps it loaded
+  nodePut(dir);
+  if (check == -1)
+    return -1;
+
+  if (rootDir[check].flags & ROOT_DIR) // directories are not opened as files
+  {
+    nodePut(check);
+    return -1;
+  }
+
+  unsigned int index = fdtFree; // takes the first free slot
+  fdt_t *entry = fdSlot(index);
+  fdtFree = entry->nextFree;
+
+  entry->indexInRoot = check;
+  entry->offset = 0;
+  entry->pending = 0;
+  entry->append = (flags & FS_OPEN_APPEND) != 0;
+  openNow++;
+  openFiles[check]++;
+
+  return index | (entry->generation << FD_INDEX_BITS); // returns fd id
+}
+
+int fs_close(int fd)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return -1;
+
+  if (entry->pending > 0) // asynchronous operations still use the fd
+    return -1;
+
+  int file = entry->indexInRoot;
+  entry->indexInRoot = -1; // resets fd table for file
+  entry->offset = 0;
+  entry->generation = (entry->generation + 1) & FD_GEN_MASK; // fd goes stale
+  entry->nextFree = fdtFree;
+  fdtFree = fd & (FD_SLOTS - 1);
+  openNow--;
+  openFiles[file]--;
+
+  int result = 0;
+  if (compCache[file] && openCount(file) == 0 && flushChunk(file) == -1) // compresses the last chunk written
+    result = -1;
+  else if ((superBlock.features & FS_FEATURE_INLINE) && openCount(file) == 0) // packs small files and tails
+    packFile(file);
+
+  if (memoryBudget && file < FS_FILE_MAX_COUNT && openCount(file) == 0) // a budgeted mount keeps no cache for closed files
+  {
+    if (nodeSync(file) == -1)
+      result = -1;
+    else
+    {
+      free(extentCache[file]);
+      extentCache[file] = NULL;
+      free(compCache[file]);
+      compCache[file] = NULL;
+    }
+  }
+
+  nodePut(file); // subdirectory entries are written back once nothing holds them
+
+  return result;
+}
+
+int fs_stat(int fd)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return -1;
+
+  int result = rootDir[entry->indexInRoot].size; // returns size of file
+
+  return result;
+}
+
+int fs_lseek(int fd, size_t offset)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return -1;
+
+  if (offset > fs_stat(fd) || offset < 0) // checks if offset is valid
+    return -1;
+
+  entry->offset = offset; // changes offset 
+
+  return 0;
+}
+
+
+int regionRead(unsigned int block, void *buf, size_t len)
+{
+  size_t whole = len / BLOCK_SIZE;
+  for (size_t i = 0; i < whole; i++) // whole blocks go straight into buf
+  {
+    if (block_read(block + i, (char*)buf + i * BLOCK_SIZE) == -1)
+      return -1;
+  }
+
+  if (len % BLOCK_SIZE == 0)
+    return 0;
+
+  char *last = (char*) block_buffer_get(); // metadata smaller than a block ends in a partial one
+  int ret = last ? block_read(block + whole, last) : -1;
+  if (ret == 0)
+    memcpy((char*)buf + whole * BLOCK_SIZE, last, len % BLOCK_SIZE);
+  block_buffer_put(last);
+  return ret;
+}
+
+int regionWrite(unsigned int block, const void *buf, size_t len)
+{
+  size_t whole = len / BLOCK_SIZE;
+  for (size_t i = 0; i < whole; i++)
+  {
+    if (block_write(block + i, (const char*)buf + i * BLOCK_SIZE) == -1)
+      return -1;
+  }
+
+  if (len % BLOCK_SIZE == 0)
+    return 0;
+
+  char *last = (char*) block_buffer_get(); // partial last block is padded with zeros
+  if (!last)
+    return -1;
+  memset(last, 0, BLOCK_SIZE);
+  memcpy(last, (const char*)buf + whole * BLOCK_SIZE, len % BLOCK_SIZE);
+  int ret = block_write(block + whole, last);
+  block_buffer_put(last);
+  return ret;
+}
+
+int memorySplit(size_t budget)
+{
+  unsigned int buckets = 1;
+  while (buckets < superBlock.totDataBlocks) // same sizing as dedupInit
+    buckets = buckets * 2;
+
+  memoryBudget = budget;
+  dedupCap = 0;
+  fat.limit = superBlock.numFATBlocks;
+  if (budget == 0) // no budget, the whole fat stays in memory
+    return 0;
+
+  size_t fixed = 0; // regions that are always in memory
+  if (superBlock.features & FS_FEATURE_CSUM)
+    fixed = fixed + superBlock.csumBlocks * BLOCK_SIZE;
+  if (superBlock.features & FS_FEATURE_DEDUP)
+    fixed = fixed + superBlock.dedupBlocks * BLOCK_SIZE + superBlock.totDataBlocks * sizeof(uint16_t);
+
+  if (budget < fixed + BLOCK_SIZE) // not even one fat block fits
+    return -1;
+
+  size_t left = budget - fixed;
+  if (superBlock.features & FS_FEATURE_DEDUP) // up to a quarter of the rest goes to the fingerprint index
+  {
+    while (buckets > 1 && buckets * sizeof(uint16_t) > left / 4)
+      buckets = buckets / 2;
+    dedupCap = buckets;
+    left = left - buckets * sizeof(uint16_t);
+  }
+
+  if (left / BLOCK_SIZE < fat.limit)
+    fat.limit = left / BLOCK_SIZE;
+
+  return fat.limit ? 0 : -1;
+}
+
+int fatInit(void)
+{
+  fat.pages = (uint16_t**) calloc(superBlock.numFATBlocks, sizeof(uint16_t*));
+  fat.freeCount = (uint16_t*) calloc(superBlock.numFATBlocks, sizeof(uint16_t));
+  fat.dirty = (uint8_t*) calloc(superBlock.numFATBlocks, 1);
+  fat.used = (uint8_t*) calloc(superBlock.numFATBlocks, 1);
+  fat.resident = 0;
+  fat.hand = 0;
+  if (!fat.pages || !fat.freeCount || !fat.dirty || !fat.used)
+  {
+    fatFree();
+    return -1;
+  }
+
+  for (int i = 0; i < superBlock.numFATBlocks; i++) // pages every fat block in once to count its free entries
+  {
+    uint16_t *page = fatPage(i);
+    if (!page)
+    {
+      fatFree();
+      return -1;
+    }
+
+    for (int j = 0; j < FAT_PER_BLOCK && i * FAT_PER_BLOCK + j < superBlock.totDataBlocks; j++)
+    {
+      if (page[j] == 0)
+        fat.freeCount[i]++;
+    }
+  }
+  fat.faults = 0;
+
+  return 0;
+}
+
+void fatFree(void)
+{
+  for (int i = 0; fat.pages && i < superBlock.numFATBlocks; i++)
+    free(fat.pages[i]);
+
+  free(fat.pages);
+  free(fat.freeCount);
+  free(fat.dirty);
+  free(fat.used);
+  fat.pages = NULL;
+  fat.freeCount = NULL;
+  fat.dirty = NULL;
+  fat.used = NULL;
+  fat.resident = 0;
+}
+
+int fatEvict(void)
+{
+  for (unsigned int step = 0; step < 2 * superBlock.numFATBlocks; step++) // clock: a used block gets a second chance
+  {
+    unsigned int i = fat.hand;
+    fat.hand = (fat.hand + 1) % superBlock.numFATBlocks;
+
+    if (!fat.pages[i])
+      continue;
+
+    if (fat.used[i])
+    {
+      fat.used[i] = 0;
+      continue;
+    }
+
+    if (fat.dirty[i] && block_write(1 + i, fat.pages[i]) == -1) // keeps a block that cannot be written back
+      continue;
+
+    free(fat.pages[i]);
+    fat.pages[i] = NULL;
+    fat.dirty[i] = 0;
+    fat.resident--;
+    return 1;
+  }
+
+  return 0;
+}
+
+uint16_t *fatPage(unsigned int page)
+{
+  if (fat.pages[page])
+  {
+    fat.used[page] = 1;
+    return fat.pages[page];
+  }
+
+  while (fat.resident >= fat.limit && fatEvict()) // makes room within the budget
+    ;
+
+  uint16_t *data = (uint16_t*) malloc(BLOCK_SIZE);
+  if (!data || block_read(1 + page, data) == -1)
+  {
+    free(data);
+    return NULL;
+  }
+
+  fat.pages[page] = data;
+  fat.used[page] = 1;
+  fat.resident++;
+  fat.faults++;
+  return data;
+}
+
+unsigned int fatGet(unsigned int index)
+{
+  uint16_t *page = fatPage(index / FAT_PER_BLOCK);
+  if (!page) // a fat block that cannot be read shows as used and ends every chain
+    return FAT_EOC;
+
+  return page[index % FAT_PER_BLOCK];
+}
+
+void fatSet(unsigned int index, unsigned int value)
+{
+  unsigned int p = index / FAT_PER_BLOCK;
+  uint16_t *page = fatPage(p);
+  if (!page)
+    return;
+
+  uint16_t *entry = &page[index % FAT_PER_BLOCK];
+  if (*entry == 0 && value != 0)
+    fat.freeCount[p]--;
+  else if (*entry != 0 && value == 0)
+    fat.freeCount[p]++;
+
+  *entry = value;
+  fat.dirty[p] = 1;
+}
+
+int fatFlush(void)
+{
+  for (int i = 0; i < superBlock.numFATBlocks; i++) // writes back the fat blocks that changed
+  {
+    if (fat.pages[i] && fat.dirty[i])
+    {
+      if (block_write(1 + i, fat.pages[i]) == -1)
+        return -1;
+      fat.dirty[i] = 0;
+    }
+  }
+
+  return 0;
+}
+
+unsigned int fatFreeBlocks(void)
+{
+  unsigned int count = 0;
+  for (int i = 0; i < superBlock.numFATBlocks; i++)
+    count = count + fat.freeCount[i];
+
+  return count;
+}
+
+int nextOpen()
+{
+  for (int i = 1; i < superBlock.totDataBlocks; i++) // finds the next open spot in fat
+  {
+    if (fat.freeCount[i / FAT_PER_BLOCK] == 0) // skips full fat blocks without paging them in
+    {
+      i = (i / FAT_PER_BLOCK + 1) * FAT_PER_BLOCK - 1;
+      continue;
+    }
+
+    if (fatGet(i) == 0)
+      return i;
+  }
+
+  if (reclaimCount > 0) // blocks of deleted files are freed before giving up
+  {
+    reclaimAll();
+    return nextOpen();
+  }
+
+  return -1;
+}
+
+int growsInto(int file, unsigned int index)
+{
+  for (int i = 0; i < nodeCount; i++) // open files grow right after their last block
+  {
+    if (i != file && openFiles[i] > 0 && lastBlock[i] != FAT_EOC && lastBlock[i] + 1 == index)
+      return 1;
+  }
+
+  return 0;
+}
+
+unsigned int allocGoal(int file)
+{
+  int spot = nextOpen();
+  if (spot == -1)
+    return FAT_EOC;
+
+  if (!growsInto(file, spot)) // nobody grows into it, the layout stays the one of the reference tool
+    return spot;
+
+  for (unsigned int g = spot / FAT_PER_BLOCK + 1; g < superBlock.numFATBlocks; g++) // allocation groups are the blocks of one fat block
+  {
+    unsigned int first = g * FAT_PER_BLOCK;
+    unsigned int end = (first + FAT_PER_BLOCK < superBlock.totDataBlocks) ? first + FAT_PER_BLOCK : superBlock.totDataBlocks;
+    if (fat.freeCount[g] * 2 < end - first) // skips groups that are more than half full
+      continue;
+
+    for (unsigned int i = first; i < end; i++) // first free block of the group, unless a file already grows there
+    {
+      if (fatGet(i) == 0)
+      {
+        if (!growsInto(file, i))
+          return i;
+        break;
+      }
+    }
+  }
+
+  unsigned int best = spot;
+  unsigned int bestRun = 0;
+  for (int i = 0; i < nodeCount; i++) // no group left, splits the longest room a growing file has
+  {
+    if (i == file || openFiles[i] == 0 || lastBlock[i] == FAT_EOC)
+      continue;
+
+    unsigned int run = 0;
+    while (lastBlock[i] + 1 + run < superBlock.totDataBlocks && fatGet(lastBlock[i] + 1 + run) == 0)
+      run++;
+
+    if (run >= 2 && run > bestRun) // a single free block is all the room that file has
+    {
+      best = lastBlock[i] + 1;
+      bestRun = run;
+    }
+  }
+
+  if (bestRun > 0)
+    return best + bestRun / 2;
+
+  for (unsigned int i = spot + 1; i < superBlock.totDataBlocks; i++) // no room to split, first free block nobody grows into
+  {
+    if (fatGet(i) == 0 && !growsInto(file, i))
+      return i;
+  }
+
+  return spot;
+}
+
+extB_t *loadExtents(int file)
+{
+  if (extentCache[file]) // extent block is already in memory
+    return extentCache[file];
+
+  extB_t *ext = (extB_t*) malloc(BLOCK_SIZE);
+  if (!ext)
+    return NULL;
+
+  if (rootDir[file].firstIndex == FAT_EOC) // file has no extent block yet
+    memset(ext, 0, BLOCK_SIZE);
+  else if (block_read(superBlock.dataStartIndex + rootDir[file].firstIndex, ext) == -1)
+  {
+    free(ext);
+    return NULL;
+  }
+
+  extentCache[file] = ext;
+  extentDirty[file] = 0;
+  return ext;
+}
+
+unsigned int cursorSeek(cursor_t *cur, int file, unsigned int fileBlock)
+{
+  EVENT_SCOPE(__func__);
+
+  cur->file = file;
+  cur->fileBlock = fileBlock;
+  cur->dataIndex = FAT_EOC;
+  cur->last = FAT_EOC;
+  cur->extent = -1;
+
+  if (rootDir[file].flags & FS_MODE_EXTENT)
+  {
+    extB_t *ext = loadExtents(file);
+    if (!ext || ext->count == 0)
+      return FAT_EOC;
+
+    int low = 0;
+    int high = ext->count - 1;
+    while (low < high) // binary search for the last extent starting at or before fileBlock
+    {
+      int mid = (low + high + 1) / 2;
+      if (ext->extents[mid].fileBlock <= fileBlock)
+        low = mid;
+      else
+        high = mid - 1;
+    }
+
+    extent_t *e = &ext->extents[low];
+    if (fileBlock >= e->fileBlock && fileBlock < e->fileBlock + e->length)
+    {
+      cur->extent = low;
+      cur->dataIndex = e->start + (fileBlock - e->fileBlock);
+      cur->last = cur->dataIndex;
+    }
+    else // past the end of file, remember the tail for appending
+    {
+      cur->extent = ext->count - 1;
+      cur->last = ext->extents[ext->count - 1].start + ext->extents[ext->count - 1].length - 1;
+    }
+
+    return cur->dataIndex;
+  }
+
+  unsigned int last = lastBlock[file];
+  if (last != FAT_EOC && fileBlock >= lastFileBlock[file] && !(rootDir[file].flags & FS_MODE_COMPRESS) &&
+      fatGet(last) == FAT_EOC) // the last block or past it, no need to walk the chain
+  {
+    cur->last = last;
+    if (fileBlock == lastFileBlock[file])
+      cur->dataIndex = last;
+    return cur->dataIndex;
+  }
+
+  unsigned int index = rootDir[file].firstIndex;
+  unsigned int i;
+  for (i = 0; i < fileBlock && index != FAT_EOC; i++) // follows the fat chain
+  {
+    cur->last = index;
+    index = fatGet(index);
+  }
+
+  cur->dataIndex = index;
+  if (index != FAT_EOC)
+    cur->last = index;
+  else if (cur->last != FAT_EOC) // walked off the end, the next append starts from there
+  {
+    lastBlock[file] = cur->last;
+    lastFileBlock[file] = i - 1;
+  }
+
+  return index;
+}
+
+unsigned int cursorNext(cursor_t *cur)
+{
+  if (cur->dataIndex == FAT_EOC) // already past the end of file
+    return FAT_EOC;
+
+  cur->fileBlock++;
+
+  if (rootDir[cur->file].flags & FS_MODE_EXTENT)
+  {
+    extB_t *ext = extentCache[cur->file];
+    extent_t *e = &ext->extents[cur->extent];
+
+    if (cur->fileBlock < e->fileBlock + e->length) // still inside the current extent
+      cur->dataIndex++;
+    else if (cur->extent + 1 < ext->count) // moves on to the next extent
+    {
+      cur->extent++;
+      cur->dataIndex = ext->extents[cur->extent].start;
+    }
+    else
+      cur->dataIndex = FAT_EOC;
+  }
+  else
+    cur->dataIndex = fatGet(cur->dataIndex);
+
+  if (cur->dataIndex != FAT_EOC)
+    cur->last = cur->dataIndex;
+
+  return cur->dataIndex;
+}
+
+unsigned int cursorAppend(cursor_t *cur, unsigned int goal)
+{
+  EVENT_SCOPE(__func__);
+
+  int file = cur->file;
+
+  if (rootDir[file].flags & FS_MODE_EXTENT)
+  {
+    extB_t *ext = loadExtents(file);
+    if (!ext)
+      return FAT_EOC;
+
+    int newSpot = -1;
+    extent_t *tail = ext->count ? &ext->extents[ext->count - 1] : NULL;
+    if (goal == FAT_EOC && tail) // prefers the block right after the tail to keep the extent contiguous
+      goal = tail->start + tail->length;
+    else if (goal == FAT_EOC) // first block, placed away from files that are growing
+      goal = allocGoal(file);
+
+    if (goal < superBlock.totDataBlocks && fatGet(goal) == 0)
+      newSpot = goal;
+    else
+      newSpot = nextOpen();
+
+    if (newSpot == -1)
+      return FAT_EOC;
+
+    int grow = tail && newSpot == tail->start + tail->length && tail->length < UINT16_MAX;
+    if (!grow && ext->count == EXTENT_MAX) // extent block is full
+      return FAT_EOC;
+
+    if (rootDir[file].firstIndex == FAT_EOC) // first write, allocate the extent block after the data block
+    {
+      fatSet(newSpot, FAT_EOC);
+      int spot = nextOpen();
+      fatSet(newSpot, 0);
+      if (spot == -1)
+        return FAT_EOC;
+      fatSet(spot, FAT_EOC);
+      rootDir[file].firstIndex = spot;
+    }
+
+    if (grow)
+      tail->length++; // grows the last extent
+    else
+    {
+
+      extent_t *e = &ext->extents[ext->count];
+      e->fileBlock = tail ? tail->fileBlock + tail->length : 0;
+      e->start = newSpot;
+      e->length = 1;
+      ext->count++;
+    }
+
+    fatSet(newSpot, FAT_EOC); // marks the block as used
+    extentDirty[file] = 1;
+    lastBlock[file] = newSpot;
+    cur->extent = ext->count - 1;
+    cur->dataIndex = newSpot;
+    cur->last = newSpot;
+    return newSpot;
+  }
+
+  if (goal == FAT_EOC) // continues the chain right after its last block, or starts it away from growing files
+    goal = (cur->last != FAT_EOC) ? cur->last + 1 : allocGoal(file);
+
+  int newSpot;
+  if (goal < superBlock.totDataBlocks && fatGet(goal) == 0) // takes the wanted block if free
+    newSpot = goal;
+  else
+    newSpot = nextOpen();
+
+  if (newSpot == -1)
+    return FAT_EOC;
+
+  if (cur->last == FAT_EOC) // file had no blocks yet
+    lastFileBlock[file] = 0;
+  else if (cur->last == lastBlock[file]) // one past the known tail
+    lastFileBlock[file]++;
+  else // reached by cursorNext, which counted the blocks on the way
+    lastFileBlock[file] = cur->fileBlock;
+
+  if (cur->last == FAT_EOC) // file had no blocks yet
+    rootDir[file].firstIndex = newSpot;
+  else
+    fatSet(cur->last, newSpot); // this sets prev block to point to next block
+
+  fatSet(newSpot, FAT_EOC);
+  lastBlock[file] = newSpot;
+  cur->dataIndex = newSpot;
+  cur->last = newSpot;
+  return newSpot;
+}
+
+int findFreeRun(unsigned int count)
+{
+  EVENT_SCOPE(__func__);
+
+  unsigned int run = 0;
+  for (int i = 1; i < superBlock.totDataBlocks; i++) // finds the first run of count free blocks
+  {
+    if (fat.freeCount[i / FAT_PER_BLOCK] == 0) // a full fat block breaks any run
+    {
+      i = (i / FAT_PER_BLOCK + 1) * FAT_PER_BLOCK - 1;
+      run = 0;
+      continue;
+    }
+
+    if (fatGet(i) != 0)
+    {
+      run = 0;
+      continue;
+    }
+
+    run++;
+    if (run == count)
+      return i - count + 1;
+  }
+
+  if (reclaimCount > 0) // blocks of deleted files are freed before giving up
+  {
+    reclaimAll();
+    return findFreeRun(count);
+  }
+
+  return -1;
+}
+
+int releaseBlocksFrom(int file, unsigned int fileBlock)
+{
+  lastBlock[file] = FAT_EOC; // the tail moves back, the next append finds it again
+
+  if (rootDir[file].flags & FS_MODE_COMPRESS) // compressed files are released chunk by chunk
+  {
+    releaseChunksFrom(file, (fileBlock + CHUNK_BLOCKS - 1) / CHUNK_BLOCKS);
+    return 0;
+  }
+
+  if (rootDir[file].flags & FS_MODE_EXTENT)
+  {
+    extB_t *ext = loadExtents(file);
+    if (!ext)
+      return -1;
+
+    while (ext->count > 0) // trims extents from the end of the file
+    {
+      extent_t *e = &ext->extents[ext->count - 1];
+      if (e->fileBlock + e->length <= fileBlock)
+        break;
+
+      unsigned int keep = fileBlock > e->fileBlock ? fileBlock - e->fileBlock : 0;
+      for (int j = keep; j < e->length; j++)
+        releaseBlock(e->start + j);
+
+      e->length = keep;
+      if (keep > 0)
+        break;
+      ext->count--;
+    }
+    extentDirty[file] = 1;
+
+    if (ext->count == 0 && rootDir[file].firstIndex != FAT_EOC) // frees the extent block itself
+    {
+      fatSet(rootDir[file].firstIndex, 0);
+      rootDir[file].firstIndex = FAT_EOC;
+      free(extentCache[file]);
+      extentCache[file] = NULL;
+      extentDirty[file] = 0;
+    }
+
+    return 0;
+  }
+
+  unsigned int dataSpot;
+  if (fileBlock == 0) // whole chain goes away
+  {
+    dataSpot = rootDir[file].firstIndex;
+    rootDir[file].firstIndex = FAT_EOC;
+  }
+  else
+  {
+    cursor_t cur;
+    unsigned int last = cursorSeek(&cur, file, fileBlock - 1);
+    if (last == FAT_EOC) // file is already shorter than that
+      return 0;
+
+    dataSpot = fatGet(last);
+    fatSet(last, FAT_EOC); // new end of chain
+  }
+
+  while (dataSpot != FAT_EOC) // iterates through fat until it reaches FAT_EOC
+  {
+    unsigned int next = fatGet(dataSpot);
+    fatSet(dataSpot, 0);
+    dataSpot = next;
+  }
+
+  return 0;
+}
+
+void freeFileBlocks(int file)
+{
+  if (rootDir[file].flags & ROOT_TAIL) // gives the packed tail back
+    dropTail(file);
+
+  releaseBlocksFrom(file, 0);
+
+  free(extentCache[file]);
+  extentCache[file] = NULL;
+  extentDirty[file] = 0;
+  free(compCache[file]);
+  compCache[file] = NULL;
+}
+
+void *reclaimWorker(void *unused)
+{
+  pthread_mutex_lock(&fsLock);
+  while (!reclaimStopping) // chains left in the queue are freed by fs_umount's write-back
+  {
+    if (reclaimCount == 0)
+    {
+      pthread_cond_wait(&reclaimWork, &fsLock);
+      continue;
+    }
+
+    reclaimBatch(RECLAIM_BATCH);
+
+    pthread_mutex_unlock(&fsLock); // lets waiting callers in between batches
+    sched_yield();
+    pthread_mutex_lock(&fsLock);
+  }
+  pthread_mutex_unlock(&fsLock);
+
+  return NULL;
+}
+
+// wakes the reclaimer up to exit and joins it, called with fsLock held once
+void reclaimStop(void)
+{
+  if (!reclaimStarted)
+    return;
+
+  reclaimStopping = 1;
+  pthread_cond_broadcast(&reclaimWork);
+  pthread_mutex_unlock(&fsLock); // the reclaimer needs the lock to see the flag
+  pthread_join(reclaimThread, NULL);
+  pthread_mutex_lock(&fsLock);
+
+  reclaimStopping = 0;
+  reclaimStarted = 0;
+}
+
+void reclaimBlocks(int file)
+{
+  if (rootDir[file].flags & (FS_MODE_EXTENT | FS_MODE_COMPRESS) || rootDir[file].firstIndex == FAT_EOC) // only fat chains are queued
+  {
+    freeFileBlocks(file);
+    return;
+  }
+
+  if (!reclaimStarted) // starts the reclaimer on first use
+  {
+    if (pthread_create(&reclaimThread, NULL, reclaimWorker, NULL) != 0)
+    {
+      freeFileBlocks(file);
+      return;
+    }
+    reclaimStarted = 1;
+  }
+
+  if (reclaimCount == reclaimCap)
+  {
+    unsigned int cap = reclaimCap ? reclaimCap * 2 : 16;
+    unsigned int *queue = (unsigned int*) realloc(reclaimQueue, cap * sizeof(unsigned int));
+    if (!queue)
+    {
+      freeFileBlocks(file);
+      return;
+    }
+    reclaimQueue = queue;
+    reclaimCap = cap;
+  }
+
+  if (rootDir[file].flags & ROOT_TAIL) // gives the packed tail back
+    dropTail(file);
+
+  reclaimQueue[reclaimCount++] = rootDir[file].firstIndex; // the chain keeps its blocks until the reclaimer gets to it
+  rootDir[file].firstIndex = FAT_EOC;
+  lastBlock[file] = FAT_EOC;
+  pthread_cond_signal(&reclaimWork);
+}
+
+void reclaimBatch(unsigned int count)
+{
+  EVENT_SCOPE(__func__);
+
+  unsigned int start = superBlock.dataStartIndex;
+  unsigned int *spot = &reclaimQueue[reclaimCount - 1];
+  unsigned int run = *spot, runLength = 0;
+
+  for (unsigned int i = 0; i < count && *spot != FAT_EOC; i++) // frees the newest chain from where it was left
+  {
+    unsigned int next = fatGet(*spot);
+    fatSet(*spot, 0);
+
+    if (run + runLength != *spot) // punches each run of consecutive blocks at once
+    {
+      if (runLength > 0 && (mountFlags & FS_MOUNT_PUNCH))
+        block_punch(start + run, runLength);
+      run = *spot;
+      runLength = 0;
+    }
+    runLength++;
+    *spot = next;
+  }
+
+  if (runLength > 0 && (mountFlags & FS_MOUNT_PUNCH))
+    block_punch(start + run, runLength);
+
+  if (*spot == FAT_EOC)
+    reclaimCount--;
+}
+
+void reclaimAll(void)
+{
+  while (reclaimCount > 0)
+    reclaimBatch(RECLAIM_BATCH);
+}
+
+void dropTail(int file)
+{
+  for (int t = 0; t < tailCount; t++)
+  {
+    if (tailBlocks[t].index != rootExt[file].tailBlock)
+      continue;
+
+    tailBlocks[t].live--;
+    if (tailBlocks[t].live == 0) // last tail of the shared block, free it
+    {
+      fatSet(tailBlocks[t].index, 0);
+      tailBlocks[t] = tailBlocks[tailCount - 1];
+      tailCount--;
+    }
+    break;
+  }
+
+  rootExt[file].tailBlock = FAT_EOC;
+  rootExt[file].tailOffset = 0;
+  rootDir[file].flags &= ~ROOT_TAIL;
+}
+
+int openCount(int file)
+{
+  return openFiles[file];
+}
+
+fdt_t *fdSlot(unsigned int index)
+{
+  return &fdt[index / FD_CHUNK][index % FD_CHUNK];
+}
+
+void fdtReset(void)
+{
+  fdtFree = FD_NONE;
+  for(int i = fdtSize - 1; i >= 0; i--) // initializes fd table, lowest slots handed out first
+  {
+    fdt_t *entry = fdSlot(i);
+    if (entry->indexInRoot != -1) // fds still open go stale
+      entry->generation = (entry->generation + 1) & FD_GEN_MASK;
+    entry->indexInRoot = -1;
+    entry->offset = 0;
+    entry->pending = 0;
+    entry->nextFree = fdtFree;
+    fdtFree = i;
+  }
+  openNow = 0;
+}
+
+fdt_t *fdEntry(int fd)
+{
+  if (fd < 0)
+    return NULL;
+
+  unsigned int index = fd & (FD_SLOTS - 1);
+  if (index >= fdtSize) // slot was never allocated
+    return NULL;
+
+  fdt_t *entry = fdSlot(index);
+  if (entry->indexInRoot == -1 || entry->generation != (fd >> FD_INDEX_BITS)) // closed, or reopened since
+    return NULL;
+
+  return entry;
+}
+
+int fs_set_open_max(unsigned int max)
+{
+  FS_LOCKED;
+
+  if (max == 0 || max > FD_SLOTS || max < openNow) // cannot go below what is open now
+    return -1;
+
+  openMax = max;
+  return 0;
+}
+
+int nodeGrow(void)
+{
+  unsigned int count = nodeCount ? nodeCount * 2 : FS_FILE_MAX_COUNT;
+
+  root_t *dir = (root_t*) realloc(rootDir, count * sizeof(Root));
+  if (dir)
+    rootDir = dir;
+  node_t *node = (node_t*) realloc(nodes, count * sizeof(Node));
+  if (node)
+    nodes = node;
+  int *open = (int*) realloc(openFiles, count * sizeof(int));
+  if (open)
+    openFiles = open;
+  extB_t **ext = (extB_t**) realloc(extentCache, count * sizeof(extB_t*));
+  if (ext)
+    extentCache = ext;
+  int *dirty = (int*) realloc(extentDirty, count * sizeof(int));
+  if (dirty)
+    extentDirty = dirty;
+  compF_t **comp = (compF_t**) realloc(compCache, count * sizeof(compF_t*));
+  if (comp)
+    compCache = comp;
+  unsigned int *last = (unsigned int*) realloc(lastBlock, count * sizeof(unsigned int));
+  if (last)
+    lastBlock = last;
+  unsigned int *lastPos = (unsigned int*) realloc(lastFileBlock, count * sizeof(unsigned int));
+  if (lastPos)
+    lastFileBlock = lastPos;
+
+  if (!dir || !node || !open || !ext || !dirty || !comp || !last || !lastPos) // arrays that did grow keep their old size in use
+    return -1;
+
+  if (nodeCount == 0) // first grow of this mount
+  {
+    for (int i = 0; i < NODE_BUCKETS; i++)
+      nodeHeads[i] = NODE_NONE;
+    nodeFree = NODE_NONE;
+  }
+
+  for (int i = count - 1; i >= (int)nodeCount; i--) // clears the new entries, subdirectory ones go on the free list
+  {
+    memset(&rootDir[i], 0, sizeof(Root));
+    rootDir[i].firstIndex = FAT_EOC;
+    nodes[i].parent = NODE_NONE;
+    nodes[i].refs = 0;
+    nodes[i].depth = 0;
+    nodes[i].next = NODE_NONE;
+    nodes[i].removed = 0;
+    openFiles[i] = 0;
+    extentCache[i] = NULL;
+    extentDirty[i] = 0;
+    compCache[i] = NULL;
+    lastBlock[i] = FAT_EOC;
+
+    if (i >= FS_FILE_MAX_COUNT)
+    {
+      nodes[i].next = nodeFree;
+      nodeFree = i;
+    }
+  }
+
+  nodeCount = count;
+  return 0;
+}
+
+int nodeFind(int dir, const char *name)
+{
+  int node = nodeHeads[(nameHash(name) ^ dir) & (NODE_BUCKETS - 1)];
+  while (node != NODE_NONE && (nodes[node].parent != dir || strcmp(rootDir[node].name, name) != 0))
+    node = nodes[node].next;
+
+  return node;
+}
+
+int nodeGet(int dir, const char *name)
+{
+  if (dir == NODE_NONE) // root directory entries are always in memory
+    return findFileInRootDirec(name);
+
+  int node = nodeFind(dir, name);
+  if (node != -1) // already loaded
+  {
+    nodes[node].refs++;
+    return node;
+  }
+
+  if (nodeFree == NODE_NONE && nodeGrow() == -1)
+    return -1;
+
+  dirB_t *bucket = (dirB_t*) block_buffer_get();
+  unsigned int fileBlock;
+  int slot = dirLookup(dir, name, bucket, &fileBlock);
+  if (slot == -1) // no such entry
+  {
+    block_buffer_put(bucket);
+    return -1;
+  }
+
+  node = nodeFree;
+  nodeFree = nodes[node].next;
+  rootDir[node] = bucket->entries[slot];
+  block_buffer_put(bucket);
+
+  unsigned int hash = (nameHash(name) ^ dir) & (NODE_BUCKETS - 1);
+  nodes[node].parent = dir;
+  nodes[node].refs = 1;
+  nodes[node].depth = nodes[dir].depth + 1;
+  nodes[node].next = nodeHeads[hash];
+  nodes[node].removed = 0;
+  nodeHeads[hash] = node;
+
+  if (dir >= FS_FILE_MAX_COUNT) // the entry holds its directory until it is released
+    nodes[dir].refs++;
+
+  return node;
+}
+
+void nodePut(int node)
+{
+  if (node < FS_FILE_MAX_COUNT) // root directory entries are never released
+    return;
+
+  nodes[node].refs--;
+  if (nodes[node].refs > 0)
+    return;
+
+  int parent = nodes[node].parent;
+  if (!nodes[node].removed && nodeSync(node) == -1) // deleted entries have nothing to write back
+    fprintf(stderr, "fs: cannot write back entry '%s'\n", rootDir[node].name);
+
+  int *link = &nodeHeads[(nameHash(rootDir[node].name) ^ parent) & (NODE_BUCKETS - 1)];
+  while (*link != NODE_NONE && *link != node) // unlinks it from its hash bucket
+    link = &nodes[*link].next;
+  if (*link == node)
+    *link = nodes[node].next;
+
+  free(extentCache[node]);
+  extentCache[node] = NULL;
+  extentDirty[node] = 0;
+  free(compCache[node]);
+  compCache[node] = NULL;
+  lastBlock[node] = FAT_EOC;
+  memset(&rootDir[node], 0, sizeof(Root));
+  rootDir[node].firstIndex = FAT_EOC;
+  nodes[node].parent = NODE_NONE;
+  nodes[node].next = nodeFree;
+  nodeFree = node;
+
+  nodePut(parent);
+}
+
+int nodeSync(int node)
+{
+  if (compCache[node] && syncComp(node) == -1)
+    return -1;
+
+  if (extentCache[node] && extentDirty[node] && rootDir[node].firstIndex != FAT_EOC)
+  {
+    if (block_write(superBlock.dataStartIndex + rootDir[node].firstIndex, extentCache[node]) == -1)
+      return -1;
+    extentDirty[node] = 0;
+  }
+
+  if (node >= FS_FILE_MAX_COUNT) // root directory entries go out with the root directory block
+    return dirUpdate(nodes[node].parent, &rootDir[node]);
+
+  return 0;
+}
+
+int nodeFlush(void)
+{
+  unsigned int deepest = 0;
+  for (int i = FS_FILE_MAX_COUNT; i < nodeCount; i++)
+  {
+    if (nodes[i].refs > 0 && nodes[i].depth > deepest)
+      deepest = nodes[i].depth;
+  }
+
+  for (unsigned int depth = deepest; depth > 0; depth--) // children before the directories holding them
+  {
+    for (int i = FS_FILE_MAX_COUNT; i < nodeCount; i++)
+    {
+      if (nodes[i].refs > 0 && nodes[i].depth == depth && !nodes[i].removed && nodeSync(i) == -1)
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+int pathParent(const char *path, int *dir, char *name)
+{
+  *dir = NODE_NONE;
+  if (path == NULL)
+    return -1;
+
+  if (*path == '/') // paths are always from the root directory
+    path++;
+
+  while (1)
+  {
+    const char *slash = strchr(path, '/');
+    size_t len = slash ? (size_t)(slash - path) : strlen(path);
+    if (len == 0 || len >= FS_FILENAME_LEN) // each name must fit with its '\0'
+    {
+      nodePut(*dir);
+      return -1;
+    }
+
+    memcpy(name, path, len);
+    name[len] = '\0';
+    if (!slash) // last name is left to the caller
+      return 0;
+
+    int next = nodeGet(*dir, name);
+    nodePut(*dir);
+    if (next == -1 || !(rootDir[next].flags & ROOT_DIR))
+    {
+      nodePut(next);
+      return -1;
+    }
+
+    *dir = next;
+    path = slash + 1;
+  }
+}
+
+uint32_t nameHash(const char *name)
+{
+  return crc32c(0, name, strlen(name));
+}
+
+int dirLookup(int dir, const char *name, dirB_t *bucket, unsigned int *fileBlock)
+{
+  if (rootDir[dir].size == 0) // nothing was ever inserted
+    return -1;
+
+  dirH_t *head = (dirH_t*) block_buffer_get();
+  int found = -1;
+
+  if (readAt(dir, 0, head, BLOCK_SIZE) == BLOCK_SIZE)
+  {
+    *fileBlock = head->table[nameHash(name) & ((1u << head->depth) - 1)];
+    if (readAt(dir, (size_t)*fileBlock * BLOCK_SIZE, bucket, BLOCK_SIZE) == BLOCK_SIZE)
+    {
+      for (int i = 0; i < bucket->count && found == -1; i++)
+      {
+        if (strcmp(bucket->entries[i].name, name) == 0)
+          found = i;
+      }
+    }
+  }
+
+  block_buffer_put(head);
+  return found;
+}
+
+int dirInsert(int dir, const root_t *entry)
+{
+  dirH_t *head = (dirH_t*) block_buffer_get();
+  dirB_t *bucket = (dirB_t*) block_buffer_get();
+  dirB_t *sibling = (dirB_t*) block_buffer_get();
+  uint32_t hash = nameHash(entry->name);
+  unsigned int fileBlock;
+  int result = -1;
+
+  if (rootDir[dir].size == 0) // first entry, lays out the header and a single bucket for every hash
+  {
+    memset(head, 0, BLOCK_SIZE);
+    memset(bucket, 0, BLOCK_SIZE);
+    head->table[0] = 1;
+    if (writeAt(dir, 0, head, BLOCK_SIZE) != BLOCK_SIZE || writeAt(dir, BLOCK_SIZE, bucket, BLOCK_SIZE) != BLOCK_SIZE)
+    {
+      releaseBlocksFrom(dir, 0);
+      rootDir[dir].size = 0;
+      goto out;
+    }
+  }
+  else if (readAt(dir, 0, head, BLOCK_SIZE) != BLOCK_SIZE)
+    goto out;
+
+  while (1)
+  {
+    fileBlock = head->table[hash & ((1u << head->depth) - 1)];
+    if (readAt(dir, (size_t)fileBlock * BLOCK_SIZE, bucket, BLOCK_SIZE) != BLOCK_SIZE)
+      goto out;
+
+    if (bucket->count < DIR_ENTRIES)
+      break;
+
+    if (bucket->depth == head->depth) // only one table slot leads to the bucket, doubles the table
+    {
+      if (head->depth == DIR_DEPTH_MAX)
+        goto out;
+      memcpy(head->table + (1u << head->depth), head->table, sizeof(uint16_t) << head->depth);
+      head->depth++;
+    }
+
+    unsigned int bit = 1u << bucket->depth; // splits the full bucket on its next hash bit
+    unsigned int newBlock = rootDir[dir].size / BLOCK_SIZE;
+    int kept = 0;
+
+    memset(sibling, 0, BLOCK_SIZE);
+    bucket->depth++;
+    sibling->depth = bucket->depth;
+    for (int i = 0; i < bucket->count; i++)
+    {
+      if (nameHash(bucket->entries[i].name) & bit)
+        sibling->entries[sibling->count++] = bucket->entries[i];
+      else
+        bucket->entries[kept++] = bucket->entries[i];
+    }
+    memset(&bucket->entries[kept], 0, (bucket->count - kept) * sizeof(Root));
+    bucket->count = kept;
+
+    if (writeAt(dir, (size_t)newBlock * BLOCK_SIZE, sibling, BLOCK_SIZE) != BLOCK_SIZE)
+    {
+      releaseBlocksFrom(dir, newBlock);
+      rootDir[dir].size = newBlock * BLOCK_SIZE;
+      goto out;
+    }
+
+    for (unsigned int i = 0; i < (1u << head->depth); i++) // slots with the bit set now lead to the new bucket
+    {
+      if (head->table[i] == fileBlock && (i & bit))
+        head->table[i] = newBlock;
+    }
+
+    if (writeAt(dir, (size_t)fileBlock * BLOCK_SIZE, bucket, BLOCK_SIZE) != BLOCK_SIZE)
+      goto out;
+  }
+
+  bucket->entries[bucket->count++] = *entry;
+  head->entries++;
+  if (writeAt(dir, (size_t)fileBlock * BLOCK_SIZE, bucket, BLOCK_SIZE) == BLOCK_SIZE &&
+      writeAt(dir, 0, head, BLOCK_SIZE) == BLOCK_SIZE)
+    result = 0;
+
+out:
+  block_buffer_put(sibling);
+  block_buffer_put(bucket);
+  block_buffer_put(head);
+  return result;
+}
+
+int dirRemove(int dir, const char *name)
+{
+  dirH_t *head = (dirH_t*) block_buffer_get();
+  dirB_t *bucket = (dirB_t*) block_buffer_get();
+  unsigned int fileBlock;
+  int result = -1;
+
+  int slot = dirLookup(dir, name, bucket, &fileBlock);
+  if (slot != -1 && readAt(dir, 0, head, BLOCK_SIZE) == BLOCK_SIZE)
+  {
+    bucket->count--;
+    bucket->entries[slot] = bucket->entries[bucket->count]; // last entry fills the hole
+    memset(&bucket->entries[bucket->count], 0, sizeof(Root));
+    head->entries--;
+
+    if (writeAt(dir, (size_t)fileBlock * BLOCK_SIZE, bucket, BLOCK_SIZE) == BLOCK_SIZE &&
+        writeAt(dir, 0, head, BLOCK_SIZE) == BLOCK_SIZE)
+      result = 0;
+  }
+
+  block_buffer_put(bucket);
+  block_buffer_put(head);
+  return result;
+}
+
+int dirUpdate(int dir, const root_t *entry)
+{
+  dirB_t *bucket = (dirB_t*) block_buffer_get();
+  unsigned int fileBlock;
+  int result = -1;
+
+  int slot = dirLookup(dir, entry->name, bucket, &fileBlock);
+  if (slot != -1 && memcmp(&bucket->entries[slot], entry, sizeof(Root)) == 0) // nothing changed
+    result = 0;
+  else if (slot != -1)
+  {
+    bucket->entries[slot] = *entry;
+    if (writeAt(dir, (size_t)fileBlock * BLOCK_SIZE, bucket, BLOCK_SIZE) == BLOCK_SIZE)
+      result = 0;
+  }
+
+  block_buffer_put(bucket);
+  return result;
+}
+
+int dirEntries(int dir)
+{
+  if (rootDir[dir].size == 0) // nothing was ever inserted
+    return 0;
+
+  dirH_t *head = (dirH_t*) block_buffer_get();
+  int entries = -1;
+  if (readAt(dir, 0, head, BLOCK_SIZE) == BLOCK_SIZE)
+    entries = head->entries;
+
+  block_buffer_put(head);
+  return entries;
+}
+
+int unpackFile(int file)
+{
+  char data[TAIL_MAX];
+  uint32_t size = rootDir[file].size;
+
+  if (rootDir[file].flags & ROOT_INLINE) // moves inline data into a real block
+  {
+    memcpy(data, rootExt[file].data, size);
+    rootDir[file].flags &= ~ROOT_INLINE;
+    rootDir[file].size = 0;
+
+    if (size > 0 && writeAt(file, 0, data, size) != size) // no space left, stays inline
+    {
+      releaseBlocksFrom(file, 0);
+      rootDir[file].flags |= ROOT_INLINE;
+      rootDir[file].size = size;
+      return -1;
+    }
+
+    return 0;
+  }
+
+  if (rootDir[file].flags & ROOT_TAIL) // moves the packed tail back into its own block
+  {
+    char *block = (char*) block_buffer_get();
+    uint32_t tail = size % BLOCK_SIZE;
+
+    if (block_read(superBlock.dataStartIndex + rootExt[file].tailBlock, block) == -1)
+    {
+      block_buffer_put(block);
+      return -1;
+    }
+    memcpy(data, block + rootExt[file].tailOffset, tail);
+    block_buffer_put(block);
+
+    rootDir[file].flags &= ~ROOT_TAIL;
+    rootDir[file].size = size - tail;
+
+    if (writeAt(file, size - tail, data, tail) != tail) // no space left, tail stays packed
+    {
+      releaseBlocksFrom(file, (size - tail) / BLOCK_SIZE);
+      rootDir[file].flags |= ROOT_TAIL;
+      rootDir[file].size = size;
+      return -1;
+    }
+
+    rootDir[file].flags |= ROOT_TAIL; // so dropTail() can clear it
+    dropTail(file);
+  }
+
+  return 0;
+}
+
+void packFile(int file)
+{
+  uint32_t size = rootDir[file].size;
+  if (rootDir[file].flags & (ROOT_INLINE | ROOT_TAIL)) // already packed
+    return;
+
+  if (file >= FS_FILE_MAX_COUNT) // only root directory entries have a root extension entry
+    return;
+
+  if (blockCount(file) > (size + BLOCK_SIZE - 1) / BLOCK_SIZE) // keeps blocks preallocated with fs_fallocate()
+    return;
+
+  if (size <= INLINE_MAX) // small file goes inline
+  {
+    if (readAt(file, 0, rootExt[file].data, size) != size)
+      return;
+
+    releaseBlocksFrom(file, 0);
+    rootDir[file].flags |= ROOT_INLINE;
+    return;
+  }
+
+  uint32_t tail = size % BLOCK_SIZE;
+  if (tail == 0 || tail > TAIL_MAX) // nothing worth packing
+    return;
+
+  if (rootDir[file].flags & FS_MODE_COMPRESS) // compressed chunks have no block sized tail
+    return;
+
+  int t;
+  for (t = 0; t < tailCount; t++) // finds a shared tail block with enough room
+  {
+    if (tailBlocks[t].used + tail <= BLOCK_SIZE)
+      break;
+  }
+
+  char *block = (char*) block_buffer_get();
+  char *data = (char*) block_buffer_get();
+
+  if (readAt(file, size - tail, data, tail) != tail)
+    goto out;
+
+  if (t == tailCount) // starts a new shared tail block
+  {
+    int spot = nextOpen();
+    if (spot == -1)
+      goto out;
+
+    fatSet(spot, FAT_EOC);
+    tailBlocks = (tailB_t*) realloc(tailBlocks, sizeof(TailBlock) * (tailCount + 1));
+    tailBlocks[t].index = spot;
+    tailBlocks[t].used = 0;
+    tailBlocks[t].live = 0;
+    tailCount++;
+    memset(block, 0, BLOCK_SIZE);
+  }
+  else if (block_read(superBlock.dataStartIndex + tailBlocks[t].index, block) == -1)
+    goto out;
+
+  memcpy(block + tailBlocks[t].used, data, tail);
+  if (block_write(superBlock.dataStartIndex + tailBlocks[t].index, block) == -1)
+    goto out;
+
+  rootExt[file].tailBlock = tailBlocks[t].index;
+  rootExt[file].tailOffset = tailBlocks[t].used;
+  tailBlocks[t].used += tail;
+  tailBlocks[t].live++;
+
+  releaseBlocksFrom(file, size / BLOCK_SIZE); // last block is not needed anymore
+  rootDir[file].flags |= ROOT_TAIL;
+
+out:
+  block_buffer_put(data);
+  block_buffer_put(block);
+}
+
+unsigned int blockCount(int file)
+{
+  if (rootDir[file].flags & FS_MODE_COMPRESS)
+  {
+    compF_t *comp = loadComp(file);
+    unsigned int count = 0;
+    for (int i = 0; comp && i < comp->index->count; i++)
+      count = count + comp->index->chunks[i].blocks;
+    return count;
+  }
+
+  if (rootDir[file].flags & FS_MODE_EXTENT)
+  {
+    extB_t *ext = loadExtents(file);
+    if (!ext || ext->count == 0)
+      return 0;
+    return ext->extents[ext->count - 1].fileBlock + ext->extents[ext->count - 1].length;
+  }
+
+  unsigned int count = 0;
+  for (unsigned int index = rootDir[file].firstIndex; index != FAT_EOC; index = fatGet(index))
+    count++;
+
+  return count;
+}
+
+int fs_feature_enable(int features)
+{
+  FS_LOCKED;
+
+  if (!fat.pages) // checks if disk is mounted
+    return -1;
+
+  if (features & ~(FS_FEATURE_INLINE | FS_FEATURE_CSUM | FS_FEATURE_DEDUP)) // checks for unknown features
+    return -1;
+
+  if ((features & FS_FEATURE_DEDUP) && !(superBlock.features & FS_FEATURE_DEDUP))
+  {
+    unsigned int blocks = (superBlock.totDataBlocks * sizeof(DedupEntry) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int run = findFreeRun(blocks); // reserves the dedup region
+    if (run == -1)
+      return -1;
+
+    dedupTable = (dedupE_t*) calloc(blocks, BLOCK_SIZE);
+    if (!dedupTable || dedupInit() == -1)
+      return -1;
+
+    for (int i = 0; i < blocks; i++) // chains the region so it shows as used in the fat
+      fatSet(run + i, (i == blocks - 1) ? FAT_EOC : run + i + 1);
+
+    superBlock.dedupIndex = run;
+    superBlock.dedupBlocks = blocks;
+    superBlock.features |= FS_FEATURE_DEDUP;
+  }
+
+  if ((features & FS_FEATURE_INLINE) && !(superBlock.features & FS_FEATURE_INLINE))
+  {
+    int run = findFreeRun(EXT_BLOCKS); // reserves the root extension region
+    if (run == -1)
+      return -1;
+
+    for (int i = 0; i < EXT_BLOCKS; i++) // chains the region so it shows as used in the fat
+      fatSet(run + i, (i == EXT_BLOCKS - 1) ? FAT_EOC : run + i + 1);
+
+    memset(rootExt, 0, sizeof(rootExt));
+    for (int i = 0; i < FS_FILE_MAX_COUNT; i++)
+      rootExt[i].tailBlock = FAT_EOC;
+
+    superBlock.extIndex = run;
+    superBlock.features |= FS_FEATURE_INLINE;
+  }
+
+  if ((features & FS_FEATURE_CSUM) && !(superBlock.features & FS_FEATURE_CSUM))
+  {
+    unsigned int blocks = (superBlock.totBlocks * sizeof(uint32_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int run = findFreeRun(blocks); // reserves the checksum region
+    if (run == -1)
+      return -1;
+
+    uint32_t *table = (uint32_t*) calloc(blocks, BLOCK_SIZE);
+    if (!table)
+      return -1;
+
+    char *block = (char*) block_buffer_get();
+    for (int i = 0; i < superBlock.totBlocks; i++) // checksums what is on disk now, later writes keep it up to date
+    {
+      if (block_read(i, block) == -1)
+      {
+        block_buffer_put(block);
+        free(table);
+        return -1;
+      }
+      table[i] = crc32c(0, block, BLOCK_SIZE);
+    }
+    block_buffer_put(block);
+
+    for (int i = 0; i < blocks; i++) // chains the region so it shows as used in the fat
+      fatSet(run + i, (i == blocks - 1) ? FAT_EOC : run + i + 1);
+
+    csumTable = table;
+    block_csum_attach(csumTable);
+    superBlock.csumIndex = run;
+    superBlock.csumBlocks = blocks;
+    superBlock.features |= FS_FEATURE_CSUM;
+  }
+
+  return 0;
+}
+
+int scrubbed(unsigned int index)
+{
+  if (index >= superBlock.csumIndex && index < superBlock.csumIndex + superBlock.csumBlocks) // checksum region has no checksums of its own
+    return 0;
+
+  return fatGet(index) != 0;
+}
+
+int fs_scrub(void)
+{
+  FS_LOCKED;
+
+  if (!fat.pages) // checks if disk is mounted
+    return -1;
+
+  if (!(superBlock.features & FS_FEATURE_CSUM)) // nothing to check against
+    return -1;
+
+  int bad = block_csum_verify(0, superBlock.dataStartIndex); // super block, fat and root directory
+  if (bad == -1)
+    return -1;
+
+  unsigned int i = 1;
+  while (i < superBlock.totDataBlocks) // checks every run of used data blocks in one go
+  {
+    if (!scrubbed(i))
+    {
+      i++;
+      continue;
+    }
+
+    unsigned int run = i;
+    while (i < superBlock.totDataBlocks && scrubbed(i))
+      i++;
+
+    int found = block_csum_verify(superBlock.dataStartIndex + run, i - run);
+    if (found == -1)
+      return -1;
+    bad = bad + found;
+  }
+
+  return bad;
+}
+
+size_t vecPeek(vecCur_t *vec, char **ptr)
+{
+  while (vec->left > 0 && vec->used == vec->iov->iov_len) // skips exhausted and empty segments
+  {
+    vec->iov++;
+    vec->left--;
+    vec->used = 0;
+  }
+
+  if (vec->left == 0)
+    return 0;
+
+  *ptr = (char*)vec->iov->iov_base + vec->used;
+  return vec->iov->iov_len - vec->used;
+}
+
+void vecAdvance(vecCur_t *vec, size_t len)
+{
+  vec->used = vec->used + len;
+}
+
+void vecCopy(vecCur_t *vec, char *mem, size_t len, int fill)
+{
+  while (len > 0) // one segment at a time
+  {
+    char *ptr;
+    size_t chunk = vecPeek(vec, &ptr);
+    if (chunk == 0)
+      return;
+    if (chunk > len)
+      chunk = len;
+
+    if (fill) // from mem into the segments
+      memcpy(ptr, mem, chunk);
+    else
+      memcpy(mem, ptr, chunk);
+
+    vecAdvance(vec, chunk);
+    mem = mem + chunk;
+    len = len - chunk;
+  }
+}
+
+ssize_t vecLength(const struct iovec *iov, int iovcnt)
+{
+  size_t total = 0;
+  if (iovcnt < 0 || (iovcnt > 0 && iov == NULL))
+    return -1;
+
+  for (int i = 0; i < iovcnt; i++)
+  {
+    if (iov[i].iov_len > INT_MAX - total) // the byte count must fit the return value
+      return -1;
+    if (iov[i].iov_len > 0 && iov[i].iov_base == NULL)
+      return -1;
+    total = total + iov[i].iov_len;
+  }
+
+  return total;
+}
+
+pthread_mutex_t readLock = PTHREAD_MUTEX_INITIALIZER; // guards the read job below
+pthread_cond_t readWork = PTHREAD_COND_INITIALIZER; // runs are waiting for a reader
+pthread_cond_t readDone = PTHREAD_COND_INITIALIZER; // every run of the job was read
+readRun_t *readJob; // runs of the large read in progress, NULL if none
+unsigned int readNext; // first run no thread took yet
+unsigned int readCount; // runs in the job
+unsigned int readPending; // runs not read yet
+int readStarted; // reader threads are running
+int readStopping; // readers are asked to exit, see readStop()
+pthread_t readThreads[READ_WORKERS]; // reader threads, joined by fs_umount
+int readThreadCount; // readers that started
+
+// reads the next run of the job, called and returning with readLock held
+void readTake(void)
+{
+  readRun_t *run = &readJob[readNext++];
+  pthread_mutex_unlock(&readLock);
+
+  run->result = block_read_run(run->block, run->count, run->buf); // positional reads, the runs never overlap
+
+  pthread_mutex_lock(&readLock);
+  readPending--;
+  if (readPending == 0)
+    pthread_cond_signal(&readDone);
+}
+
+void *readWorker(void *unused)
+{
+  pthread_mutex_lock(&readLock);
+  while (!readStopping)
+  {
+    if (!readJob || readNext == readCount)
+      pthread_cond_wait(&readWork, &readLock);
+    else
+      readTake();
+  }
+  pthread_mutex_unlock(&readLock);
+
+  return NULL;
+}
+
+// wakes the readers up to exit and joins them, no read job is in progress as jobs run with fsLock held
+void readStop(void)
+{
+  pthread_mutex_lock(&readLock);
+  if (!readStarted)
+  {
+    pthread_mutex_unlock(&readLock);
+    return;
+  }
+
+  readStopping = 1;
+  pthread_cond_broadcast(&readWork);
+  pthread_mutex_unlock(&readLock); // the readers need the lock to see the flag
+  for (int i = 0; i < readThreadCount; i++)
+    pthread_join(readThreads[i], NULL);
+
+  pthread_mutex_lock(&readLock);
+  readStopping = 0;
+  readStarted = 0;
+  readThreadCount = 0;
+  pthread_mutex_unlock(&readLock);
+}
+
+// reads every run, on the calling thread and the readers, and waits for all of them
+void readRuns(readRun_t *runs, unsigned int count)
+{
+  pthread_mutex_lock(&readLock);
+  if (!readStarted) // starts the readers on first use, the caller reads alone if none starts
+  {
+    for (int i = 0; i < READ_WORKERS; i++)
+    {
+      if (pthread_create(&readThreads[readThreadCount], NULL, readWorker, NULL) != 0)
+        break;
+      readThreadCount++;
+    }
+    readStarted = 1;
+  }
+
+  readJob = runs;
+  readNext = 0;
+  readCount = count;
+  readPending = count;
+  pthread_cond_broadcast(&readWork);
+
+  while (readNext < readCount) // the caller takes runs too
+    readTake();
+  while (readPending > 0)
+    pthread_cond_wait(&readDone, &readLock);
+
+  readJob = NULL;
+  pthread_mutex_unlock(&readLock);
+}
+
+// reads the whole blocks of a large read as runs of consecutive blocks spread over the readers, -1 if it could not start
+int readLarge(int file, size_t offset, char *buf, size_t count)
+{
+  size_t head = (BLOCK_SIZE - offset % BLOCK_SIZE) % BLOCK_SIZE; // up to the first block boundary
+  size_t blocks = (count - head) / BLOCK_SIZE;
+  unsigned int runMax = READ_RUN_MAX / BLOCK_SIZE > 0 ? READ_RUN_MAX / BLOCK_SIZE : 1;
+
+  readRun_t *runs = (readRun_t*) malloc(blocks * sizeof(ReadRun));
+  if (!runs)
+    return -1;
+
+  // the whole range is translated to runs before any block is read
+  unsigned int runCount = 0;
+  char *ptr = buf + head;
+  cursor_t cur;
+  unsigned int index = cursorSeek(&cur, file, (offset + head) / BLOCK_SIZE);
+  for (size_t i = 0; i < blocks && index != FAT_EOC; i++)
+  {
+    readRun_t *last = runCount > 0 ? &runs[runCount - 1] : NULL;
+    unsigned int block = superBlock.dataStartIndex + index;
+    if (last && last->block + last->count == block && last->count < runMax)
+      last->count++;
+    else
+      runs[runCount++] = (ReadRun) { .block = block, .count = 1, .buf = ptr, .result = -1 };
+
+    ptr = ptr + BLOCK_SIZE;
+    if (i + 1 < blocks)
+      index = cursorNext(&cur);
+  }
+
+  size_t totalRead = 0;
+  if (head > 0)
+    totalRead = readAt(file, offset, buf, head);
+
+  if (totalRead == head)
+  {
+    readRuns(runs, runCount);
+    for (unsigned int i = 0; i < runCount && runs[i].result == 0; i++) // stops at the first run that failed, like a serial read
+      totalRead = totalRead + (size_t)runs[i].count * BLOCK_SIZE;
+  }
+  free(runs);
+
+  if (totalRead == head + blocks * BLOCK_SIZE && totalRead < count) // partial last block
+  {
+    int got = readAt(file, offset + totalRead, buf + totalRead, count - totalRead);
+    if (got > 0)
+      totalRead = totalRead + got;
+  }
+
+  return totalRead;
+}
+
+int readAt(int file, size_t offset, void *buf, size_t count)
+{
+  struct iovec iov = { .iov_base = buf, .iov_len = count };
+  return readvAt(file, offset, &iov, 1, count);
+}
+
+int readvAt(int file, size_t offset, const struct iovec *iov, int iovcnt, size_t count)
+{
+  vecCur_t vec = { .iov = iov, .left = iovcnt, .used = 0 };
+  size_t size = rootDir[file].size;
+  if (offset >= size) // nothing to read past the end of file
+    return 0;
+
+  if (count > size - offset) // only reads up to the end of file
+    count = size - offset;
+
+  if (rootDir[file].flags & ROOT_INLINE) // small file lives in its root extension entry
+  {
+    vecCopy(&vec, rootExt[file].data + offset, count, 1);
+    return count;
+  }
+
+  if (rootDir[file].flags & FS_MODE_COMPRESS) // decompresses straight into each segment
+  {
+    size_t totalRead = 0;
+    char *ptr;
+    size_t chunk;
+    while (totalRead < count && (chunk = vecPeek(&vec, &ptr)) > 0)
+    {
+      if (chunk > count - totalRead)
+        chunk = count - totalRead;
+
+      int got = compRead(file, offset + totalRead, ptr, chunk);
+      if (got <= 0)
+        break;
+      vecAdvance(&vec, got);
+      totalRead = totalRead + got;
+      if (got < chunk)
+        break;
+    }
+
+    return totalRead;
+  }
+
+  if (iovcnt == 1 && count >= READ_PARALLEL_MIN) // large reads are split into block runs read concurrently
+  {
+    int got = readLarge(file, offset, iov->iov_base, count);
+    if (got >= 0)
+      return got;
+  }
+
+  char *block = (char*) block_buffer_get();
+  unsigned int start = superBlock.dataStartIndex;
+  size_t totalRead = 0;
+  cursor_t cur;
+  unsigned int index = cursorSeek(&cur, file, offset / BLOCK_SIZE); // walks the fat or extents once for all segments
+
+  while (totalRead < count) // reads block by block
+  {
+    size_t inBlock = (offset + totalRead) % BLOCK_SIZE;
+    size_t chunk = BLOCK_SIZE - inBlock;
+    if (chunk > count - totalRead)
+      chunk = count - totalRead;
+
+    char *ptr = NULL;
+    if (index == FAT_EOC) // only the packed tail can be left past the last block
+    {
+      if (!(rootDir[file].flags & ROOT_TAIL) || cur.fileBlock != size / BLOCK_SIZE)
+        break;
+      if (block_read(start + rootExt[file].tailBlock, block) == -1)
+        break;
+      vecCopy(&vec, block + rootExt[file].tailOffset + inBlock, chunk, 1);
+    }
+    else if (chunk == BLOCK_SIZE && vecPeek(&vec, &ptr) >= BLOCK_SIZE) // whole block goes straight into the segment
+    {
+      if (block_read(start + index, ptr) == -1)
+        break;
+      vecAdvance(&vec, BLOCK_SIZE);
+    }
+    else
+    {
+      if (block_read(start + index, block) == -1)
+        break;
+      vecCopy(&vec, block + inBlock, chunk, 1);
+    }
+
+    totalRead = totalRead + chunk;
+    if (totalRead < count)
+      index = cursorNext(&cur);
+  }
+
+  block_buffer_put(block);
+  return totalRead;
+}
+
+int writeAt(int file, size_t offset, const void *buf, size_t count)
+{
+  struct iovec iov = { .iov_base = (void*)buf, .iov_len = count };
+  return writevAt(file, offset, &iov, 1, count);
+}
+
+int writevAt(int file, size_t offset, const struct iovec *iov, int iovcnt, size_t count)
+{
+  vecCur_t vec = { .iov = iov, .left = iovcnt, .used = 0 };
+  size_t size = rootDir[file].size;
+  if (offset > size) // writes cannot leave holes in the file
+    return -1;
+
+  if (count == 0)
+    return 0;
+
+  if (rootDir[file].flags & ROOT_INLINE)
+  {
+    if (offset + count <= INLINE_MAX) // still small enough to stay inline
+    {
+      vecCopy(&vec, rootExt[file].data + offset, count, 0);
+      if (offset + count > size)
+        rootDir[file].size = offset + count;
+      return count;
+    }
+
+    if (unpackFile(file) == -1)
+      return 0;
+  }
+  else if ((rootDir[file].flags & ROOT_TAIL) && unpackFile(file) == -1)
+    return 0;
+
+  if (rootDir[file].flags & FS_MODE_COMPRESS) // compresses each segment in turn
+  {
+    size_t totalWrite = 0;
+    char *ptr;
+    size_t chunk;
+    while (totalWrite < count && (chunk = vecPeek(&vec, &ptr)) > 0)
+    {
+      if (chunk > count - totalWrite)
+        chunk = count - totalWrite;
+
+      int put = compWrite(file, offset + totalWrite, ptr, chunk);
+      if (put <= 0)
+        break;
+      vecAdvance(&vec, put);
+      totalWrite = totalWrite + put;
+      if (put < chunk)
+        break;
+    }
+
+    return totalWrite;
+  }
+
+  char *block = (char*) block_buffer_get();
+  unsigned int start = superBlock.dataStartIndex;
+  size_t totalWrite = 0;
+  cursor_t cur;
+  unsigned int index = cursorSeek(&cur, file, offset / BLOCK_SIZE); // walks the fat or extents once for all segments
+  int fresh = 0;
+
+  if (index == FAT_EOC) // offset is at the end of the last block, so the file must grow
+  {
+    index = cursorAppend(&cur, FAT_EOC);
+    fresh = 1;
+  }
+
+  while (totalWrite < count && index != FAT_EOC) // writes block by block
+  {
+    size_t pos = offset + totalWrite;
+    size_t inBlock = pos % BLOCK_SIZE;
+    size_t chunk = BLOCK_SIZE - inBlock;
+    if (chunk > count - totalWrite)
+      chunk = count - totalWrite;
+
+    int dedup = (superBlock.features & FS_FEATURE_DEDUP) && (rootDir[file].flags & FS_MODE_EXTENT);
+
+    if (chunk == BLOCK_SIZE) // whole block comes from the segments
+    {
+      char *data = block;
+      int direct = vecPeek(&vec, &data) >= BLOCK_SIZE; // straight from the segment when it holds the whole block
+      if (!direct)
+      {
+        data = block;
+        vecCopy(&vec, block, BLOCK_SIZE, 0);
+      }
+
+      if (dedup)
+        index = dedupWrite(&cur, index, data, 1);
+
+      if (index == FAT_EOC || (index != DEDUP_SHARED && block_write(start + index, data) == -1))
+        break;
+      if (direct)
+        vecAdvance(&vec, BLOCK_SIZE);
+    }
+    else
+    {
+      if (fresh) // new block holds no data yet
+        memset(block, 0, BLOCK_SIZE);
+      else if (block_read(start + index, block) == -1)
+        break;
+
+      vecCopy(&vec, block + inBlock, chunk, 0);
+      if (dedup)
+        index = dedupWrite(&cur, index, block, 0);
+
+      if (index == FAT_EOC || block_write(start + index, block) == -1)
+        break;
+    }
+
+    totalWrite = totalWrite + chunk;
+    if (totalWrite < count)
+    {
+      index = cursorNext(&cur);
+      fresh = 0;
+      if (index == FAT_EOC) // if we are at the end of a file then we must allocate a new block
+      {
+        index = cursorAppend(&cur, FAT_EOC);
+        fresh = 1;
+      }
+    }
+  }
+
+  block_buffer_put(block);
+  if (offset + totalWrite > size) // file grew
+    rootDir[file].size = offset + totalWrite;
+
+  return totalWrite;
+}
+
+int fs_write(int fd, void *buf, size_t count)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return -1;
+
+  if (entry->append) // every write goes to the end of file, however the file grew meanwhile
+    entry->offset = rootDir[entry->indexInRoot].size;
+
+  int totalWrite = writeAt(entry->indexInRoot, entry->offset, buf, count);
+  if (totalWrite == -1) // offset is past the end of file
+    return -1;
+
+  entry->offset = entry->offset + totalWrite; // changes offset to new spot
+
+  return totalWrite;
+}
+
+int fs_read(int fd, void *buf, size_t count)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return -1;
+
+  if (entry->offset > fs_stat(fd)) // checks if offset is valid
+    return -1;
+
+  int totalRead = readAt(entry->indexInRoot, entry->offset, buf, count);
+
+  entry->offset = entry->offset + totalRead;
+  return totalRead;
+}
+
+int fs_pread(int fd, void *buf, size_t count, size_t offset)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return -1;
+
+  if (offset > rootDir[entry->indexInRoot].size) // checks if offset is valid
+    return -1;
+
+  return readAt(entry->indexInRoot, offset, buf, count);
+}
+
+int fs_pwrite(int fd, const void *buf, size_t count, size_t offset)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return -1;
+
+  return writeAt(entry->indexInRoot, offset, buf, count); // -1 past the end of file
+}
+
+int fs_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  ssize_t count = vecLength(iov, iovcnt);
+  if (!entry || count == -1)
+    return -1;
+
+  if (entry->offset > rootDir[entry->indexInRoot].size) // checks if offset is valid
+    return -1;
+
+  int totalRead = readvAt(entry->indexInRoot, entry->offset, iov, iovcnt, count);
+
+  entry->offset = entry->offset + totalRead;
+  return totalRead;
+}
+
+int fs_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  ssize_t count = vecLength(iov, iovcnt);
+  if (!entry || count == -1)
+    return -1;
+
+  if (entry->append) // every write goes to the end of file
+    entry->offset = rootDir[entry->indexInRoot].size;
+
+  int totalWrite = writevAt(entry->indexInRoot, entry->offset, iov, iovcnt, count);
+  if (totalWrite == -1) // offset is past the end of file
+    return -1;
+
+  entry->offset = entry->offset + totalWrite; // changes offset to new spot
+
+  return totalWrite;
+}
+
+int fs_fallocate(int fd, size_t size)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return -1;
+
+  return preallocate(entry->indexInRoot, size);
+}
+
+int preallocate(int file, size_t size)
+{
+  if (rootDir[file].flags & FS_MODE_COMPRESS) // compressed size is unknown until data is written
+    return 0;
+
+  if (rootDir[file].flags & ROOT_INLINE && size <= INLINE_MAX) // inline data needs no block
+    return 0;
+
+  if ((rootDir[file].flags & (ROOT_INLINE | ROOT_TAIL)) && unpackFile(file) == -1)
+    return -1;
+
+  unsigned int have = blockCount(file);
+  unsigned int need = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  if (need <= have) // already big enough
+    return 0;
+
+  unsigned int extra = need - have;
+  int newExtentBlock = (rootDir[file].flags & FS_MODE_EXTENT) && rootDir[file].firstIndex == FAT_EOC;
+  if (fatFreeBlocks() < extra + newExtentBlock && reclaimCount > 0) // blocks of deleted files are freed before giving up
+    reclaimAll();
+  if (fatFreeBlocks() < extra + newExtentBlock) // checks there is enough space
+    return -1;
+
+  if (newExtentBlock) // allocates the extent block first so it does not split the run
+  {
+    int spot = nextOpen();
+    fatSet(spot, FAT_EOC);
+    rootDir[file].firstIndex = spot;
+  }
+
+  cursor_t cur;
+  cursorSeek(&cur, file, have);
+
+  int run = -1;
+  unsigned int tail = cur.last == FAT_EOC ? FAT_EOC : cur.last + 1;
+  if (tail != FAT_EOC && tail + extra <= superBlock.totDataBlocks)
+  {
+    run = tail; // checks if the run can continue right after the last block
+    for (unsigned int i = 0; i < extra && run != -1; i++)
+    {
+      if (fatGet(tail + i) != 0)
+        run = -1;
+    }
+  }
+  if (run == -1)
+    run = findFreeRun(extra);
+
+  for (unsigned int i = 0; i < extra; i++) // links the run at the end of the file
+  {
+    if (cursorAppend(&cur, run == -1 ? FAT_EOC : run + i) == FAT_EOC)
+    {
+      releaseBlocksFrom(file, have);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int fs_truncate(int fd, size_t size)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return -1;
+
+  int file = entry->indexInRoot;
+  uint32_t oldSize = rootDir[file].size;
+  if (size > oldSize) // files can only shrink
+    return -1;
+
+  if (rootDir[file].flags & ROOT_TAIL)
+  {
+    uint32_t tailStart = oldSize - oldSize % BLOCK_SIZE;
+    if (size <= tailStart) // packed tail is cut off entirely
+      dropTail(file);
+  }
+
+  if (!(rootDir[file].flags & (ROOT_INLINE | ROOT_TAIL)))
+    releaseBlocksFrom(file, (size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+  rootDir[file].size = size;
+
+  for (int i = 0; openFiles[file] > 1 && i < fdtSize; i++) // keeps offsets of other fds on the file in bounds
+  {
+    fdt_t *other = fdSlot(i);
+    if (other->indexInRoot == file && other->offset > size)
+      other->offset = size;
+  }
+  if (entry->offset > size)
+    entry->offset = size;
+
+  return 0;
+}
+
+int transferRuns(int file, size_t offset, size_t count, int hostFd, int out)
+{
+  unsigned int start = superBlock.dataStartIndex;
+  size_t done = 0;
+  cursor_t cur;
+  unsigned int index = cursorSeek(&cur, file, offset / BLOCK_SIZE);
+
+  while (done < count && index != FAT_EOC) // moves one run of contiguous blocks at a time
+  {
+    unsigned int runStart = index;
+    size_t inBlock = (offset + done) % BLOCK_SIZE;
+    size_t len = BLOCK_SIZE - inBlock;
+    unsigned int next = cursorNext(&cur);
+
+    while (done + len < count && next == index + 1) // grows the run while blocks follow each other
+    {
+      index = next;
+      len = len + BLOCK_SIZE;
+      next = cursorNext(&cur);
+    }
+
+    if (len > count - done)
+      len = count - done;
+
+    int moved;
+    if (out)
+      moved = block_copy_out(start + runStart, inBlock, len, hostFd);
+    else
+      moved = block_copy_in(start + runStart, inBlock, len, hostFd);
+
+    if (moved == -1)
+      return done ? done : -1;
+
+    done = done + moved;
+    if (moved < len) // end of the host file
+      break;
+
+    index = next;
+  }
+
+  return done;
+}
+
+void *mapRuns(int file, size_t offset, size_t length)
+{
+  unsigned int start = superBlock.dataStartIndex;
+  unsigned int blocks = length / BLOCK_SIZE;
+  char *base = NULL;
+  unsigned int done = 0;
+  cursor_t cur;
+  unsigned int index = cursorSeek(&cur, file, offset / BLOCK_SIZE);
+
+  while (done < blocks && index != FAT_EOC) // maps one run of contiguous blocks at a time
+  {
+    unsigned int runStart = index;
+    unsigned int run = 1;
+    unsigned int next = cursorNext(&cur);
+
+    while (done + run < blocks && next == index + 1) // grows the run while blocks follow each other
+    {
+      index = next;
+      run++;
+      next = cursorNext(&cur);
+    }
+
+    if (!base && run == blocks) // one run, the image is mapped as is
+      return block_map(start + runStart, run, NULL);
+
+    if (!base) // several runs, reserves a range to assemble them in
+    {
+      base = (char*) mmap(NULL, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (base == MAP_FAILED)
+        return NULL;
+    }
+
+    if (!block_map(start + runStart, run, base + (size_t) done * BLOCK_SIZE))
+      break;
+
+    done = done + run;
+    index = next;
+  }
+
+  if (done < blocks) // chain ended early or a run could not be mapped
+  {
+    if (base)
+      munmap(base, length);
+    return NULL;
+  }
+
+  return base;
+}
+
+const void *fs_mmap(int fd, size_t offset, size_t len)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return NULL;
+
+  int file = entry->indexInRoot;
+  size_t size = rootDir[file].size;
+  if (len == 0 || offset >= size || len > size - offset) // range must lie within the file
+    return NULL;
+
+  if (mapCount == mapCap) // grows the mapping list
+  {
+    unsigned int cap = mapCap ? mapCap * 2 : 16;
+    mapping_t *grown = (mapping_t*) realloc(mappings, cap * sizeof(mapping_t));
+    if (!grown)
+      return NULL;
+    mappings = grown;
+    mapCap = cap;
+  }
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t blocks = size;
+  if (rootDir[file].flags & ROOT_TAIL) // packed tail is not part of the block runs
+    blocks = size - size % BLOCK_SIZE;
+
+  mapping_t map;
+  int direct = !(rootDir[file].flags & (ROOT_INLINE | FS_MODE_COMPRESS)) && BLOCK_SIZE % page == 0 && offset + len <= blocks;
+  if (direct) // data blocks hold the bytes as they are, maps them
+  {
+    size_t first = offset - offset % BLOCK_SIZE;
+    map.length = (offset + len - first + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    map.base = mapRuns(file, first, map.length);
+    map.addr = (const char*) map.base + (offset - first);
+  }
+
+  if (!direct || !map.base) // anything else is read into an anonymous mapping
+  {
+    if (len > INT_MAX)
+      return NULL;
+
+    map.length = (len + page - 1) / page * page;
+    map.base = mmap(NULL, map.length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map.base == MAP_FAILED)
+      return NULL;
+
+    if (readAt(file, offset, map.base, len) != (int) len || mprotect(map.base, map.length, PROT_READ))
+    {
+      munmap(map.base, map.length);
+      return NULL;
+    }
+    map.addr = (const char*) map.base;
+  }
+
+  mappings[mapCount++] = map;
+  return map.addr;
+}
+
+int fs_munmap(const void *addr)
+{
+  FS_LOCKED;
+
+  for (unsigned int i = 0; i < mapCount; i++)
+  {
+    if (mappings[i].addr != addr)
+      continue;
+
+    int ret = munmap(mappings[i].base, mappings[i].length);
+    mappings[i] = mappings[--mapCount]; // order of the list does not matter
+    return ret;
+  }
+
+  return -1; // not handed out by fs_mmap
+}
+
+int fs_export(int fd, int host_fd)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
+    return -1;
+
+  int file = entry->indexInRoot;
+  size_t offset = entry->offset;
+  size_t size = rootDir[file].size;
+  if (offset >= size) // nothing left to export
+    return 0;
+
+  size_t count = size - offset;
+  int done = 0;
+
+  if (rootDir[file].flags & ROOT_INLINE) // inline data is already in memory
+  {
+    done = write(host_fd, rootExt[file].data + offset, count);
+    if (done == -1)
+      return -1;
+  }
+  else if (rootDir[file].flags & FS_MODE_COMPRESS) // data must be decompressed, one block at a time
+  {
+    char *buf = (char*) block_buffer_get();
+    while (done < count)
+    {
+      int got = compRead(file, offset + done, buf, count - done < BLOCK_SIZE ? count - done : BLOCK_SIZE);
+      if (got <= 0 || write(host_fd, buf, got) != got)
+        break;
+      done = done + got;
+    }
+    block_buffer_put(buf);
+  }
+  else
+  {
+    size_t blocks = size;
+    if (rootDir[file].flags & ROOT_TAIL) // packed tail is not part of the block runs
+      blocks = size - size % BLOCK_SIZE;
+
+    if (offset < blocks)
+    {
+      done = transferRuns(file, offset, blocks - offset, host_fd, 1);
+      if (done == -1)
+        return -1;
+    }
+
+    if (offset + done >= blocks && offset + done < size) // tail goes through a bounded buffer
+    {
+      char *block = (char*) block_buffer_get();
+      size_t tailDone = offset + done - blocks;
+      size_t tailLeft = size - (offset + done);
+
+      if (block_read(superBlock.dataStartIndex + rootExt[file].tailBlock, block) == 0)
+      {
+        int moved = write(host_fd, block + rootExt[file].tailOffset + tailDone, tailLeft);
+        if (moved > 0)
+          done = done + moved;
+      }
+      block_buffer_put(block);
+    }
+  }
+
+  entry->offset = entry->offset + done;
+  return done;
+}
+
+int fs_import(int host_fd, int fd)
+{
+  FS_LOCKED;
+
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
     return -1;
 
-  uint16_t *buffer = (uint16_t*) malloc(sizeof(uint16_t) * BLOCK_SIZE); // allocate space for buffer
-  fat.blocks = (fatB_t)malloc(sizeof(FATBlock) * superBlock.numFATBlocks * BLOCK_SIZE); // allocate space for fat
- 
-  int count = 0;
-  for (int i = 1; i <= superBlock.numFATBlocks; i++) // reads in the fat entries from the disk
+  int file = entry->indexInRoot;
+  size_t offset = entry->offset;
+  struct stat st;
+  off_t pos = lseek(host_fd, 0, SEEK_CUR);
+  int done = 0;
+
+  if (fstat(host_fd, &st) == 0 && S_ISREG(st.st_mode) && pos >= 0) // size is known, copy block runs directly
   {
-    block_read(i, buffer);
-    memcpy(fat.blocks + count, buffer, BLOCK_SIZE); // copies the buffer into fat
-    count = count + BLOCK_SIZE;
+    size_t count = st.st_size > pos ? st.st_size - pos : 0;
+
+    if (count > 0 && !((rootDir[file].flags & ROOT_INLINE) && offset + count <= INLINE_MAX) &&
+        !(rootDir[file].flags & FS_MODE_COMPRESS) &&
+        !((superBlock.features & FS_FEATURE_DEDUP) && (rootDir[file].flags & FS_MODE_EXTENT)) &&
+        preallocate(file, offset + count) == 0) // lays the new data out in one run
+    {
+      done = transferRuns(file, offset, count, host_fd, 0);
+      if (done == -1)
+        return -1;
+
+      if (offset + done > rootDir[file].size) // file grew
+        rootDir[file].size = offset + done;
+
+      entry->offset = entry->offset + done;
+      return done;
+    }
   }
 
-  if (block_read(superBlock.rootIndex, (void*)&rootDir) == -1) // reads in the root directory from the disk
-    return -1;
+  char *buf = (char*) block_buffer_get();
+  while (1) // unknown size or inline file, goes through a bounded buffer
+  {
+    int got = read(host_fd, buf, BLOCK_SIZE);
+    if (got <= 0)
+      break;
 
-  return 0;
+    int wrote = writeAt(file, entry->offset, buf, got);
+    if (wrote <= 0)
+      break;
+
+    entry->offset = entry->offset + wrote;
+    done = done + wrote;
+    if (wrote < got) // disk is full
+      break;
+  }
+  block_buffer_put(buf);
+
+  return done;
 }
 
-int fs_umount(void)
+compF_t *loadComp(int file)
 {
-  if(!fat.blocks) // checks that disk id mounted
-    return -1;
-  
-  if(block_write(0, (void*)&superBlock) == -1) // writes super block back to the disk
-    return -1;
+  if (compCache[file]) // compression state is already in memory
+    return compCache[file];
 
-  //write blocks out to disk
-  int count = 1;
-  for(int i = 0; i < superBlock.numFATBlocks; i++)
+  compF_t *comp = (compF_t*) malloc(sizeof(CompFile) + BLOCK_SIZE + CHUNK_SIZE); // index block and chunk follow the state
+  if (!comp)
+    return NULL;
+  comp->index = (chunkIdx_t*) (comp + 1);
+  comp->data = (char*) comp->index + BLOCK_SIZE;
+
+  if (rootDir[file].firstIndex == FAT_EOC) // file has no chunk index yet
+    memset(comp->index, 0, BLOCK_SIZE);
+  else if (block_read(superBlock.dataStartIndex + rootDir[file].firstIndex, comp->index) == -1)
   {
-    if(block_write(count, (void*)&fat.blocks[(BLOCK_SIZE/2) * i]))
-      return -1;
-    count++;
+    free(comp);
+    return NULL;
   }
-  
-  //write root directory out to disk
-  if(block_write(superBlock.rootIndex, (void*)&rootDir) == -1)
-    return -1;
 
-  //check disk can be closed
-  if(block_disk_close() == -1)
-    return -1;
-
-  free(fat.blocks); // frees fat
-  return 0;
+  comp->indexDirty = 0;
+  comp->chunk = -1;
+  comp->dirty = 0;
+  compCache[file] = comp;
+  return comp;
 }
 
-int fs_info(void)
+int flushChunk(int file)
 {
-  if (!fat.blocks) // checks if disk is mounted
+  compF_t *comp = compCache[file];
+  if (!comp || !comp->dirty) // nothing to compress
+    return 0;
+
+  int c = comp->chunk;
+  size_t len = rootDir[file].size - (size_t)c * CHUNK_SIZE;
+  if (len > CHUNK_SIZE)
+    len = CHUNK_SIZE;
+
+  char *packed = (char*) malloc(CHUNK_SIZE + BLOCK_SIZE);
+  if (!packed)
     return -1;
 
-  int fatRatio = 0;
-  int rootRatio = 0;
+  int stored = lz_compress(comp->data, len, packed, CHUNK_SIZE);
+  uint32_t length = stored;
+  unsigned int blocks = (stored + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-  for (int i = 0; i < superBlock.totDataBlocks; i++) // calculates fat ratio
+  if (stored == -1 || blocks >= (len + BLOCK_SIZE - 1) / BLOCK_SIZE) // not worth it, stores the chunk raw
   {
-    if (fat.blocks[i].word != 0)
-      fatRatio++;  
+    memcpy(packed, comp->data, len);
+    stored = len;
+    length = 0;
+    blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
   }
-  
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) // calculates root ratio
+  memset(packed + stored, 0, blocks * BLOCK_SIZE - stored);
+
+  if (rootDir[file].firstIndex == FAT_EOC) // first chunk, allocate the index block
   {
-    if (strlen(rootDir[i].name) != 0)
-      rootRatio++;
+    int spot = nextOpen();
+    if (spot == -1)
+      goto fail;
+    fatSet(spot, FAT_EOC);
+    rootDir[file].firstIndex = spot;
   }
 
-  int fatCount = 1;
+  chunk_t *chunk = &comp->index->chunks[c];
+  if (c >= comp->index->count) // new chunk at the end of the file
+  {
+    chunk->start = FAT_EOC;
+    chunk->blocks = 0;
+    comp->index->count = c + 1;
+  }
 
-  if (((superBlock.totDataBlocks * 2) / BLOCK_SIZE) != 0) // calculates total fat blocks
-    fatCount = (superBlock.totDataBlocks * 2) / BLOCK_SIZE;
+  if (chunk->start != FAT_EOC && chunk->blocks >= blocks) // new data fits in the old run
+  {
+    for (int i = blocks; i < chunk->blocks; i++)
+      fatSet(chunk->start + i, 0);
+  }
+  else
+  {
+    for (int i = 0; chunk->start != FAT_EOC && i < chunk->blocks; i++)
+      fatSet(chunk->start + i, 0);
 
-  printf("FS Info:\n");
-  printf("total_blk_count=%d\n", superBlock.totBlocks);
-  printf("fat_blk_count=%d\n", fatCount);
-  printf("rdir_blk=%d\n", superBlock.rootIndex);
-  printf("data_blk=%d\n", superBlock.dataStartIndex);
-  printf("data_blk_count=%d\n", superBlock.totDataBlocks);
-  printf("fat_free_ratio=%d/%d\n",  (superBlock.totDataBlocks-fatRatio), superBlock.totDataBlocks);
-  printf("rdir_free_ratio=%d/%d\n", (FS_FILE_MAX_COUNT-rootRatio), FS_FILE_MAX_COUNT);
+    int run = findFreeRun(blocks);
+    if (run == -1) // no room left for the chunk
+    {
+      chunk->start = FAT_EOC;
+      chunk->blocks = 0;
+      goto fail;
+    }
 
-  return 0;
-}
+    chunk->start = run;
+    for (int i = 0; i < blocks; i++)
+      fatSet(run + i, FAT_EOC); // marks the run as used
+  }
 
-int findFileInRootDirec(const char *filename)
-{
-  for(int i = 0; i < FS_FILE_MAX_COUNT; i++)
+  chunk->blocks = blocks;
+  chunk->length = length;
+  comp->indexDirty = 1;
+
+  for (int i = 0; i < blocks; i++) // writes the run out
   {
-    if(strcmp(rootDir[i].name, filename) == 0) // checks if file name is in root directory
-      return i; 
+    if (block_write(superBlock.dataStartIndex + chunk->start + i, packed + i * BLOCK_SIZE) == -1)
+      goto fail;
   }
 
+  free(packed);
+  comp->dirty = 0;
+  return 0;
+
+fail:
+  free(packed);
+  comp->dirty = 0;
+  comp->chunk = -1;
+  releaseChunksFrom(file, c); // file is cut at the chunk that could not be stored
+  if (rootDir[file].size > (size_t)c * CHUNK_SIZE)
+    rootDir[file].size = (size_t)c * CHUNK_SIZE;
   return -1;
 }
 
-int fs_create(const char *filename)
+int loadChunk(int file, int c)
 {
-  //if filename is invalid
-  if(filename == NULL)
+  compF_t *comp = loadComp(file);
+  if (!comp)
     return -1;
 
-  //if length of filename is too long
-  if(sizeof(filename) > FS_FILENAME_LEN) // uses sizeof to add + 1 for the '\0'
+  if (comp->chunk == c) // chunk is already in memory
+    return 0;
+
+  if (flushChunk(file) == -1)
     return -1;
 
-  //if file name already exists in file directory
-  if(findFileInRootDirec(filename) != -1)
+  comp->chunk = -1;
+  if (c >= comp->index->count || comp->index->chunks[c].start == FAT_EOC) // chunk holds no data yet
+  {
+    memset(comp->data, 0, CHUNK_SIZE);
+    comp->chunk = c;
+    return 0;
+  }
+
+  chunk_t *chunk = &comp->index->chunks[c];
+  char *packed = (char*) malloc(CHUNK_SIZE);
+  if (!packed)
     return -1;
 
-  //find empty entry in root directory
-  int full = 0;
-  for(int i = 0; i < FS_FILE_MAX_COUNT; i++)
+  for (int i = 0; i < chunk->blocks; i++) // reads the whole run in
   {
-    if(strlen(rootDir[i].name) == 0)
+    if (block_read(superBlock.dataStartIndex + chunk->start + i, packed + i * BLOCK_SIZE) == -1)
     {
-      strcpy(rootDir[i].name, filename);
-      rootDir[i].size = 0;
-      rootDir[i].firstIndex = FAT_EOC;
-      full = 1;
-      break;
+      free(packed);
+      return -1;
     }
   }
-  
-  //if root directory is already full
-  if(!full)
+
+  if (chunk->length == 0) // stored raw
+    memcpy(comp->data, packed, CHUNK_SIZE);
+  else if (lz_decompress(packed, chunk->length, comp->data, CHUNK_SIZE) == -1)
+  {
+    fprintf(stderr, "fs: corrupted chunk %d of file '%s'\n", c, rootDir[file].name);
+    free(packed);
     return -1;
-  
+  }
+
+  free(packed);
+  comp->chunk = c;
   return 0;
 }
 
-int fs_delete(const char *filename)
+void releaseChunksFrom(int file, unsigned int c)
 {
-  //filename is invalid
-  if(filename == NULL)
-    return -1;
+  compF_t *comp = loadComp(file);
+  if (!comp)
+    return;
 
-  //if length of filename is too long
-  if(sizeof(filename) > FS_FILENAME_LEN) // uses sizeif to add + 1 for the '\0'
-    return -1;
-  
-  //no file in root directory to delete
-  int check = findFileInRootDirec(filename);
-  if(check == -1)
-    return -1;
+  for (int i = c; i < comp->index->count; i++) // frees the runs of every chunk past c
+  {
+    chunk_t *chunk = &comp->index->chunks[i];
+    for (int j = 0; chunk->start != FAT_EOC && j < chunk->blocks; j++)
+      fatSet(chunk->start + j, 0);
+  }
 
-  unsigned int dataSpot = rootDir[check].firstIndex;
-  int next;
-  int end;
-      
-  while(dataSpot != FAT_EOC) // iterates through fat until it reaches FAT_EOC
+  if (comp->index->count > c)
   {
-    end = dataSpot;
-    next = fat.blocks[dataSpot].word;
-    fat.blocks[dataSpot].word = 0;
-    dataSpot = next;
+    comp->index->count = c;
+    comp->indexDirty = 1;
+  }
 
-    if (dataSpot == FAT_EOC)
-      fat.blocks[end].word = 0;
+  if (comp->chunk >= (int)c) // cached chunk is gone too
+  {
+    comp->chunk = -1;
+    comp->dirty = 0;
   }
-      
-  rootDir[check].name[0] = '\0'; // this clears the name from the root directory
-  rootDir[check].size = 0;
-  rootDir[check].firstIndex = FAT_EOC;
 
-  return 0;
+  if (c == 0 && rootDir[file].firstIndex != FAT_EOC) // frees the index block itself
+  {
+    fatSet(rootDir[file].firstIndex, 0);
+    rootDir[file].firstIndex = FAT_EOC;
+    comp->indexDirty = 0;
+  }
 }
 
-int fs_ls(void)
+int syncComp(int file)
 {
-  if (!fat.blocks)
+  compF_t *comp = compCache[file];
+  if (flushChunk(file) == -1)
     return -1;
 
-  printf("FS Ls:\n");
-
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) // prints info from root directory
+  if (comp->indexDirty && rootDir[file].firstIndex != FAT_EOC) // writes the chunk index back
   {
-    if (strlen(rootDir[i].name) != 0)
-      printf("file: %s, size: %d, data_blk: %d\n", rootDir[i].name, rootDir[i].size, rootDir[i].firstIndex);
+    if (block_write(superBlock.dataStartIndex + rootDir[file].firstIndex, comp->index) == -1)
+      return -1;
+    comp->indexDirty = 0;
   }
 
   return 0;
 }
 
-int fs_open(const char *filename)
+int compRead(int file, size_t offset, void *buf, size_t count)
 {
-  if (filename == NULL) // checks if file name is null
-    return -1;
+  size_t totalRead = 0;
 
-  if (sizeof(filename) > FS_FILENAME_LEN) // checks if file name is an acceptable length
-    return -1;
+  while (totalRead < count) // decompresses chunk by chunk
+  {
+    size_t pos = offset + totalRead;
+    size_t inChunk = pos % CHUNK_SIZE;
+    size_t len = CHUNK_SIZE - inChunk;
+    if (len > count - totalRead)
+      len = count - totalRead;
 
-  int check = findFileInRootDirec(filename); // finds the index of the file in the root directory
-  if (check == -1)
-    return -1;
+    if (loadChunk(file, pos / CHUNK_SIZE) == -1)
+      break;
 
-  int full = 0;
-  int i;
-  for (i = 0; i < FS_OPEN_MAX_COUNT; i++) // finds an open space in fd table
+    memcpy((char*)buf + totalRead, compCache[file]->data + inChunk, len);
+    totalRead = totalRead + len;
+  }
+
+  return totalRead;
+}
+
+int compWrite(int file, size_t offset, const void *buf, size_t count)
+{
+  size_t totalWrite = 0;
+
+  while (totalWrite < count) // fills chunk by chunk, compression happens when leaving a chunk
   {
-    if (fdt[i].indexInRoot == -1)
-    {
-      fdt[i].indexInRoot = check;
-      fdt[i].offset = 0;
-      full = 1;
+    size_t pos = offset + totalWrite;
+    unsigned int c = pos / CHUNK_SIZE;
+    size_t inChunk = pos % CHUNK_SIZE;
+    size_t len = CHUNK_SIZE - inChunk;
+    if (len > count - totalWrite)
+      len = count - totalWrite;
+
+    if (c >= CHUNK_MAX) // chunk index is full
       break;
-    }
+
+    if (loadChunk(file, c) == -1)
+      break;
+
+    compF_t *comp = compCache[file];
+    memcpy(comp->data + inChunk, (const char*)buf + totalWrite, len);
+    comp->dirty = 1;
+    totalWrite = totalWrite + len;
+
+    if (pos + len > rootDir[file].size) // file grew
+      rootDir[file].size = pos + len;
   }
 
-  if (!full) // checks if the fd table has reached its max
-    return -1;
+  if (totalWrite > 0 && rootDir[file].size < offset + totalWrite) // a flush cut the file short
+    totalWrite = rootDir[file].size > offset ? rootDir[file].size - offset : 0;
 
-  return i; // returns fd id
+  return totalWrite;
 }
 
-int fs_close(int fd)
+int dedupInit(void)
 {
-  if (fd < 0 || fd > 31) // checks valid fd
-    return -1;
+  unsigned int buckets = 1;
+  while (buckets < superBlock.totDataBlocks && (!dedupCap || buckets < dedupCap)) // about one bucket per data block, within the budget
+    buckets = buckets * 2;
 
-  if (fdt[fd].indexInRoot == -1) // checks that fd holds valid index
+  free(dedupHeads);
+  free(dedupNext);
+  dedupHeads = (uint16_t*) malloc(buckets * sizeof(uint16_t));
+  dedupNext = (uint16_t*) malloc(superBlock.totDataBlocks * sizeof(uint16_t));
+  if (!dedupHeads || !dedupNext)
     return -1;
 
-  fdt[fd].indexInRoot = -1; // resets fd table for file
-  fdt[fd].offset = 0;
+  dedupMask = buckets - 1;
+  for (int i = 0; i < buckets; i++)
+    dedupHeads[i] = FAT_EOC;
+
+  for (int i = 1; i < superBlock.totDataBlocks; i++) // lists every block with a known fingerprint
+  {
+    if (dedupTable[i].hashed)
+      dedupInsert(i, dedupTable[i].hash);
+  }
 
   return 0;
 }
 
-int fs_stat(int fd)
+void dedupInsert(unsigned int index, uint32_t hash)
 {
-  if (fd < 0 || fd > 31) // checks if fd is valid
-    return -1;
+  unsigned int bucket = hash & dedupMask;
+  dedupTable[index].hash = hash;
+  dedupTable[index].hashed = 1;
+  dedupNext[index] = dedupHeads[bucket];
+  dedupHeads[bucket] = index;
+}
 
-  if (fdt[fd].indexInRoot == -1) // checks if index in fd table is valid
-    return -1;
+void dedupForget(unsigned int index)
+{
+  if (!dedupTable[index].hashed)
+    return;
 
-  int result = rootDir[fdt[fd].indexInRoot].size; // returns size of file
+  uint16_t *link = &dedupHeads[dedupTable[index].hash & dedupMask];
+  while (*link != FAT_EOC && *link != index) // finds the link pointing at the block
+    link = &dedupNext[*link];
 
-  return result;
+  if (*link == index)
+    *link = dedupNext[index];
+  dedupTable[index].hashed = 0;
 }
 
-int fs_lseek(int fd, size_t offset)
+unsigned int dedupLookup(uint32_t hash, const void *data)
 {
-  if (fd < 0 || fd > 31) // checks if fd is valid
-    return -1;
+  char *block = (char*) block_buffer_get();
+  unsigned int found = FAT_EOC;
 
-  if (fdt[fd].indexInRoot == -1) // checks if index in fd table is valid
-    return -1;
-
-  if (offset > fs_stat(fd) || offset < 0) // checks if offset is valid
-    return -1;
+  for (unsigned int i = dedupHeads[hash & dedupMask]; i != FAT_EOC; i = dedupNext[i]) // compares candidates byte for byte
+  {
+    if (dedupTable[i].hash != hash || dedupTable[i].refs == UINT16_MAX)
+      continue;
 
-  fdt[fd].offset = offset; // changes offset 
+    if (block_read(superBlock.dataStartIndex + i, block) == 0 && memcmp(block, data, BLOCK_SIZE) == 0)
+    {
+      found = i;
+      break;
+    }
+  }
 
-  return 0;
+  block_buffer_put(block);
+  return found;
 }
 
-int nextOpen()
+void releaseBlock(unsigned int index)
 {
-  for (int i = 1; i < FS_FILE_MAX_COUNT; i++) // finds the next open spot in fat
+  if (dedupTable && dedupTable[index].refs > 0) // other files still use the block
   {
-    if (fat.blocks[i].word == 0)
-      return i;
+    dedupTable[index].refs--;
+    return;
   }
 
-  return -1;
+  if (dedupTable)
+    dedupForget(index);
+  fatSet(index, 0);
 }
 
-int fs_write(int fd, void *buf, size_t count)
+int extentRemap(cursor_t *cur, unsigned int index)
 {
-  if (fd < 0 || fd > 31) // checks for vaild fd
-    return -1;
+  extB_t *ext = extentCache[cur->file];
+  int i = cur->extent;
+  extent_t e = ext->extents[i];
+  unsigned int off = cur->fileBlock - e.fileBlock;
+  int left = off > 0;
+  int right = off + 1 < e.length;
+  int joinPrev = !left && i > 0 && ext->extents[i - 1].start + ext->extents[i - 1].length == index &&
+                 ext->extents[i - 1].length < UINT16_MAX;
+  int joinLeft = left && e.start + off == index; // only possible when remapping onto itself
 
-  if (fdt[fd].indexInRoot == -1) // checks valid index in root directory
-    return -1;
+  if (joinLeft)
+    return 0;
 
-  if (fdt[fd].offset > fs_stat(fd) || fdt[fd].offset < 0) // checks for valid offset
+  int pieces = left + right + (joinPrev ? 0 : 1); // extents replacing extent i
+  if (ext->count - 1 + pieces > EXTENT_MAX) // extent block is full
     return -1;
 
-  char *block = (char*) malloc(sizeof(char) * BLOCK_SIZE);
-  unsigned int totalWrite = 0;
-  unsigned int offset = fdt[fd].offset;
-  unsigned int start = superBlock.dataStartIndex;
-  unsigned int fileStartIndex = rootDir[fdt[fd].indexInRoot].firstIndex;
+  memmove(&ext->extents[i + pieces], &ext->extents[i + 1], (ext->count - i - 1) * sizeof(Extent));
+  ext->count = ext->count - 1 + pieces;
 
-  if (fileStartIndex == FAT_EOC) // checks if the file has been written to yet 
+  int at = i;
+  if (left) // blocks of the extent before the remapped one
   {
-    fileStartIndex = nextOpen();
-    rootDir[fdt[fd].indexInRoot].firstIndex = fileStartIndex;
-    rootDir[fdt[fd].indexInRoot].size = count;
-    fat.blocks[fileStartIndex].word = FAT_EOC;
+    ext->extents[at].fileBlock = e.fileBlock;
+    ext->extents[at].start = e.start;
+    ext->extents[at].length = off;
+    at++;
   }
 
-  if (offset + count <= BLOCK_SIZE) // checks if offset + count is less than block size
+  if (joinPrev) // remapped block continues the previous extent
+  {
+    ext->extents[i - 1].length++;
+    cur->extent = i - 1;
+  }
+  else
   {
-    block_read((start + fileStartIndex), block);
-    memcpy(block, buf, count);
-    totalWrite = count;
-    block_write((start + fileStartIndex), block);
+    ext->extents[at].fileBlock = cur->fileBlock;
+    ext->extents[at].start = index;
+    ext->extents[at].length = 1;
+    cur->extent = at;
+    at++;
+  }
 
+  if (right) // blocks of the extent after the remapped one
+  {
+    ext->extents[at].fileBlock = cur->fileBlock + 1;
+    ext->extents[at].start = e.start + off + 1;
+    ext->extents[at].length = e.length - off - 1;
   }
-  else // if offset + count is greater than block size
+
+  extentDirty[cur->file] = 1;
+  cur->dataIndex = index;
+  cur->last = index;
+  return 0;
+}
+
+unsigned int dedupWrite(cursor_t *cur, unsigned int index, const void *data, int full)
+{
+  uint32_t hash = crc32c(0, data, BLOCK_SIZE);
+
+  if (full) // whole block, looks for the same content elsewhere
   {
-    unsigned int tempOffset = offset % BLOCK_SIZE;
-    if (tempOffset > 0) // gets index into the end block of file
+    unsigned int same = dedupLookup(hash, data);
+    if (same == index) // block already holds this content
+      return DEDUP_SHARED;
+
+    if (same != FAT_EOC && extentRemap(cur, same) == 0) // shares the existing block instead of writing
     {
-      unsigned int move = offset / BLOCK_SIZE;
-      unsigned int temp = fileStartIndex;
-      for (int i = 0; i < move; i++) // finds the index of the block where the offset is
-      {
-        temp = fat.blocks[temp].word;
-        if (i == (move - 1))
-	  fileStartIndex = temp;
-      }
-      offset = tempOffset;
+      dedupTable[same].refs++;
+      releaseBlock(index);
+      return DEDUP_SHARED;
+    }
+  }
+
+  if (dedupTable[index].refs > 0) // block is shared, copies it on write
+  {
+    int spot = nextOpen();
+    if (spot == -1)
+      return FAT_EOC;
+
+    fatSet(spot, FAT_EOC);
+    if (extentRemap(cur, spot) == -1)
+    {
+      fatSet(spot, 0);
+      return FAT_EOC;
     }
 
-    block_read((start + fileStartIndex), block); // reads the first block in
-      
-    unsigned int leftOver;
-    if (offset == 0) // if offset is zero
+    dedupTable[index].refs--;
+    index = spot;
+  }
+  else
+    dedupForget(index); // old content is about to be overwritten
+
+  dedupTable[index].refs = 0;
+  if (full)
+    dedupInsert(index, hash);
+
+  return index;
+}
+
+pthread_mutex_t asyncLock = PTHREAD_MUTEX_INITIALIZER; // guards the async queues below
+pthread_cond_t asyncWork = PTHREAD_COND_INITIALIZER; // an operation may be ready to run
+pthread_cond_t asyncIdle = PTHREAD_COND_INITIALIZER; // no operation left in flight
+asyncOp_t *asyncQueue; // operations waiting for a worker, in submission order
+asyncOp_t *asyncDone; // completions waiting for fs_async_reap(), in completion order
+int asyncInflight; // operations submitted and not completed
+int asyncStarted; // worker threads are running
+int asyncEvent = -1; // eventfd counting completions in asyncDone, -1 until asked for
+
+void fsUnlock(pthread_mutex_t **lock)
+{
+  pthread_mutex_unlock(*lock);
+}
+
+void asyncRun(asyncOp_t *op)
+{
+  pthread_mutex_lock(&fsLock);
+
+  if (op->write && op->entry->append) // the end of file when the write runs, not when it was submitted
+    op->offset = rootDir[op->file].size;
+
+  if (op->write)
+    op->result = writeAt(op->file, op->offset, op->buf, op->count);
+  else
+    op->result = readAt(op->file, op->offset, op->buf, op->count);
+
+  fdt_t *entry = op->entry;
+  if (op->write && entry->append && op->result > 0) // the offset ends up past the appended bytes, as after fs_write
+    entry->offset = op->offset + op->result;
+  entry->pending--;
+  if (entry->pending == 0 && entry->offset > rootDir[op->file].size) // short transfers left the offset past the end of file
+    entry->offset = rootDir[op->file].size;
+
+  pthread_mutex_unlock(&fsLock);
+}
+
+void *asyncWorker(void *unused)
+{
+  pthread_mutex_lock(&asyncLock);
+  while (1)
+  {
+    asyncOp_t **link = &asyncQueue;
+    while (*link && (*link)->entry->busy) // operations on one fd run in submission order
+      link = &(*link)->next;
+
+    if (!*link)
     {
-      leftOver = count - BLOCK_SIZE; // calculates bits left to read
-      totalWrite = BLOCK_SIZE;
-      memcpy(block, buf, BLOCK_SIZE);
-      buf = buf + BLOCK_SIZE; // shifts buf over by how much we just wrote into the disk
-      block_write((start + fileStartIndex), block);
+      pthread_cond_wait(&asyncWork, &asyncLock);
+      continue;
     }
-    else // if offset is not zero
+
+    asyncOp_t *op = *link;
+    *link = op->next;
+    op->entry->busy = 1;
+    pthread_mutex_unlock(&asyncLock);
+
+    asyncRun(op);
+
+    pthread_mutex_lock(&asyncLock);
+    op->entry->busy = 0;
+    pthread_cond_broadcast(&asyncWork);
+
+    if (op->callback) // callback runs without any lock held
     {
-      leftOver = 0; // there is no more left to write from buf
-      totalWrite = count;
-      memcpy(block, buf, count);
-      buf = buf + count;
-      block_write((start + fileStartIndex), block); // writes the last part of buf into disk
+      pthread_mutex_unlock(&asyncLock);
+      op->callback(op->fd, op->result, op->arg);
+      free(op);
+      pthread_mutex_lock(&asyncLock);
     }
-     
-    unsigned int currIndex = fileStartIndex;
-      
-    while(leftOver != 0) // continues to write data from buf into disk until its all written
+    else // completion waits in the completion queue
     {
-      unsigned int prev = currIndex;
-      currIndex = fat.blocks[currIndex].word;
-      if (currIndex == FAT_EOC) // if we are at the end of a file then we must allocate a new block
-      {
-        unsigned int newSpot = nextOpen();
-	if (newSpot == -1)
-	  break;
+      asyncOp_t **tail = &asyncDone;
+      while (*tail)
+        tail = &(*tail)->next;
+      op->next = NULL;
+      *tail = op;
 
-        fat.blocks[prev].word = newSpot; // this sets prev block to point to next block
-	fat.blocks[newSpot].word = FAT_EOC; // sets new block to FAT_EOC
-	currIndex = newSpot;
-      }
+      uint64_t one = 1;
+      if (asyncEvent != -1 && write(asyncEvent, &one, sizeof(one)) != sizeof(one))
+        perror("write");
+    }
 
-      if (leftOver <= BLOCK_SIZE) // if left to write is less than block size
-      {
-	block_write((start + currIndex), buf);
-	buf = buf + leftOver;
-	totalWrite = totalWrite + leftOver;
-        leftOver = 0;
-      }
-      else // if left to write is more than block size
-      {
-	block_write((start + currIndex), buf);
-	buf = buf + BLOCK_SIZE;
-	leftOver = leftOver - BLOCK_SIZE;
-	totalWrite = totalWrite + BLOCK_SIZE;
-      }
-    }  
+    asyncInflight--;
+    if (asyncInflight == 0)
+      pthread_cond_broadcast(&asyncIdle);
   }
 
-  free(block);
-  fdt[fd].offset = fdt[fd].offset + totalWrite; // changes offset to new spot
+  return NULL;
+}
 
-  return totalWrite;
+void asyncDrain(void)
+{
+  pthread_mutex_lock(&asyncLock);
+  while (asyncInflight > 0)
+    pthread_cond_wait(&asyncIdle, &asyncLock);
+  pthread_mutex_unlock(&asyncLock);
 }
 
-int fs_read(int fd, void *buf, size_t count)
+int asyncSubmit(int write, int fd, void *buf, size_t count, fs_callback_t callback, void *arg)
 {
-  if (fd < 0 || fd > 31) // checks if fd is valud
-    return -1;
+  FS_LOCKED;
 
-  if (fdt[fd].indexInRoot == -1) // checks if index is valid
+  fdt_t *entry = fdEntry(fd); // checks if fd is valid and open
+  if (!entry)
     return -1;
 
-  if (fdt[fd].offset > fs_stat(fd) || fdt[fd].offset < 0) // checks if offset is valid
+  asyncOp_t *op = (asyncOp_t*) malloc(sizeof(AsyncOp));
+  if (!op)
     return -1;
 
-  if (fdt[fd].offset == fs_stat(fd)) // checks if offset is at the end of the file
-    return 0;
-
-  char *block = (char*) malloc(sizeof(char) * BLOCK_SIZE);
-  unsigned int totalRead = 0;
-  unsigned int offset = fdt[fd].offset;
-  unsigned int limit = fs_stat(fd);
-  unsigned int start = superBlock.dataStartIndex;
-  unsigned int fileStartIndex = rootDir[fdt[fd].indexInRoot].firstIndex;
+  op->next = NULL;
+  op->write = write;
+  op->fd = fd;
+  op->entry = entry;
+  op->file = entry->indexInRoot;
+  op->offset = entry->offset; // later calls on the fd start where this one ends
+  op->buf = buf;
+  op->count = count;
+  op->callback = callback;
+  op->arg = arg;
+  op->result = -1;
 
-  if (limit > BLOCK_SIZE) // the file size if greater than 1 block
+  pthread_mutex_lock(&asyncLock);
+  if (!asyncStarted) // starts the worker pool on first use, fails only if no worker starts
   {
-    if (offset + count <= BLOCK_SIZE) // if offset + count is less than block size
+    int started = 0;
+    for (int i = 0; i < ASYNC_WORKERS; i++)
     {
-      block_read((start + fileStartIndex), block);
-      block = block + offset;
-      memcpy(buf, block, count);
-      totalRead = count;
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, asyncWorker, NULL) != 0)
+        break;
+      pthread_detach(thread);
+      started++;
     }
-    else // if offset + count is greater than block size
+
+    if (started == 0)
     {
-      unsigned int tempOffset = offset % BLOCK_SIZE;
-      if (tempOffset > 0) // finds index of offset in particular block
-      {
-        unsigned int move = offset / BLOCK_SIZE;
-	unsigned int temp = fileStartIndex;
-        for (int i = 0; i < move; i++) // finds the index of the block where offset is
-        {
-          temp = fat.blocks[temp].word;
-          if (i == (move - 1))
-	    fileStartIndex = temp;
-        }
-	offset = tempOffset;
-      }
+      pthread_mutex_unlock(&asyncLock);
+      free(op);
+      return -1;
+    }
+    asyncStarted = 1;
+  }
 
-      block_read((start + fileStartIndex), block); // reads the block in from the disk
-      block = block + offset;
-      
-      unsigned int leftOver;
-      if (offset == 0) // if offset is zero
-      {
-	leftOver = count - BLOCK_SIZE;
-        totalRead = BLOCK_SIZE;
-        memcpy(buf, block, BLOCK_SIZE); // copies the block into buf
-        buf = buf + BLOCK_SIZE; // makes space for block in buf
-      }
-      else // if offset is not zero
-      {
-	leftOver = 0;
-        totalRead = count;
-        memcpy(buf, block, count); // copies a count of bits from disk into buf
-        buf = buf + count;
-      }
-     
-      unsigned int currIndex = fileStartIndex;
-      
-      while(leftOver != 0) // reads from disk until we read everything that was wanted
-      {
-        currIndex = fat.blocks[currIndex].word;
-	if (currIndex == FAT_EOC)
-          break;
+  asyncOp_t **tail = &asyncQueue;
+  while (*tail)
+    tail = &(*tail)->next;
+  *tail = op;
+  asyncInflight++;
+  pthread_cond_signal(&asyncWork);
+  pthread_mutex_unlock(&asyncLock);
 
-	block_read((start + currIndex), block);
-        
-	if (leftOver <= BLOCK_SIZE) // if remaining left to read is less than block size
-        {
-	  memcpy(buf, block, leftOver);
-	  totalRead = totalRead + leftOver;
-          leftOver = 0;
-        }
-	else // if remaining left to read is greater than block size
-	{
-          memcpy(buf, block, BLOCK_SIZE);
-	  buf = buf + BLOCK_SIZE;
-	  leftOver = leftOver - BLOCK_SIZE;
-	  totalRead = totalRead + BLOCK_SIZE;
-	}
-      }  
-    }
+  entry->offset = entry->offset + count;
+  entry->pending++;
+  return 0;
+}
+
+int fs_read_async(int fd, void *buf, size_t count, fs_callback_t callback, void *arg)
+{
+  return asyncSubmit(0, fd, buf, count, callback, arg);
+}
+
+int fs_write_async(int fd, const void *buf, size_t count, fs_callback_t callback, void *arg)
+{
+  return asyncSubmit(1, fd, (void*)buf, count, callback, arg);
+}
+
+int fs_async_fd(void)
+{
+  pthread_mutex_lock(&asyncLock);
+  if (asyncEvent == -1) // counts the completions already waiting
+  {
+    int waiting = 0;
+    for (asyncOp_t *op = asyncDone; op; op = op->next)
+      waiting++;
+    asyncEvent = eventfd(waiting, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
   }
-  else // the file size is less that the block size
+  int event = asyncEvent;
+  pthread_mutex_unlock(&asyncLock);
+
+  return event;
+}
+
+int fs_async_reap(struct fs_completion *completions, int max)
+{
+  int count = 0;
+
+  pthread_mutex_lock(&asyncLock);
+  while (count < max && asyncDone) // hands completions out in completion order
   {
-    block_read((start + fileStartIndex), block);
-    block = block + offset;
-    memcpy(buf, block, count);
+    asyncOp_t *op = asyncDone;
+    asyncDone = op->next;
 
-    if (limit <= count) // if file size is less than count
-    {
-      buf = buf + limit;
-      totalRead = limit;
-    }
-    else // if file size is less than the block size and greater than the count
-    {
-      buf = buf + count;
-      totalRead = count; 
-    }
+    completions[count].fd = op->fd;
+    completions[count].result = op->result;
+    completions[count].arg = op->arg;
+    count++;
+    free(op);
+
+    uint64_t one;
+    if (asyncEvent != -1 && read(asyncEvent, &one, sizeof(one)) != sizeof(one))
+      perror("read");
   }
+  pthread_mutex_unlock(&asyncLock);
 
-  free(block);
-  fdt[fd].offset = fdt[fd].offset + totalRead;
-  return totalRead;
+  return count;
 }
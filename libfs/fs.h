@@ -2,16 +2,90 @@
 #define _FS_H
 
 #include <stddef.h> /* for size_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
 
 /** Maximum filename length (including the NULL character) */
 #define FS_FILENAME_LEN 16
 
-/** Maximum number of files in the root directory */
+/** Maximum number of files in the root directory (subdirectories have no limit) */
 #define FS_FILE_MAX_COUNT 128
 
-/** Maximum number of open files */
+/** Default maximum number of open files, see fs_set_open_max() */
 #define FS_OPEN_MAX_COUNT 32
 
+/** File mode: map the file with extents instead of a FAT chain */
+#define FS_MODE_EXTENT 0x01
+
+/** File mode: compress the file data */
+#define FS_MODE_COMPRESS 0x02
+
+/** Mount flag: use direct I/O, bypassing the kernel page cache */
+#define FS_MOUNT_DIRECT 0x01
+
+/** Mount flag: write blocks back from a background thread */
+#define FS_MOUNT_WRITEBACK 0x02
+
+/** Mount flag: punch holes in the virtual disk file over reclaimed blocks */
+#define FS_MOUNT_PUNCH 0x04
+
+/** Open flag: every write goes to the end of the file */
+#define FS_OPEN_APPEND 0x01
+
+/** Format feature: inline small files and pack file tails into shared blocks */
+#define FS_FEATURE_INLINE 0x01
+
+/** Format feature: checksum every block of the disk */
+#define FS_FEATURE_CSUM 0x02
+
+/** Format feature: share identical blocks between extent-mapped files */
+#define FS_FEATURE_DEDUP 0x04
+
+/** Format flag: reserve the space of the disk instead of leaving it sparse */
+#define FS_FORMAT_ALLOCATE 0x01
+
+/** Options of a new file system, see fs_format() */
+struct fs_format_options {
+	/* Block size in bytes, a power of two from 1024 to 65536, 0 for 4096 */
+	size_t block_size;
+	/* Bitwise OR of %FS_FORMAT_* flags, or 0 */
+	int flags;
+	/* Empty files created in the root directory */
+	unsigned int files;
+	/* Name of the created files, followed by their number; "file" if NULL */
+	const char *prefix;
+};
+
+/**
+ * fs_format - Create an empty file system
+ * @diskname: Name of the virtual disk file to create
+ * @data_blocks: Number of data blocks of the file system
+ * @options: Options of the new file system, or NULL for the defaults
+ *
+ * Create virtual disk file @diskname, replacing any file of that name, holding
+ * an empty file system of @data_blocks data blocks. With the default options,
+ * the disk is the same as the one made by the reference fs_make tool.
+ *
+ * Only the superblock, the first FAT block and, when files are created, the
+ * root directory are written. The rest of the disk is a hole of the host file,
+ * which reads back as zeros, so the time taken does not depend on the size of
+ * the disk. With %FS_FORMAT_ALLOCATE, the space is reserved on the host file
+ * system with posix_fallocate() instead, so later writes cannot run out of
+ * host space.
+ *
+ * The block size is recorded in the superblock and followed by every later
+ * mount. Larger blocks move more data per block transfer and FAT lookup and
+ * hold more entries per directory bucket, smaller blocks waste less space at
+ * the end of each file. Disks whose blocks are not 4096 bytes can only be
+ * handled by this library.
+ *
+ * Return: -1 if @diskname cannot be created or written, if @data_blocks is 0
+ * or makes the disk larger than 65535 blocks, or if an option is invalid (more
+ * files than the root directory holds, or names longer than %FS_FILENAME_LEN
+ * - 1 characters). 0 otherwise.
+ */
+int fs_format(const char *diskname, unsigned int data_blocks,
+	      const struct fs_format_options *options);
+
 /**
  * fs_mount - Mount a file system
  * @diskname: Name of the virtual disk file
@@ -25,17 +99,126 @@
  */
 int fs_mount(const char *diskname);
 
+/**
+ * fs_mount_flags - Mount a file system with options
+ * @diskname: Name of the virtual disk file
+ * @flags: Bitwise OR of %FS_MOUNT_* flags, or 0
+ *
+ * Same as fs_mount(). With %FS_MOUNT_DIRECT, the virtual disk file is accessed
+ * with direct I/O so file data is not cached a second time by the kernel. Block
+ * temporaries, and user buffers of fs_read() and fs_write() that are not
+ * aligned for direct I/O, go through a pool of aligned buffers that are reused
+ * from one call to the next, keeping memory usage predictable.
+ *
+ * With %FS_MOUNT_WRITEBACK, writing a block only copies it into memory. A
+ * flusher thread writes dirty blocks back once they are a second old, or all
+ * of them once 8 MiB are dirty, sorted by block so that consecutive blocks go
+ * out in one system call; writers wait for it when 16 MiB are dirty. Blocks
+ * still in memory when the program dies are lost, see fs_sync().
+ *
+ * With %FS_MOUNT_PUNCH, the blocks of deleted files are also given back to the
+ * host file system once reclaimed, see fs_delete(), by punching holes in the
+ * virtual disk file.
+ *
+ * Return: -1 if fs_mount() would fail, if @flags contains unknown flags or if
+ * the virtual disk file does not support direct I/O. 0 otherwise.
+ */
+int fs_mount_flags(const char *diskname, int flags);
+
+/**
+ * fs_mount_budget - Mount a file system within a memory budget
+ * @diskname: Name of the virtual disk file
+ * @flags: Bitwise OR of %FS_MOUNT_* flags, or 0
+ * @budget: Bytes of memory the mount may use for its tables, 0 for no limit
+ *
+ * Same as fs_mount_flags(), but the tables that grow with the size of the
+ * disk (the FAT, the checksum and dedup regions and the fingerprint index)
+ * are kept within @budget bytes. The checksum and dedup regions are always
+ * held in memory; up to a quarter of what is left goes to the fingerprint
+ * index and the rest holds FAT blocks, which are then read from the disk on
+ * demand and written back when evicted. Extent blocks and compression state
+ * of a file in the root directory are also dropped once it is closed. Regions
+ * added later by fs_feature_enable() come on top of the budget.
+ *
+ * Return: -1 if fs_mount_flags() would fail, or if @budget cannot hold the
+ * regions that are always in memory plus one FAT block. 0 otherwise.
+ */
+int fs_mount_budget(const char *diskname, int flags, size_t budget);
+
 /**
  * fs_umount - Unmount file system
  *
  * Unmount the currently mounted file system and close the underlying virtual
- * disk file.
+ * disk file. File descriptors still open are closed: later calls on them fail,
+ * also once a file system is mounted again.
  *
  * Return: -1 if no underlying virtual disk was opened, or if the virtual disk
- * cannot be closed, or if there are still open file descriptors. 0 otherwise.
+ * cannot be closed. 0 otherwise.
  */
 int fs_umount(void);
 
+/**
+ * fs_sync - Write the file system back to disk
+ *
+ * Write the superblock, the FAT, the directories and every other table kept in
+ * memory back to the disk, as fs_umount() does, and wait until every block
+ * written so far has reached the virtual disk file.
+ *
+ * Return: -1 if no underlying virtual disk was opened or if writing fails. 0
+ * otherwise.
+ */
+int fs_sync(void);
+
+/**
+ * fs_feature_enable - Enable extended format features
+ * @features: Bitwise OR of %FS_FEATURE_* flags
+ *
+ * Turn on the extended format @features on the currently mounted file system.
+ * Features are recorded in the superblock and stay enabled for every later
+ * mount. Images using extended features can no longer be handled by tools that
+ * only know the original format.
+ *
+ * With %FS_FEATURE_INLINE, a root extension region giving each root directory
+ * entry 256 extra bytes is reserved in the data blocks. Files of up to 248
+ * bytes are stored inline in their extension entry and need no data block at
+ * all, and when a larger file is closed, its last partial block (if it holds at
+ * most half a block) is packed together with the tails of other files into a
+ * shared tail block. Packed files are transparently unpacked when written to.
+ *
+ * With %FS_FEATURE_CSUM, a checksum region holding the CRC32C checksum of every
+ * block of the disk is reserved in the data blocks (its location is kept in the
+ * superblock) and all blocks are checksummed once. From then on, every block
+ * written updates its checksum, and reading a block that does not match its
+ * checksum fails. Checksums are computed with the SSE4.2 crc32 instruction
+ * when the processor has it.
+ *
+ * With %FS_FEATURE_DEDUP, a dedup region holding a fingerprint and a reference
+ * count for every data block is reserved in the data blocks. When a whole
+ * block of a file created with %FS_MODE_EXTENT is written, its fingerprint is
+ * looked up in an in-memory index rebuilt at mount time, and if a block with
+ * the same content exists, the file is mapped onto that block instead of
+ * writing a copy. A shared block is copied when one of its files writes to it,
+ * and freed when its last file lets go of it. Files chained through the FAT
+ * are not deduplicated since a block can only belong to one chain.
+ *
+ * Return: -1 if no underlying virtual disk was opened, if @features contains
+ * unknown flags or if there is not enough space on disk to enable them. 0
+ * otherwise.
+ */
+int fs_feature_enable(int features);
+
+/**
+ * fs_scrub - Verify the checksums of the whole file system
+ *
+ * Check the superblock, the FAT, the root directory and every data block in
+ * use against their checksums, reading runs of consecutive blocks in batches.
+ * Each corrupted block is reported on stderr.
+ *
+ * Return: -1 if no underlying virtual disk was opened, if %FS_FEATURE_CSUM is
+ * not enabled or if reading fails. Otherwise the number of corrupted blocks.
+ */
+int fs_scrub(void);
+
 /**
  * fs_info - Display information about file system
  *
@@ -45,6 +228,69 @@ int fs_umount(void);
  */
 int fs_info(void);
 
+/** Layout of the files of a mounted file system, see fs_fragmentation() */
+struct fs_fragmentation {
+	/* Files and directories holding data blocks */
+	unsigned int files;
+	/* Those whose blocks are split in more than one run */
+	unsigned int fragmented;
+	/* Runs of consecutive data blocks, over all files */
+	unsigned int extents;
+	/* Data blocks of all files */
+	unsigned int blocks;
+	/* Runs of free data blocks, and the length of the longest one */
+	unsigned int free_extents;
+	unsigned int free_largest;
+};
+
+/**
+ * fs_fragmentation - Report how fragmented files and free space are
+ * @frag: Filled with the layout of the mounted file system
+ *
+ * Walk the blocks of every file, in subdirectories too, and count the runs of
+ * consecutive data blocks they are made of, then the runs of free blocks left.
+ * The average run length of files is @frag->blocks / @frag->extents. Inline
+ * data and packed tails do not count; compressed files count their chunks.
+ *
+ * Return: -1 if no underlying virtual disk was opened or if a directory cannot
+ * be read. 0 otherwise.
+ */
+int fs_fragmentation(struct fs_fragmentation *frag);
+
+/** Memory used by a mounted file system, see fs_memory_usage() */
+struct fs_memory {
+	/* Budget given to fs_mount_budget(), 0 if none */
+	size_t budget;
+	/* Bytes of FAT blocks in memory */
+	size_t fat;
+	/* Bytes of the checksum and dedup regions and the fingerprint index */
+	size_t indexes;
+	/* Bytes of directory entries, per-file state and the descriptor table */
+	size_t files;
+	/* Bytes of blocks waiting to be written back (%FS_MOUNT_WRITEBACK only) */
+	size_t dirty;
+	/* Sum of the above */
+	size_t total;
+	/* FAT blocks in memory and on disk */
+	unsigned int fat_resident;
+	unsigned int fat_blocks;
+	/* FAT blocks read back from the disk after being evicted */
+	unsigned int fat_faults;
+};
+
+/**
+ * fs_memory_usage - Report memory usage
+ * @usage: Filled with the memory used by the mounted file system
+ *
+ * Only @fat and @indexes count against the budget of fs_mount_budget(); the
+ * memory in @files grows with the directory entries and files in use, and the
+ * memory in @dirty with the writes the flusher has not caught up with.
+ *
+ * Return: -1 if no underlying virtual disk was opened or if @usage is NULL.
+ * 0 otherwise.
+ */
+int fs_memory_usage(struct fs_memory *usage);
+
 /**
  * fs_create - Create a new file
  * @filename: File name
@@ -54,12 +300,47 @@ int fs_info(void);
  * length cannot exceed %FS_FILENAME_LEN characters (including the NULL
  * character).
  *
+ * @filename can also be a path such as "logs/2024/app.log" (a leading '/' is
+ * allowed) naming a file in a subdirectory created with fs_mkdir(). Each name
+ * along the path follows the same length rule as a file name in the root
+ * directory. Every other function taking a file name accepts such paths too.
+ *
  * Return: -1 if @filename is invalid, if a file named @filename already exists,
- * or if string @filename is too long, or if the root directory already contains
- * %FS_FILE_MAX_COUNT files. 0 otherwise.
+ * or if string @filename is too long, if a directory on the path does not
+ * exist, or if the root directory already contains %FS_FILE_MAX_COUNT files. 0
+ * otherwise.
  */
 int fs_create(const char *filename);
 
+/**
+ * fs_create_mode - Create a new file with a specific layout
+ * @filename: File name
+ * @mode: Bitwise OR of %FS_MODE_* flags, or 0 for a regular file
+ *
+ * Same as fs_create(), but the layout of the new file is selected by @mode.
+ * With %FS_MODE_EXTENT, the file is described by a sorted list of (start
+ * block, length) extents kept in an extent block referenced from its root
+ * directory entry. Translating a file offset into a data block is then a
+ * binary search over the extents instead of a walk along the FAT chain, and
+ * new blocks are preferably allocated right after the last extent so that
+ * sequentially written files stay contiguous.
+ *
+ * With %FS_MODE_COMPRESS, the file data is split into chunks of 16 blocks that
+ * are each compressed with a fast LZ codec and stored in a run of contiguous
+ * blocks, listed in a chunk index block referenced from the root directory
+ * entry. fs_read() decompresses the chunks it needs and fs_write() fills an
+ * uncompressed chunk in memory that is compressed when the writer moves on to
+ * another chunk or when the file is last closed. Chunks that do not compress
+ * are stored as is. The chunk index holds (block size - 8) / 8 chunks, the
+ * most a compressed file has: 511 with 4096-byte blocks, 127 with 1 KiB
+ * blocks and 8191 with 64 KiB blocks. If the disk runs out of space while
+ * storing a chunk, the file is cut at that chunk.
+ *
+ * Return: -1 if fs_create() would fail, if @mode contains unknown flags or if
+ * it combines %FS_MODE_EXTENT and %FS_MODE_COMPRESS. 0 otherwise.
+ */
+int fs_create_mode(const char *filename, int mode);
+
 /**
  * fs_delete - Delete a file
  * @filename: File name
@@ -67,11 +348,47 @@ int fs_create(const char *filename);
  * Delete the file named @filename from the root directory of the mounted file
  * system.
  *
+ * The entry goes right away, but the FAT chain of the file is only queued: a
+ * background thread frees it a batch of blocks at a time. The queue is worked
+ * through before an allocation fails for lack of space, and by fs_info(),
+ * fs_fragmentation(), fs_sync() and fs_umount(). Extent-mapped and compressed
+ * files are freed right away.
+ *
  * Return: -1 if @filename is invalid, if there is no file named @filename to
- * delete, or if file @filename is currently open. 0 otherwise.
+ * delete, if @filename is a directory, or if file @filename is currently open.
+ * 0 otherwise.
  */
 int fs_delete(const char *filename);
 
+/**
+ * fs_mkdir - Create a directory
+ * @path: Path of the new directory
+ *
+ * Create a new and empty directory at @path. A directory in the root directory
+ * takes one of its %FS_FILE_MAX_COUNT entries, but a subdirectory holds any
+ * number of entries, up to 130048. Its entries are kept in buckets of one block
+ * each, indexed by a hash of the name through a table in the first block of
+ * the directory (extendible hashing): looking a name up reads two blocks
+ * whatever the size of the directory, and a full bucket is split in two
+ * without touching the others.
+ *
+ * Return: -1 if @path is invalid, if an entry named @path already exists, if a
+ * directory on the path does not exist, or if the root directory is full. 0
+ * otherwise.
+ */
+int fs_mkdir(const char *path);
+
+/**
+ * fs_rmdir - Delete a directory
+ * @path: Path of the directory
+ *
+ * Delete the empty directory at @path.
+ *
+ * Return: -1 if @path is invalid, if there is no directory at @path, or if the
+ * directory is not empty. 0 otherwise.
+ */
+int fs_rmdir(const char *path);
+
 /**
  * fs_ls - List files on file system
  *
@@ -81,6 +398,72 @@ int fs_delete(const char *filename);
  */
 int fs_ls(void);
 
+/**
+ * fs_ls_dir - List files of a directory
+ * @path: Path of the directory, "/" for the root directory
+ *
+ * Same as fs_ls() for the directory at @path. Entries of a subdirectory are
+ * listed in hash order.
+ *
+ * Return: -1 if no underlying virtual disk was opened, or if there is no
+ * directory at @path. 0 otherwise.
+ */
+int fs_ls_dir(const char *path);
+
+/**
+ * struct fs_dirent - Directory entry returned by fs_readdir()
+ * @name: Name of the entry, NULL-terminated
+ * @size: Size of the file in bytes
+ * @first_block: First data block of the file, as shown by fs_ls()
+ * @block_count: Number of data blocks holding the file content
+ * @is_dir: Whether the entry is a directory
+ */
+struct fs_dirent {
+	char name[FS_FILENAME_LEN];
+	unsigned int size;
+	unsigned int first_block;
+	unsigned int block_count;
+	int is_dir;
+};
+
+/**
+ * fs_readdir - Read entries of a directory
+ * @path: Path of the directory, "/" for the root directory
+ * @pos: Position in the directory, 0 to start from the first entry
+ * @entries: Array receiving the entries
+ * @max: Size of array @entries
+ *
+ * Fill @entries with up to @max entries of the directory at @path, starting at
+ * position @pos, and advance @pos past the entries returned. Calling again with
+ * the same @pos picks up where the previous call stopped, so a directory of
+ * any size is walked with a fixed-size array and no allocation. Empty entries
+ * of the root directory are skipped through an occupancy bitmap, and the
+ * entries of a subdirectory come in hash order, one bucket block at a time.
+ * Entries created or deleted in the directory during a walk may be skipped or
+ * returned twice.
+ *
+ * Return: -1 if no underlying virtual disk was opened, or if there is no
+ * directory at @path. Otherwise the number of entries stored in @entries, 0
+ * once the whole directory was read.
+ */
+int fs_readdir(const char *path, unsigned int *pos, struct fs_dirent *entries,
+	       int max);
+
+/**
+ * fs_stat_many - Get the size of many files
+ * @paths: Array of file paths
+ * @count: Number of paths in @paths
+ * @sizes: Array receiving the size of each file
+ *
+ * Store in @sizes[i] the size of the file at @paths[i], or -1 if there is no
+ * such file, without opening the files. Consecutive paths in the same
+ * directory share a single walk of the directories leading to it.
+ *
+ * Return: -1 if no underlying virtual disk was opened. Otherwise the number of
+ * files found.
+ */
+int fs_stat_many(const char **paths, int count, int *sizes);
+
 /**
  * fs_open - Open a file
  * @filename: File name
@@ -91,14 +474,51 @@ int fs_ls(void);
  * of the file descriptor is set to 0 initially (beginning of the file). If the
  * same file is opened multiple files, fs_open() must return distinct file
  * descriptors. A maximum of %FS_OPEN_MAX_COUNT files can be open
- * simultaneously.
+ * simultaneously, unless the limit was changed with fs_set_open_max().
+ *
+ * A closed file descriptor is never valid again: its slot may be reused, but
+ * with a new generation number encoded in the descriptor, so calls with the old
+ * descriptor fail instead of reaching the file opened later.
  *
  * Return: -1 if @filename is invalid, there is no file named @filename to open,
- * or if there are already %FS_OPEN_MAX_COUNT files currently open. Otherwise,
- * return the file descriptor.
+ * if @filename is a directory, or if the maximum number of files are already
+ * open. Otherwise, return the file descriptor.
  */
 int fs_open(const char *filename);
 
+/**
+ * fs_open_flags - Open a file with options
+ * @filename: File name
+ * @flags: Bitwise OR of %FS_OPEN_* flags, or 0
+ *
+ * Same as fs_open(). With %FS_OPEN_APPEND, fs_write(), fs_writev() and
+ * fs_write_async() on the file descriptor first move its offset to the end of
+ * the file, as it is when the write runs; fs_pwrite() still writes where it is
+ * told to.
+ *
+ * Finding the end of a FAT-chained file does not walk its chain: the last
+ * block of every file in use is remembered once it has been reached, so
+ * appending costs the same whatever the size of the file.
+ *
+ * Return: -1 if fs_open() would fail or if @flags contains unknown flags.
+ * Otherwise, return the file descriptor.
+ */
+int fs_open_flags(const char *filename, int flags);
+
+/**
+ * fs_set_open_max - Change the maximum number of open files
+ * @max: New maximum, from 1 to 1048576
+ *
+ * Allow up to @max files to be open simultaneously instead of
+ * %FS_OPEN_MAX_COUNT. The descriptor table grows on demand, so a large limit
+ * costs nothing until descriptors are actually opened. Opening and closing a
+ * file take constant time whatever the number of open files.
+ *
+ * Return: -1 if @max is out of range or smaller than the number of files
+ * currently open. 0 otherwise.
+ */
+int fs_set_open_max(unsigned int max);
+
 /**
  * fs_close - Close a file
  * @fd: File descriptor
@@ -152,6 +572,12 @@ int fs_lseek(int fd, size_t offset);
  * as many bytes as possible. The number of written bytes can therefore be
  * smaller than @count (it can even be 0 if there is no more space on disk).
  *
+ * A new block goes right after the last block of the file when that one is
+ * free. The first block of a file goes to the lowest free block, unless another
+ * open file would grow into it: the file then starts in the next allocation
+ * group (the blocks of one FAT block) that is at least half free, or halfway
+ * into the free run, so that files written at the same time do not interleave.
+ *
  * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
  * open). Otherwise return the number of bytes actually written.
  */
@@ -172,9 +598,270 @@ int fs_write(int fd, void *buf, size_t count);
  * is at the end of the file). The file offset of the file descriptor is
  * implicitly incremented by the number of bytes that were actually read.
  *
+ * A large read (1 MiB or more) of a file that is neither inline nor
+ * compressed is split into runs of consecutive blocks read concurrently by a
+ * pool of threads, each straight into its own slice of @buf.
+ *
  * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
  * open). Otherwise return the number of bytes actually read.
  */
 int fs_read(int fd, void *buf, size_t count);
 
+/**
+ * fs_pread - Read from a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @offset: File offset to read from
+ *
+ * Same as fs_read(), but reads from @offset and leaves the file offset of @fd
+ * untouched, so that several threads can read different ranges of one file
+ * through the same file descriptor without seeking.
+ *
+ * Return: -1 if file descriptor @fd is invalid, or if @offset is larger than
+ * the current file size. Otherwise return the number of bytes actually read.
+ */
+int fs_pread(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_pwrite - Write to a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @offset: File offset to write at
+ *
+ * Same as fs_write(), but writes at @offset and leaves the file offset of @fd
+ * untouched.
+ *
+ * Return: -1 if file descriptor @fd is invalid, or if @offset is larger than
+ * the current file size. Otherwise return the number of bytes actually
+ * written.
+ */
+int fs_pwrite(int fd, const void *buf, size_t count, size_t offset);
+
+/**
+ * fs_readv - Read from a file into several buffers
+ * @fd: File descriptor
+ * @iov: Buffers to fill, in order
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Same as fs_read() into the concatenation of the @iovcnt buffers of @iov:
+ * the blocks of the file are located once for the whole range and each is
+ * copied into the buffers it spans.
+ *
+ * Return: -1 if file descriptor @fd is invalid, if @iovcnt is negative or if
+ * the buffers add up to more than INT_MAX bytes. Otherwise return the number
+ * of bytes actually read.
+ */
+int fs_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_writev - Write to a file from several buffers
+ * @fd: File descriptor
+ * @iov: Buffers to write, in order
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Same as fs_write() of the concatenation of the @iovcnt buffers of @iov, in
+ * a single pass over the blocks of the file.
+ *
+ * Return: -1 if file descriptor @fd is invalid, if @iovcnt is negative or if
+ * the buffers add up to more than INT_MAX bytes. Otherwise return the number
+ * of bytes actually written.
+ */
+int fs_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_mmap - Map part of a file read-only
+ * @fd: File descriptor
+ * @offset: File offset where the mapped range starts
+ * @len: Number of bytes to map
+ *
+ * Give read-only access to @len bytes of the file opened as @fd, starting at
+ * @offset, without copying them. When the blocks of the range follow each
+ * other on disk, the returned pointer points straight into a mapping of the
+ * disk image; when they are scattered, each run of contiguous blocks is mapped
+ * into its place in a single range. Inline, packed and compressed data, and
+ * blocks smaller than a page, are read into an anonymous mapping instead.
+ *
+ * The mapping stays valid until fs_munmap() or fs_umount(), even once @fd is
+ * closed. Writing to the mapped range of the file afterwards may or may not
+ * show up in the mapping, and deleting or truncating the file leaves its
+ * content undefined.
+ *
+ * Return: NULL if file descriptor @fd is invalid, if @len is 0, if the range
+ * does not lie within the file or if it cannot be mapped. Otherwise the
+ * address of the first byte of the range.
+ */
+const void *fs_mmap(int fd, size_t offset, size_t len);
+
+/**
+ * fs_munmap - Release a mapping of a file
+ * @addr: Address returned by fs_mmap()
+ *
+ * Return: -1 if @addr was not returned by fs_mmap() or was already released.
+ * 0 otherwise.
+ */
+int fs_munmap(const void *addr);
+
+/**
+ * fs_callback_t - Completion callback of an asynchronous operation
+ * @fd: File descriptor the operation was submitted on
+ * @result: Return value the synchronous call would have had
+ * @arg: Argument given at submission
+ */
+typedef void (*fs_callback_t)(int fd, int result, void *arg);
+
+/**
+ * struct fs_completion - Completed asynchronous operation
+ * @fd: File descriptor the operation was submitted on
+ * @result: Return value the synchronous call would have had
+ * @arg: Argument given at submission
+ */
+struct fs_completion {
+	int fd;
+	int result;
+	void *arg;
+};
+
+/**
+ * fs_read_async - Read from a file without waiting
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @callback: Function called on completion, or NULL
+ * @arg: Argument passed back on completion
+ *
+ * Queue a read of @count bytes at the current file offset of @fd and return
+ * right away. The operation is run by an internal pool of worker threads, and
+ * @buf must stay valid until it completes. Operations on the same file
+ * descriptor run in the order they were queued.
+ *
+ * The file offset moves past the @count bytes when the read is queued, so the
+ * next call on @fd starts where this read ends. Once no operation is left in
+ * flight on @fd, an offset left past the end of the file by short transfers is
+ * pulled back to the end of the file. File descriptor @fd cannot be closed
+ * while operations on it are in flight, and fs_umount() waits for all of them.
+ *
+ * On completion, @callback is called from a worker thread with the result
+ * fs_read() would have returned. It may call other fs_* functions, except
+ * fs_umount(). If @callback is NULL, the completion is instead queued for
+ * fs_async_reap() and signaled on the descriptor returned by fs_async_fd().
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or if the operation cannot be queued. 0 otherwise.
+ */
+int fs_read_async(int fd, void *buf, size_t count, fs_callback_t callback, void *arg);
+
+/**
+ * fs_write_async - Write to a file without waiting
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes to be written
+ * @callback: Function called on completion, or NULL
+ * @arg: Argument passed back on completion
+ *
+ * Same as fs_read_async() for fs_write().
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or if the operation cannot be queued. 0 otherwise.
+ */
+int fs_write_async(int fd, const void *buf, size_t count, fs_callback_t callback, void *arg);
+
+/**
+ * fs_async_fd - Get the completion queue descriptor
+ *
+ * Return an eventfd that is readable whenever completions of operations queued
+ * without a callback are waiting for fs_async_reap(), so it can be watched by
+ * poll() or epoll together with other descriptors. It must not be read from or
+ * closed by the caller.
+ *
+ * Return: -1 if the descriptor cannot be created. Otherwise the descriptor.
+ */
+int fs_async_fd(void);
+
+/**
+ * fs_async_reap - Collect completed asynchronous operations
+ * @completions: Array to fill with completions
+ * @max: Number of entries in @completions
+ *
+ * Move up to @max completions of operations queued without a callback into
+ * @completions, oldest first. Never blocks.
+ *
+ * Return: the number of completions stored in @completions.
+ */
+int fs_async_reap(struct fs_completion *completions, int max);
+
+/**
+ * fs_fallocate - Preallocate space for a file
+ * @fd: File descriptor
+ * @size: Number of bytes the file should be able to hold
+ *
+ * Make sure the file referenced by file descriptor @fd owns enough data blocks
+ * to hold @size bytes, without changing its size. Missing blocks are taken as
+ * one contiguous run, right after the current last block of the file when
+ * possible, so that later writes up to @size never have to look for free
+ * blocks and the file ends up laid out sequentially. If no such run exists,
+ * free blocks are taken wherever they are.
+ *
+ * Preallocated blocks are kept until the file is truncated with fs_truncate()
+ * or deleted.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or if there is not enough free space on disk. 0 otherwise.
+ */
+int fs_fallocate(int fd, size_t size);
+
+/**
+ * fs_truncate - Shrink a file
+ * @fd: File descriptor
+ * @size: New size of the file
+ *
+ * Cut the file referenced by file descriptor @fd down to @size bytes and free
+ * every data block past the new end of file, including blocks preallocated
+ * with fs_fallocate(). The offset of every file descriptor pointing past the
+ * new end of file is moved back to @size.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open), or if @size is larger than the current file size. 0 otherwise.
+ */
+int fs_truncate(int fd, size_t size);
+
+/**
+ * fs_export - Copy a file to a host file descriptor
+ * @fd: File descriptor
+ * @host_fd: Host file descriptor to write to
+ *
+ * Copy the content of the file referenced by file descriptor @fd, from its
+ * current offset up to the end of file, to the host file descriptor @host_fd.
+ * Each run of contiguous data blocks is handed to the kernel in one piece
+ * (copy_file_range() or splice()), so the data is never staged in user memory.
+ * Only inline data and packed tails go through a bounded buffer. The file
+ * offset of @fd is incremented by the number of bytes copied.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or if nothing could be copied because of an I/O error. Otherwise return
+ * the number of bytes copied.
+ */
+int fs_export(int fd, int host_fd);
+
+/**
+ * fs_import - Copy a host file descriptor into a file
+ * @host_fd: Host file descriptor to read from
+ * @fd: File descriptor
+ *
+ * Copy everything left to read from the host file descriptor @host_fd into the
+ * file referenced by file descriptor @fd, starting at its current offset, and
+ * extend the file as needed. When @host_fd is a regular file, the blocks needed
+ * are preallocated as with fs_fallocate() and each run of contiguous blocks is
+ * filled by the kernel directly. Otherwise, data goes through a bounded buffer.
+ * As with fs_write(), as many bytes as possible are copied if the disk runs out
+ * of space. The file offset of @fd is incremented by the number of bytes
+ * copied.
+ *
+ * Return: -1 if file descriptor @fd is invalid (out of bounds or not currently
+ * open) or if nothing could be copied because of an I/O error. Otherwise return
+ * the number of bytes copied.
+ */
+int fs_import(int host_fd, int fd);
+
 #endif /* _FS_H */
@@ -0,0 +1,192 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+/* Shortest back reference worth encoding */
+#define MIN_MATCH 4
+
+/* Bytes at the end of the input always emitted as literals */
+#define LAST_LITERALS 5
+
+/* Largest distance of a back reference */
+#define MAX_OFFSET 0xFFFF
+
+/* Hash table of recent positions, indexed by the next four bytes */
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+
+static uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Write a length nibble overflow as a run of 255 bytes, -1 if out of room */
+static int put_length(uint8_t **op, uint8_t *oend, int len)
+{
+	while (len >= 255) {
+		if (*op >= oend)
+			return -1;
+		*(*op)++ = 255;
+		len -= 255;
+	}
+
+	if (*op >= oend)
+		return -1;
+	*(*op)++ = len;
+
+	return 0;
+}
+
+/* Emit one sequence: literals, then a match unless @match is 0 */
+static int put_sequence(uint8_t **op, uint8_t *oend, const uint8_t *lit,
+			int nlit, int offset, int match)
+{
+	uint8_t *token = *op;
+	int mlen = match ? match - MIN_MATCH : 0;
+
+	if (*op >= oend)
+		return -1;
+	(*op)++;
+
+	*token = (nlit < 15 ? nlit : 15) << 4;
+	if (nlit >= 15 && put_length(op, oend, nlit - 15))
+		return -1;
+
+	if (oend - *op < nlit)
+		return -1;
+	memcpy(*op, lit, nlit);
+	*op += nlit;
+
+	/* Last sequence carries no match */
+	if (!match)
+		return 0;
+
+	if (oend - *op < 2)
+		return -1;
+	*(*op)++ = offset & 0xFF;
+	*(*op)++ = offset >> 8;
+
+	*token |= mlen < 15 ? mlen : 15;
+	if (mlen >= 15 && put_length(op, oend, mlen - 15))
+		return -1;
+
+	return 0;
+}
+
+int lz_compress(const void *src, int len, void *dst, int cap)
+{
+	const uint8_t *in = src;
+	uint8_t *op = dst;
+	uint8_t *oend = op + cap;
+	int table[HASH_SIZE];
+	int anchor = 0;
+	int i = 0;
+
+	memset(table, -1, sizeof(table));
+
+	while (i + MIN_MATCH <= len - LAST_LITERALS) {
+		uint32_t seq = read32(in + i);
+		uint32_t h = hash32(seq);
+		int ref = table[h];
+		int match;
+
+		table[h] = i;
+		if (ref < 0 || i - ref > MAX_OFFSET || read32(in + ref) != seq) {
+			i++;
+			continue;
+		}
+
+		/* Extend the match as far as it goes */
+		match = MIN_MATCH;
+		while (i + match < len - LAST_LITERALS &&
+		       in[ref + match] == in[i + match])
+			match++;
+
+		if (put_sequence(&op, oend, in + anchor, i - anchor, i - ref,
+				 match))
+			return -1;
+
+		i += match;
+		anchor = i;
+	}
+
+	if (put_sequence(&op, oend, in + anchor, len - anchor, 0, 0))
+		return -1;
+
+	return op - (uint8_t *)dst;
+}
+
+/* Read a length nibble overflow, -1 if the input ends */
+static int get_length(const uint8_t **ip, const uint8_t *iend, int *len)
+{
+	uint8_t b;
+
+	do {
+		if (*ip >= iend)
+			return -1;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+
+	return 0;
+}
+
+int lz_decompress(const void *src, int len, void *dst, int cap)
+{
+	const uint8_t *ip = src;
+	const uint8_t *iend = ip + len;
+	uint8_t *out = dst;
+	uint8_t *op = out;
+	uint8_t *oend = out + cap;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		int nlit = token >> 4;
+		int match = token & 15;
+		int offset;
+
+		if (nlit == 15 && get_length(&ip, iend, &nlit))
+			return -1;
+
+		if (iend - ip < nlit || oend - op < nlit)
+			return -1;
+		memcpy(op, ip, nlit);
+		ip += nlit;
+		op += nlit;
+
+		/* Last sequence has no match */
+		if (ip >= iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op - out)
+			return -1;
+
+		if (match == 15 && get_length(&ip, iend, &match))
+			return -1;
+		match += MIN_MATCH;
+
+		if (oend - op < match)
+			return -1;
+
+		/* Byte by byte, the reference may overlap the output */
+		while (match--) {
+			*op = *(op - offset);
+			op++;
+		}
+	}
+
+	return op - out;
+}
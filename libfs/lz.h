@@ -0,0 +1,33 @@
+#ifndef _LZ_H
+#define _LZ_H
+
+/**
+ * lz_compress - Compress a buffer
+ * @src: Data to compress
+ * @len: Number of bytes in @src
+ * @dst: Buffer receiving the compressed data
+ * @cap: Size of @dst in bytes
+ *
+ * Compress @len bytes of @src into @dst with a small LZ77 codec in the style of
+ * LZ4: a sequence of literal runs and back references of at least four bytes
+ * found through a hash of the next four bytes. Compression runs in a single
+ * pass and needs no memory beyond its hash table on the stack.
+ *
+ * Return: -1 if the compressed data does not fit in @cap bytes. Otherwise the
+ * number of bytes written to @dst.
+ */
+int lz_compress(const void *src, int len, void *dst, int cap);
+
+/**
+ * lz_decompress - Decompress a buffer
+ * @src: Data produced by lz_compress()
+ * @len: Number of bytes in @src
+ * @dst: Buffer receiving the decompressed data
+ * @cap: Size of @dst in bytes
+ *
+ * Return: -1 if @src is corrupted or if the decompressed data does not fit in
+ * @cap bytes. Otherwise the number of bytes written to @dst.
+ */
+int lz_decompress(const void *src, int len, void *dst, int cap);
+
+#endif /* _LZ_H */
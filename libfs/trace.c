@@ -0,0 +1,654 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fs.h"
+#include "trace.h"
+
+#define trace_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Low bits of an fd giving its slot in the descriptor table */
+#define FD_INDEX_MASK ((1 << 20) - 1)
+
+/* Functions of libfs.a, reached through the linker's --wrap option */
+int __real_fs_format(const char *diskname, unsigned int data_blocks,
+		     const struct fs_format_options *options);
+int __real_fs_mount(const char *diskname);
+int __real_fs_mount_flags(const char *diskname, int flags);
+int __real_fs_mount_budget(const char *diskname, int flags, size_t budget);
+int __real_fs_umount(void);
+int __real_fs_feature_enable(int features);
+int __real_fs_scrub(void);
+int __real_fs_sync(void);
+int __real_fs_info(void);
+int __real_fs_memory_usage(struct fs_memory *usage);
+int __real_fs_fragmentation(struct fs_fragmentation *frag);
+int __real_fs_create(const char *filename);
+int __real_fs_create_mode(const char *filename, int mode);
+int __real_fs_delete(const char *filename);
+int __real_fs_mkdir(const char *path);
+int __real_fs_rmdir(const char *path);
+int __real_fs_ls(void);
+int __real_fs_ls_dir(const char *path);
+int __real_fs_readdir(const char *path, unsigned int *pos,
+		      struct fs_dirent *entries, int max);
+int __real_fs_stat_many(const char **paths, int count, int *sizes);
+int __real_fs_open(const char *filename);
+int __real_fs_open_flags(const char *filename, int flags);
+int __real_fs_set_open_max(unsigned int max);
+int __real_fs_close(int fd);
+int __real_fs_stat(int fd);
+int __real_fs_lseek(int fd, size_t offset);
+int __real_fs_write(int fd, void *buf, size_t count);
+int __real_fs_read(int fd, void *buf, size_t count);
+int __real_fs_pread(int fd, void *buf, size_t count, size_t offset);
+int __real_fs_pwrite(int fd, const void *buf, size_t count, size_t offset);
+int __real_fs_readv(int fd, const struct iovec *iov, int iovcnt);
+int __real_fs_writev(int fd, const struct iovec *iov, int iovcnt);
+const void *__real_fs_mmap(int fd, size_t offset, size_t len);
+int __real_fs_munmap(const void *addr);
+int __real_fs_read_async(int fd, void *buf, size_t count,
+			 fs_callback_t callback, void *arg);
+int __real_fs_write_async(int fd, const void *buf, size_t count,
+			  fs_callback_t callback, void *arg);
+int __real_fs_async_fd(void);
+int __real_fs_async_reap(struct fs_completion *completions, int max);
+int __real_fs_fallocate(int fd, size_t size);
+int __real_fs_truncate(int fd, size_t size);
+int __real_fs_export(int fd, int host_fd);
+int __real_fs_import(int host_fd, int fd);
+
+/* Recorder state, guarded by lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int started;
+static FILE *out;
+static struct timespec origin;
+
+/* What is known of an fd */
+struct fd_state {
+	/* File offset */
+	uint32_t offset;
+	/* Opened with FS_OPEN_APPEND */
+	int append;
+};
+
+/* State of every fd, indexed by descriptor slot */
+static struct fd_state *fds;
+static size_t fds_len;
+
+static uint64_t elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000ULL +
+		to->tv_nsec - from->tv_nsec;
+}
+
+static void trace_close(void)
+{
+	pthread_mutex_lock(&lock);
+	if (out)
+		fclose(out);
+	out = NULL;
+	pthread_mutex_unlock(&lock);
+}
+
+/* Open the trace named by FS_TRACE on the first call, lock held */
+static void trace_start(void)
+{
+	struct fs_trace_header header = {
+		.magic = FS_TRACE_MAGIC,
+		.rec_size = sizeof(struct fs_trace_rec),
+	};
+	const char *path = getenv("FS_TRACE");
+
+	started = 1;
+	clock_gettime(CLOCK_MONOTONIC, &origin);
+	if (!path || !*path)
+		return;
+
+	out = fopen(path, "wb");
+	if (!out) {
+		perror("fopen");
+		return;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, out) != 1) {
+		trace_error("cannot write trace header");
+		fclose(out);
+		out = NULL;
+		return;
+	}
+
+	atexit(trace_close);
+}
+
+/* State slot of @fd, NULL if it cannot have one */
+static struct fd_state *state_of(int fd)
+{
+	size_t index = (size_t)fd & FD_INDEX_MASK;
+
+	if (fd < 0)
+		return NULL;
+
+	if (index >= fds_len) {
+		size_t len = fds_len ? fds_len : 64;
+		struct fd_state *grown;
+
+		while (len <= index)
+			len *= 2;
+		grown = realloc(fds, len * sizeof(*fds));
+		if (!grown)
+			return NULL;
+		memset(grown + fds_len, 0, (len - fds_len) * sizeof(*fds));
+		fds = grown;
+		fds_len = len;
+	}
+
+	return &fds[index];
+}
+
+/*
+ * Offset where a write on @fd lands, the end of the file if @fd was opened
+ * with FS_OPEN_APPEND, -1 for the offset of the fd
+ */
+static long append_offset(int fd)
+{
+	struct fd_state *state;
+	int append;
+
+	pthread_mutex_lock(&lock);
+	state = state_of(fd);
+	append = state && state->append;
+	pthread_mutex_unlock(&lock);
+
+	return append ? __real_fs_stat(fd) : -1;
+}
+
+/* Time at the start of a call */
+static struct timespec begin(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now;
+}
+
+/*
+ * Append the record of a call started at @start, made at file offset @at or at
+ * the offset of @fd if @at is -1. The offset of @fd is updated afterwards:
+ * @advance is added to it, or it is set to @seek unless @seek is -1.
+ */
+static void record_at(int op, struct timespec start, int fd, size_t size,
+		      int result, const char *name, long at, long advance,
+		      long seek)
+{
+	struct fs_trace_rec rec;
+	struct timespec end;
+	struct fd_state *state;
+	uint64_t took;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pthread_mutex_lock(&lock);
+	if (!started)
+		trace_start();
+
+	state = state_of(fd);
+	if (out) {
+		memset(&rec, 0, sizeof(rec));
+		took = elapsed(&start, &end);
+		rec.start = elapsed(&origin, &start);
+		rec.duration = took > UINT32_MAX ? UINT32_MAX : took;
+		rec.offset = at != -1 ? at : state ? state->offset : 0;
+		rec.size = size;
+		rec.fd = fd;
+		rec.result = result;
+		rec.op = op;
+		rec.name_len = name ? strnlen(name, UINT8_MAX) : 0;
+
+		if (fwrite(&rec, sizeof(rec), 1, out) != 1 ||
+		    fwrite(name, 1, rec.name_len, out) != rec.name_len) {
+			trace_error("cannot write trace, tracing stops");
+			fclose(out);
+			out = NULL;
+		}
+	}
+
+	if (state && seek != -1)
+		state->offset = seek;
+	else if (state && advance > 0)
+		state->offset += advance;
+
+	/* A new fd starts at offset 0, @size holds its open flags */
+	if (op == FS_TRACE_OPEN && (state = state_of(result))) {
+		state->offset = 0;
+		state->append = (size & FS_OPEN_APPEND) != 0;
+	}
+
+	if (op == FS_TRACE_UMOUNT && out)
+		fflush(out);
+	pthread_mutex_unlock(&lock);
+}
+
+static void record(int op, struct timespec start, int fd, size_t size,
+		   int result, const char *name, long advance, long seek)
+{
+	record_at(op, start, fd, size, result, name, -1, advance, seek);
+}
+
+/* Total length of @iovcnt buffers */
+static size_t iov_length(const struct iovec *iov, int iovcnt)
+{
+	size_t total = 0;
+
+	for (int i = 0; iov && i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	return total;
+}
+
+int __wrap_fs_format(const char *diskname, unsigned int data_blocks,
+		     const struct fs_format_options *options)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_format(diskname, data_blocks, options);
+
+	record_at(FS_TRACE_FORMAT, start, -1, data_blocks, ret, diskname,
+		  options ? options->block_size : 0, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_mount(const char *diskname)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_mount(diskname);
+
+	record(FS_TRACE_MOUNT, start, -1, 0, ret, diskname, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_mount_flags(const char *diskname, int flags)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_mount_flags(diskname, flags);
+
+	record(FS_TRACE_MOUNT, start, -1, flags, ret, diskname, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_mount_budget(const char *diskname, int flags, size_t budget)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_mount_budget(diskname, flags, budget);
+
+	record(FS_TRACE_MOUNT_BUDGET, start, -1,
+	       budget > UINT32_MAX ? UINT32_MAX : budget, ret, diskname, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_umount(void)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_umount();
+
+	record(FS_TRACE_UMOUNT, start, -1, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_feature_enable(int features)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_feature_enable(features);
+
+	record(FS_TRACE_FEATURE, start, -1, features, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_scrub(void)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_scrub();
+
+	record(FS_TRACE_SCRUB, start, -1, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_sync(void)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_sync();
+
+	record(FS_TRACE_SYNC, start, -1, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_info(void)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_info();
+
+	record(FS_TRACE_INFO, start, -1, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_memory_usage(struct fs_memory *usage)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_memory_usage(usage);
+
+	record(FS_TRACE_MEMORY, start, -1, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_fragmentation(struct fs_fragmentation *frag)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_fragmentation(frag);
+
+	record(FS_TRACE_FRAG, start, -1, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_create(const char *filename)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_create(filename);
+
+	record(FS_TRACE_CREATE, start, -1, 0, ret, filename, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_create_mode(const char *filename, int mode)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_create_mode(filename, mode);
+
+	record(FS_TRACE_CREATE, start, -1, mode, ret, filename, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_delete(const char *filename)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_delete(filename);
+
+	record(FS_TRACE_DELETE, start, -1, 0, ret, filename, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_mkdir(const char *path)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_mkdir(path);
+
+	record(FS_TRACE_MKDIR, start, -1, 0, ret, path, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_rmdir(const char *path)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_rmdir(path);
+
+	record(FS_TRACE_RMDIR, start, -1, 0, ret, path, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_ls(void)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_ls();
+
+	record(FS_TRACE_LS, start, -1, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_ls_dir(const char *path)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_ls_dir(path);
+
+	record(FS_TRACE_LS_DIR, start, -1, 0, ret, path, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_readdir(const char *path, unsigned int *pos,
+		      struct fs_dirent *entries, int max)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_readdir(path, pos, entries, max);
+
+	record(FS_TRACE_READDIR, start, -1, max, ret, path, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_stat_many(const char **paths, int count, int *sizes)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_stat_many(paths, count, sizes);
+
+	record(FS_TRACE_STAT_MANY, start, -1, count, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_open(const char *filename)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_open(filename);
+
+	record(FS_TRACE_OPEN, start, -1, 0, ret, filename, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_open_flags(const char *filename, int flags)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_open_flags(filename, flags);
+
+	record(FS_TRACE_OPEN, start, -1, flags, ret, filename, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_set_open_max(unsigned int max)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_set_open_max(max);
+
+	record(FS_TRACE_OPEN_MAX, start, -1, max, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_close(int fd)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_close(fd);
+
+	record(FS_TRACE_CLOSE, start, fd, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_stat(int fd)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_stat(fd);
+
+	record(FS_TRACE_STAT, start, fd, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_lseek(int fd, size_t offset)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_lseek(fd, offset);
+
+	record(FS_TRACE_LSEEK, start, fd, offset, ret, NULL, 0,
+	       ret == 0 ? (long)offset : -1);
+	return ret;
+}
+
+int __wrap_fs_write(int fd, void *buf, size_t count)
+{
+	struct timespec start = begin();
+	long at = append_offset(fd);
+	int ret = __real_fs_write(fd, buf, count);
+
+	record_at(FS_TRACE_WRITE, start, fd, count, ret, NULL, at, ret,
+		  at != -1 ? at + (ret > 0 ? ret : 0) : -1);
+	return ret;
+}
+
+int __wrap_fs_read(int fd, void *buf, size_t count)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_read(fd, buf, count);
+
+	record(FS_TRACE_READ, start, fd, count, ret, NULL, ret, -1);
+	return ret;
+}
+
+int __wrap_fs_pread(int fd, void *buf, size_t count, size_t offset)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_pread(fd, buf, count, offset);
+
+	record_at(FS_TRACE_PREAD, start, fd, count, ret, NULL, offset, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_pwrite(int fd, const void *buf, size_t count, size_t offset)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_pwrite(fd, buf, count, offset);
+
+	record_at(FS_TRACE_PWRITE, start, fd, count, ret, NULL, offset, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_readv(fd, iov, iovcnt);
+
+	record(FS_TRACE_READV, start, fd, iov_length(iov, iovcnt), ret, NULL,
+	       ret, -1);
+	return ret;
+}
+
+int __wrap_fs_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct timespec start = begin();
+	long at = append_offset(fd);
+	int ret = __real_fs_writev(fd, iov, iovcnt);
+
+	record_at(FS_TRACE_WRITEV, start, fd, iov_length(iov, iovcnt), ret,
+		  NULL, at, ret, at != -1 ? at + (ret > 0 ? ret : 0) : -1);
+	return ret;
+}
+
+const void *__wrap_fs_mmap(int fd, size_t offset, size_t len)
+{
+	struct timespec start = begin();
+	const void *ret = __real_fs_mmap(fd, offset, len);
+
+	record_at(FS_TRACE_MMAP, start, fd, len, ret ? 0 : -1, NULL, offset,
+		  0, -1);
+	return ret;
+}
+
+int __wrap_fs_munmap(const void *addr)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_munmap(addr);
+
+	record(FS_TRACE_MUNMAP, start, -1, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_read_async(int fd, void *buf, size_t count,
+			 fs_callback_t callback, void *arg)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_read_async(fd, buf, count, callback, arg);
+
+	/* The offset moves at submission */
+	record(FS_TRACE_READ_ASYNC, start, fd, count, ret, NULL,
+	       ret == 0 ? (long)count : 0, -1);
+	return ret;
+}
+
+int __wrap_fs_write_async(int fd, const void *buf, size_t count,
+			  fs_callback_t callback, void *arg)
+{
+	struct timespec start = begin();
+	long at = append_offset(fd);
+	int ret = __real_fs_write_async(fd, buf, count, callback, arg);
+
+	record_at(FS_TRACE_WRITE_ASYNC, start, fd, count, ret, NULL, at,
+		  ret == 0 ? (long)count : 0,
+		  at != -1 && ret == 0 ? at + (long)count : -1);
+	return ret;
+}
+
+int __wrap_fs_async_fd(void)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_async_fd();
+
+	record(FS_TRACE_ASYNC_FD, start, -1, 0, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_async_reap(struct fs_completion *completions, int max)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_async_reap(completions, max);
+
+	record(FS_TRACE_ASYNC_REAP, start, -1, max, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_fallocate(int fd, size_t size)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_fallocate(fd, size);
+
+	record(FS_TRACE_FALLOCATE, start, fd, size, ret, NULL, 0, -1);
+	return ret;
+}
+
+int __wrap_fs_truncate(int fd, size_t size)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_truncate(fd, size);
+	struct fd_state *state;
+	long seek = -1;
+
+	/* Truncating below the offset of the fd pulls it back */
+	pthread_mutex_lock(&lock);
+	state = state_of(fd);
+	if (ret == 0 && state && state->offset > size)
+		seek = size;
+	pthread_mutex_unlock(&lock);
+
+	record(FS_TRACE_TRUNCATE, start, fd, size, ret, NULL, 0, seek);
+	return ret;
+}
+
+int __wrap_fs_export(int fd, int host_fd)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_export(fd, host_fd);
+
+	record(FS_TRACE_EXPORT, start, fd, 0, ret, NULL, ret, -1);
+	return ret;
+}
+
+int __wrap_fs_import(int host_fd, int fd)
+{
+	struct timespec start = begin();
+	int ret = __real_fs_import(host_fd, fd);
+
+	record(FS_TRACE_IMPORT, start, fd, 0, ret, NULL, ret, -1);
+	return ret;
+}
@@ -0,0 +1,99 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h> /* for uint32_t definition */
+
+/*
+ * Call tracing layer over the fs.h API, built as libfstrace.a. A program is
+ * traced by linking it with the options listed in trace.wrap ahead of
+ * libfstrace.a and libfs.a: every fs_*() call then goes through a wrapper that
+ * forwards it to libfs.a and, when environment variable FS_TRACE names a file,
+ * appends one record per call to that file. The trace is flushed at every
+ * fs_umount() and when the program exits.
+ *
+ * A trace is a struct fs_trace_header followed by struct fs_trace_rec records
+ * in call order, each followed by the @name_len bytes of the path it was given
+ * (without the NULL character), if any.
+ */
+
+/** Signature at the start of a trace */
+#define FS_TRACE_MAGIC "FSTRACE1"
+
+/** Traced calls */
+enum fs_trace_op {
+	FS_TRACE_MOUNT,
+	FS_TRACE_UMOUNT,
+	FS_TRACE_FEATURE,
+	FS_TRACE_SCRUB,
+	FS_TRACE_INFO,
+	FS_TRACE_CREATE,
+	FS_TRACE_DELETE,
+	FS_TRACE_MKDIR,
+	FS_TRACE_RMDIR,
+	FS_TRACE_LS,
+	FS_TRACE_LS_DIR,
+	FS_TRACE_READDIR,
+	FS_TRACE_STAT_MANY,
+	FS_TRACE_OPEN,
+	FS_TRACE_OPEN_MAX,
+	FS_TRACE_CLOSE,
+	FS_TRACE_STAT,
+	FS_TRACE_LSEEK,
+	FS_TRACE_WRITE,
+	FS_TRACE_READ,
+	FS_TRACE_READ_ASYNC,
+	FS_TRACE_WRITE_ASYNC,
+	FS_TRACE_ASYNC_FD,
+	FS_TRACE_ASYNC_REAP,
+	FS_TRACE_FALLOCATE,
+	FS_TRACE_TRUNCATE,
+	FS_TRACE_EXPORT,
+	FS_TRACE_IMPORT,
+	/* Budget in size, saturated */
+	FS_TRACE_MOUNT_BUDGET,
+	FS_TRACE_MEMORY,
+	/* Offset given to the call in offset */
+	FS_TRACE_PREAD,
+	FS_TRACE_PWRITE,
+	/* Total of the buffers in size */
+	FS_TRACE_READV,
+	FS_TRACE_WRITEV,
+	/* Data blocks in size, block size (0 for the default) in offset */
+	FS_TRACE_FORMAT,
+	FS_TRACE_SYNC,
+	/* Offset given to the call in offset, result 0 if it mapped the range */
+	FS_TRACE_MMAP,
+	FS_TRACE_MUNMAP,
+	FS_TRACE_FRAG,
+	FS_TRACE_OPS,
+};
+
+struct __attribute__((__packed__)) fs_trace_header {
+	/* FS_TRACE_MAGIC, without the NULL character */
+	char magic[8];
+	/* Size of struct fs_trace_rec */
+	uint32_t rec_size;
+	uint32_t padding;
+};
+
+struct __attribute__((__packed__)) fs_trace_rec {
+	/* Start of the call, in nanoseconds since the first traced call */
+	uint64_t start;
+	/* Duration of the call in nanoseconds, saturated */
+	uint32_t duration;
+	/* File offset of @fd before the call, as seen through the traced calls */
+	uint32_t offset;
+	/* Byte count, size, offset, mode, flags or features of the call */
+	uint32_t size;
+	/* File descriptor the call was made on, -1 if none */
+	int32_t fd;
+	/* Return value of the call */
+	int32_t result;
+	/* One of enum fs_trace_op */
+	uint8_t op;
+	/* Bytes of path following the record */
+	uint8_t name_len;
+	uint16_t padding;
+};
+
+#endif /* _TRACE_H */
@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <crc.h>
+#include <disk.h>
+#include <fs.h>
+
+#define die(...)				\
+do {							\
+	fprintf(stderr, __VA_ARGS__);	\
+	fprintf(stderr, "\n");		\
+	exit(1);					\
+} while (0)
+
+/* Size of the buffer handed to each fs_read()/fs_write() call */
+#define IO_SIZE (64 * BLOCK_SIZE_DEFAULT)
+
+/* Largest file of the block size comparison, 1 KiB blocks hold 64 MiB */
+#define SWEEP_MAX (32 * 1024 * 1024)
+
+/* Small files written by the block size comparison, and their size */
+#define SMALL_FILES 100
+#define SMALL_SIZE 3000
+
+/* Random reads done by the block size comparison, and their size */
+#define RANDOM_READS 8192
+#define RANDOM_SIZE 4096
+
+/* Size of the writes of the write-back comparison */
+#define WB_WRITE_SIZE 4096
+
+/* Number of blocks checksummed by the checksum benchmark */
+#define CRC_BLOCKS 65536
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double mib_per_sec(size_t bytes, double secs)
+{
+	return bytes / (1024.0 * 1024.0) / secs;
+}
+
+static void bench_crc(void)
+{
+	char *block = malloc(BLOCK_SIZE);
+	uint32_t sum = 0;
+	double start;
+
+	for (int i = 0; i < BLOCK_SIZE; i++)
+		block[i] = rand();
+
+	start = now();
+	for (int i = 0; i < CRC_BLOCKS; i++)
+		sum ^= crc32c_sw(0, block, BLOCK_SIZE);
+	printf("crc32c software:  %8.1f MiB/s\n",
+	       mib_per_sec((size_t)CRC_BLOCKS * BLOCK_SIZE, now() - start));
+
+	start = now();
+	for (int i = 0; i < CRC_BLOCKS; i++)
+		sum ^= crc32c(0, block, BLOCK_SIZE);
+	printf("crc32c %s:  %8.1f MiB/s\n",
+	       crc32c_hw_available() ? "hardware" : "software",
+	       mib_per_sec((size_t)CRC_BLOCKS * BLOCK_SIZE, now() - start));
+
+	/* Keeps the loops from being optimized away */
+	if (sum == 0x12345678)
+		printf("\n");
+	free(block);
+}
+
+/* Write then read back a file of @size bytes, reporting both throughputs */
+static void bench_io(const char *diskname, const char *label, size_t size)
+{
+	char *buf = malloc(IO_SIZE);
+	size_t done;
+	double start;
+	int fd;
+
+	memset(buf, 'x', IO_SIZE);
+
+	if (fs_mount(diskname))
+		die("Cannot mount %s", diskname);
+	if (fs_create("bench") || (fd = fs_open("bench")) < 0)
+		die("Cannot create bench file");
+
+	start = now();
+	for (done = 0; done < size; done += IO_SIZE)
+		if (fs_write(fd, buf, IO_SIZE) != IO_SIZE)
+			die("Short write");
+	fs_close(fd);
+	if (fs_umount())
+		die("Cannot unmount %s", diskname);
+	printf("%s write: %8.1f MiB/s\n", label,
+	       mib_per_sec(size, now() - start));
+
+	if (fs_mount(diskname) || (fd = fs_open("bench")) < 0)
+		die("Cannot reopen bench file");
+
+	start = now();
+	for (done = 0; done < size; done += IO_SIZE)
+		if (fs_read(fd, buf, IO_SIZE) != IO_SIZE)
+			die("Short read");
+	printf("%s read:  %8.1f MiB/s\n", label,
+	       mib_per_sec(size, now() - start));
+
+	fs_close(fd);
+	fs_delete("bench");
+	if (fs_umount())
+		die("Cannot unmount %s", diskname);
+	free(buf);
+}
+
+/* Read @RANDOM_SIZE bytes at random aligned offsets of a @size bytes file */
+static void bench_random(const char *diskname, const char *label, size_t size)
+{
+	char *buf = calloc(1, IO_SIZE);
+	unsigned int seed = 1;
+	size_t done;
+	double start;
+	int fd;
+
+	if (fs_mount(diskname) || fs_create("random") ||
+	    (fd = fs_open("random")) < 0)
+		die("Cannot create random file");
+	for (done = 0; done < size; done += IO_SIZE)
+		if (fs_write(fd, buf, IO_SIZE) != IO_SIZE)
+			die("Short write");
+
+	start = now();
+	for (int i = 0; i < RANDOM_READS; i++) {
+		seed = seed * 1103515245 + 12345;
+		if (fs_pread(fd, buf, RANDOM_SIZE,
+			     (seed % (size / RANDOM_SIZE)) * RANDOM_SIZE) !=
+		    RANDOM_SIZE)
+			die("Short random read");
+	}
+	printf("%s random: %8.1f MiB/s\n", label,
+	       mib_per_sec((size_t)RANDOM_READS * RANDOM_SIZE,
+			   now() - start));
+
+	fs_close(fd);
+	fs_delete("random");
+	if (fs_umount())
+		die("Cannot unmount %s", diskname);
+	free(buf);
+}
+
+/* Create, write and flush @SMALL_FILES files of @SMALL_SIZE bytes */
+static void bench_small(const char *diskname, const char *label)
+{
+	char buf[SMALL_SIZE];
+	char name[FS_FILENAME_LEN];
+	double start;
+	int fd;
+
+	memset(buf, 'x', sizeof(buf));
+
+	start = now();
+	if (fs_mount(diskname))
+		die("Cannot mount %s", diskname);
+	for (int i = 0; i < SMALL_FILES; i++) {
+		snprintf(name, sizeof(name), "small%d", i);
+		if (fs_create(name) || (fd = fs_open(name)) < 0 ||
+		    fs_write(fd, buf, sizeof(buf)) != sizeof(buf))
+			die("Cannot write %s", name);
+		fs_close(fd);
+	}
+	if (fs_umount())
+		die("Cannot unmount %s", diskname);
+	printf("%s small:  %8.1f files/ms\n", label,
+	       SMALL_FILES / ((now() - start) * 1000));
+}
+
+/* Run each workload on disks of every block size */
+static void bench_block_sizes(const char *diskname, size_t size)
+{
+	static const size_t sizes[] = { 1024, 4096, 16384, 65536 };
+	char path[256], label[32];
+
+	if (size > SWEEP_MAX)
+		size = SWEEP_MAX;
+	snprintf(path, sizeof(path), "%s.bs", diskname);
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		struct fs_format_options options = { .block_size = sizes[i] };
+
+		/* The file, plus a block per small file and a few spare */
+		if (fs_format(path, size / sizes[i] + SMALL_FILES + 64,
+			      &options))
+			die("Cannot format %s", path);
+
+		snprintf(label, sizeof(label), "%2zuK blocks", sizes[i] / 1024);
+		bench_io(path, label, size);
+		bench_random(path, label, size);
+		bench_small(path, label);
+	}
+
+	remove(path);
+}
+
+/* Write a @size bytes file in small writes, then unmount, with @flags */
+static void bench_writeback(const char *diskname, const char *label,
+			    size_t size, int flags)
+{
+	struct block_writeback_stats stats = { 0 };
+	char *buf = malloc(WB_WRITE_SIZE);
+	double start, written;
+	size_t done;
+	int fd;
+
+	memset(buf, 'x', WB_WRITE_SIZE);
+
+	/* Extents keep the block lookup of each write short */
+	if (fs_mount_flags(diskname, flags) ||
+	    fs_create_mode("wb", FS_MODE_EXTENT) ||
+	    (fd = fs_open("wb")) < 0)
+		die("Cannot create write-back file");
+
+	start = now();
+	for (done = 0; done < size; done += WB_WRITE_SIZE)
+		if (fs_write(fd, buf, WB_WRITE_SIZE) != WB_WRITE_SIZE)
+			die("Short write");
+	written = now() - start;
+	fs_close(fd);
+	if (fs_sync())
+		die("Cannot sync %s", diskname);
+	if (flags & FS_MOUNT_WRITEBACK)
+		block_writeback_stats(&stats);
+	if (fs_umount())
+		die("Cannot unmount %s", diskname);
+
+	printf("%s: %6.2f us/write, %8.1f MiB/s to disk",
+	       label, written * 1e6 / (size / WB_WRITE_SIZE),
+	       mib_per_sec(size, now() - start));
+	if (stats.writes)
+		printf(", %zu blocks in %zu writes",
+		       stats.blocks, stats.writes);
+	printf("\n");
+
+	if (fs_mount(diskname) || fs_delete("wb") || fs_umount())
+		die("Cannot delete write-back file");
+	free(buf);
+}
+
+/* Checksum a @size bytes file read with fs_pread(), then through fs_mmap() */
+static void bench_mmap(const char *diskname, size_t size)
+{
+	char *buf = calloc(1, IO_SIZE), *copy = malloc(size);
+	uint32_t sums[2];
+	const char *map;
+	double start, took[2];
+	size_t done;
+	int fd;
+
+	if (fs_mount(diskname) || fs_create("map") ||
+	    (fd = fs_open("map")) < 0)
+		die("Cannot create mapped file");
+	for (done = 0; done < size; done += IO_SIZE)
+		if (fs_write(fd, buf, IO_SIZE) != IO_SIZE)
+			die("Short write");
+
+	start = now();
+	if (fs_pread(fd, copy, size, 0) != (int)size)
+		die("Short read");
+	sums[0] = crc32c(0, copy, size);
+	took[0] = now() - start;
+
+	start = now();
+	map = fs_mmap(fd, 0, size);
+	if (!map)
+		die("Cannot map file");
+	sums[1] = crc32c(0, map, size);
+	fs_munmap(map);
+	took[1] = now() - start;
+
+	if (sums[0] != sums[1])
+		die("Mapping doesn't match");
+	printf("pread and parse: %8.1f MiB/s\n", mib_per_sec(size, took[0]));
+	printf("mmap and parse:  %8.1f MiB/s\n", mib_per_sec(size, took[1]));
+
+	fs_close(fd);
+	fs_delete("map");
+	if (fs_umount())
+		die("Cannot unmount %s", diskname);
+	free(copy);
+	free(buf);
+}
+
+/* Time fs_delete() of a @size bytes file, then the reclaim fs_sync() waits for */
+static void bench_delete(const char *diskname, const char *label,
+			 size_t size, int flags)
+{
+	char *buf = calloc(1, IO_SIZE);
+	double start, deleted;
+	size_t done;
+	int fd;
+
+	if (fs_mount_flags(diskname, flags) || fs_create("doomed") ||
+	    (fd = fs_open("doomed")) < 0)
+		die("Cannot create deleted file");
+	for (done = 0; done < size; done += IO_SIZE)
+		if (fs_write(fd, buf, IO_SIZE) != IO_SIZE)
+			die("Short write");
+	fs_close(fd);
+	if (fs_sync())
+		die("Cannot sync %s", diskname);
+
+	start = now();
+	if (fs_delete("doomed"))
+		die("Cannot delete file");
+	deleted = now() - start;
+	if (fs_sync())
+		die("Cannot sync %s", diskname);
+	printf("%s delete: %8.1f us, %8.1f us until reclaimed\n", label,
+	       deleted * 1e6, (now() - start) * 1e6);
+
+	if (fs_umount())
+		die("Cannot unmount %s", diskname);
+	free(buf);
+}
+
+/*
+ * Append to a file 4 KiB at a time through a descriptor opened with
+ * FS_OPEN_APPEND, timing the first and the last quarter of the appends
+ */
+static void bench_append(const char *diskname, size_t size)
+{
+	char *buf = calloc(1, WB_WRITE_SIZE);
+	size_t appends = size / WB_WRITE_SIZE, quarter = appends / 4;
+	double start, first = 0, last = 0;
+	int fd;
+
+	if (fs_mount(diskname) || fs_create("log") ||
+	    (fd = fs_open_flags("log", FS_OPEN_APPEND)) < 0)
+		die("Cannot create appended file");
+
+	for (size_t i = 0; i < appends; i++) {
+		/* Another descriptor leaves the offset anywhere */
+		fs_lseek(fd, 0);
+		start = now();
+		if (fs_write(fd, buf, WB_WRITE_SIZE) != WB_WRITE_SIZE)
+			die("Short append");
+		if (i < quarter)
+			first += now() - start;
+		else if (i >= appends - quarter)
+			last += now() - start;
+	}
+	printf("append: %6.2f us first quarter, %6.2f us last quarter\n",
+	       first * 1e6 / quarter, last * 1e6 / quarter);
+
+	fs_close(fd);
+	fs_delete("log");
+	if (fs_umount())
+		die("Cannot unmount %s", diskname);
+	free(buf);
+}
+
+/*
+ * Read a @size bytes file @IO_SIZE bytes at a time, then with a single
+ * fs_pread() split into block runs read concurrently
+ */
+static void bench_large_read(const char *diskname, const char *label,
+			     size_t size, int flags)
+{
+	char *buf = calloc(1, size);
+	double start, took[2];
+	size_t done;
+	int fd;
+
+	if (fs_mount(diskname) || fs_create("large") ||
+	    (fd = fs_open("large")) < 0)
+		die("Cannot create large file");
+	if (fs_write(fd, buf, size) != (int)size)
+		die("Short write");
+	fs_close(fd);
+	if (fs_umount())
+		die("Cannot unmount %s", diskname);
+
+	if (fs_mount_flags(diskname, flags) || (fd = fs_open("large")) < 0)
+		die("Cannot reopen large file");
+
+	start = now();
+	for (done = 0; done < size; done += IO_SIZE)
+		if (fs_pread(fd, buf + done, IO_SIZE, done) != IO_SIZE)
+			die("Short read");
+	took[0] = now() - start;
+
+	start = now();
+	if (fs_pread(fd, buf, size, 0) != (int)size)
+		die("Short read");
+	took[1] = now() - start;
+
+	printf("%s %3zu KiB reads: %8.1f MiB/s\n", label,
+	       (size_t)IO_SIZE / 1024, mib_per_sec(size, took[0]));
+	printf("%s one read:     %8.1f MiB/s\n", label,
+	       mib_per_sec(size, took[1]));
+
+	fs_close(fd);
+	fs_delete("large");
+	if (fs_umount())
+		die("Cannot unmount %s", diskname);
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	size_t size;
+	double start;
+	int bad;
+
+	if (argc < 3)
+		die("Usage: %s <diskname> <MiB>\n"
+		    "Benchmarks block checksums on a fresh virtual disk, then\n"
+		    "block sizes on disks made next to it.",
+		    argv[0]);
+
+	size = strtoul(argv[2], NULL, 0) * 1024 * 1024;
+	size -= size % IO_SIZE;
+
+	bench_crc();
+	bench_io(argv[1], "unchecked  ", size);
+
+	if (fs_mount(argv[1]) || fs_feature_enable(FS_FEATURE_CSUM) ||
+	    fs_umount())
+		die("Cannot enable checksums on %s", argv[1]);
+	bench_io(argv[1], "checksummed", size);
+
+	if (fs_mount(argv[1]))
+		die("Cannot mount %s", argv[1]);
+	start = now();
+	bad = fs_scrub();
+	printf("scrub: %d corrupted blocks in %.3f s\n", bad, now() - start);
+	fs_umount();
+
+	bench_writeback(argv[1], "cached write-through", size, 0);
+	bench_writeback(argv[1], "cached write-back   ", size,
+			FS_MOUNT_WRITEBACK);
+	bench_writeback(argv[1], "direct write-through", size,
+			FS_MOUNT_DIRECT);
+	bench_writeback(argv[1], "direct write-back   ", size,
+			FS_MOUNT_DIRECT | FS_MOUNT_WRITEBACK);
+
+	bench_mmap(argv[1], size);
+
+	bench_large_read(argv[1], "cached", size, 0);
+	bench_large_read(argv[1], "direct", size, FS_MOUNT_DIRECT);
+
+	bench_append(argv[1], size);
+
+	bench_delete(argv[1], "plain  ", size, 0);
+	bench_delete(argv[1], "punched", size, FS_MOUNT_PUNCH);
+
+	bench_block_sizes(argv[1], size);
+
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define die(...)				\
+do {							\
+	fprintf(stderr, __VA_ARGS__);	\
+	fprintf(stderr, "\n");		\
+	exit(1);					\
+} while (0)
+
+static void usage(const char *program)
+{
+	die("Usage: %s [-a] [-b <block size>] [-n <files> [-p <prefix>]] "
+	    "<diskname> <data block count>\n"
+	    "Creates a virtual disk holding an empty file system.\n"
+	    "\t-a\treserve the space of the disk instead of leaving it sparse\n"
+	    "\t-b\tblock size in bytes, from 1024 to 65536 (default 4096)\n"
+	    "\t-n\tnumber of empty files to create in the root directory\n"
+	    "\t-p\tname of the created files, followed by their number "
+	    "(default \"file\")",
+	    program);
+}
+
+int main(int argc, char **argv)
+{
+	struct fs_format_options options = { 0 };
+	unsigned long data_blocks;
+	char *end;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ab:n:p:")) != -1) {
+		switch (opt) {
+		case 'a':
+			options.flags |= FS_FORMAT_ALLOCATE;
+			break;
+		case 'b':
+			options.block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			options.files = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			options.prefix = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (argc - optind != 2)
+		usage(argv[0]);
+
+	data_blocks = strtoul(argv[optind + 1], &end, 0);
+	if (*end != '\0' || data_blocks > UINT16_MAX)
+		die("Invalid data block count '%s'", argv[optind + 1]);
+
+	if (fs_format(argv[optind], data_blocks, &options))
+		die("Cannot create virtual disk '%s'", argv[optind]);
+
+	printf("Created virtual disk '%s' with '%lu' data blocks\n",
+	       argv[optind], data_blocks);
+
+	return 0;
+}
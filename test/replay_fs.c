@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fs.h>
+#include <trace.h>
+
+#define die(...)				\
+do {							\
+	fprintf(stderr, __VA_ARGS__);	\
+	fprintf(stderr, "\n");		\
+	exit(1);					\
+} while (0)
+
+/* Low bits of an fd giving its slot in the descriptor table */
+#define FD_INDEX_MASK ((1 << 20) - 1)
+
+static const char *op_names[FS_TRACE_OPS] = {
+	[FS_TRACE_MOUNT] = "mount",
+	[FS_TRACE_UMOUNT] = "umount",
+	[FS_TRACE_FEATURE] = "feature",
+	[FS_TRACE_SCRUB] = "scrub",
+	[FS_TRACE_INFO] = "info",
+	[FS_TRACE_CREATE] = "create",
+	[FS_TRACE_DELETE] = "delete",
+	[FS_TRACE_MKDIR] = "mkdir",
+	[FS_TRACE_RMDIR] = "rmdir",
+	[FS_TRACE_LS] = "ls",
+	[FS_TRACE_LS_DIR] = "ls_dir",
+	[FS_TRACE_READDIR] = "readdir",
+	[FS_TRACE_STAT_MANY] = "stat_many",
+	[FS_TRACE_OPEN] = "open",
+	[FS_TRACE_OPEN_MAX] = "open_max",
+	[FS_TRACE_CLOSE] = "close",
+	[FS_TRACE_STAT] = "stat",
+	[FS_TRACE_LSEEK] = "lseek",
+	[FS_TRACE_WRITE] = "write",
+	[FS_TRACE_READ] = "read",
+	[FS_TRACE_READ_ASYNC] = "read_async",
+	[FS_TRACE_WRITE_ASYNC] = "write_async",
+	[FS_TRACE_ASYNC_FD] = "async_fd",
+	[FS_TRACE_ASYNC_REAP] = "async_reap",
+	[FS_TRACE_FALLOCATE] = "fallocate",
+	[FS_TRACE_TRUNCATE] = "truncate",
+	[FS_TRACE_EXPORT] = "export",
+	[FS_TRACE_IMPORT] = "import",
+	[FS_TRACE_MOUNT_BUDGET] = "mount_budget",
+	[FS_TRACE_MEMORY] = "memory",
+	[FS_TRACE_PREAD] = "pread",
+	[FS_TRACE_PWRITE] = "pwrite",
+	[FS_TRACE_READV] = "readv",
+	[FS_TRACE_WRITEV] = "writev",
+	[FS_TRACE_FORMAT] = "format",
+	[FS_TRACE_SYNC] = "sync",
+	[FS_TRACE_MMAP] = "mmap",
+	[FS_TRACE_MUNMAP] = "munmap",
+	[FS_TRACE_FRAG] = "fragmentation",
+};
+
+/* Latencies and bytes moved by the replayed calls of one op */
+struct op_stats {
+	double *lat;
+	size_t count;
+	size_t cap;
+	size_t bytes;
+};
+
+static struct op_stats stats[FS_TRACE_OPS];
+
+/* Replayed fd of every recorded fd, indexed by descriptor slot */
+static int *fds;
+static size_t fds_len;
+
+/* Buffer for the data of reads and writes */
+static char *buf;
+static size_t buf_len;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int *fd_slot(int fd)
+{
+	size_t index = (size_t)fd & FD_INDEX_MASK;
+
+	if (fd < 0)
+		return NULL;
+
+	if (index >= fds_len) {
+		size_t len = fds_len ? fds_len : 64;
+
+		while (len <= index)
+			len *= 2;
+		fds = realloc(fds, len * sizeof(*fds));
+		if (!fds)
+			die("Cannot grow fd table");
+		for (size_t i = fds_len; i < len; i++)
+			fds[i] = -1;
+		fds_len = len;
+	}
+
+	return &fds[index];
+}
+
+/* Replayed fd of recorded @fd, -1 if it was never opened */
+static int fd_map(int fd)
+{
+	int *slot = fd_slot(fd);
+
+	return slot ? *slot : -1;
+}
+
+/* Buffer of at least @size bytes, filled with a pattern */
+static char *data(size_t size)
+{
+	if (size > buf_len) {
+		buf = realloc(buf, size);
+		if (!buf)
+			die("Cannot allocate %zu bytes", size);
+		for (size_t i = buf_len; i < size; i++)
+			buf[i] = 'a' + i % 26;
+		buf_len = size;
+	}
+
+	return buf;
+}
+
+static void stats_add(int op, double lat, size_t bytes)
+{
+	struct op_stats *s = &stats[op];
+
+	if (s->count == s->cap) {
+		s->cap = s->cap ? 2 * s->cap : 64;
+		s->lat = realloc(s->lat, s->cap * sizeof(*s->lat));
+		if (!s->lat)
+			die("Cannot grow latency table");
+	}
+
+	s->lat[s->count++] = lat;
+	s->bytes += bytes;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Latency at @pct percent of the sorted latencies of @s */
+static double percentile(struct op_stats *s, int pct)
+{
+	size_t i = (s->count * pct + 99) / 100;
+
+	return s->lat[i ? i - 1 : 0];
+}
+
+/*
+ * Replay one record on @diskname, returning the result of the replayed call.
+ * Reads and writes first seek to the recorded offset, outside of the timing,
+ * so that they move the same bytes whatever happened to the fd in between.
+ * Asynchronous and vectored calls, exports and imports are replayed as plain
+ * reads and writes of the same size.
+ */
+static int replay(const struct fs_trace_rec *rec, const char *name,
+		  const char *diskname, double *lat, size_t *bytes)
+{
+	int fd = fd_map(rec->fd);
+	size_t count = rec->size;
+	struct fs_fragmentation frag;
+	const void *map;
+	double start;
+	int ret;
+
+	switch (rec->op) {
+	case FS_TRACE_READ:
+	case FS_TRACE_WRITE:
+	case FS_TRACE_READ_ASYNC:
+	case FS_TRACE_WRITE_ASYNC:
+	case FS_TRACE_EXPORT:
+	case FS_TRACE_IMPORT:
+	case FS_TRACE_READV:
+	case FS_TRACE_WRITEV:
+		fs_lseek(fd, rec->offset);
+		if (rec->op == FS_TRACE_EXPORT || rec->op == FS_TRACE_IMPORT)
+			count = rec->result > 0 ? rec->result : 0;
+		break;
+	}
+
+	start = now();
+	switch (rec->op) {
+	case FS_TRACE_MOUNT:
+		ret = rec->size ? fs_mount_flags(diskname, rec->size) :
+			fs_mount(diskname);
+		break;
+	case FS_TRACE_MOUNT_BUDGET:
+		ret = fs_mount_budget(diskname, 0, rec->size);
+		break;
+	case FS_TRACE_UMOUNT:
+		ret = fs_umount();
+		break;
+	case FS_TRACE_FEATURE:
+		ret = fs_feature_enable(rec->size);
+		break;
+	case FS_TRACE_SCRUB:
+		ret = fs_scrub();
+		break;
+	case FS_TRACE_SYNC:
+		ret = fs_sync();
+		break;
+	case FS_TRACE_FRAG:
+		ret = fs_fragmentation(&frag);
+		break;
+	case FS_TRACE_CREATE:
+		ret = rec->size ? fs_create_mode(name, rec->size) :
+			fs_create(name);
+		break;
+	case FS_TRACE_DELETE:
+		ret = fs_delete(name);
+		break;
+	case FS_TRACE_MKDIR:
+		ret = fs_mkdir(name);
+		break;
+	case FS_TRACE_RMDIR:
+		ret = fs_rmdir(name);
+		break;
+	case FS_TRACE_OPEN:
+		ret = rec->size ? fs_open_flags(name, rec->size) :
+			fs_open(name);
+		break;
+	case FS_TRACE_OPEN_MAX:
+		ret = fs_set_open_max(rec->size);
+		break;
+	case FS_TRACE_CLOSE:
+		ret = fs_close(fd);
+		break;
+	case FS_TRACE_STAT:
+		ret = fs_stat(fd);
+		break;
+	case FS_TRACE_LSEEK:
+		ret = fs_lseek(fd, rec->size);
+		break;
+	case FS_TRACE_READ:
+	case FS_TRACE_READ_ASYNC:
+	case FS_TRACE_EXPORT:
+	case FS_TRACE_READV:
+		ret = fs_read(fd, data(count), count);
+		break;
+	case FS_TRACE_WRITE:
+	case FS_TRACE_WRITE_ASYNC:
+	case FS_TRACE_IMPORT:
+	case FS_TRACE_WRITEV:
+		ret = fs_write(fd, data(count), count);
+		break;
+	case FS_TRACE_PREAD:
+		ret = fs_pread(fd, data(count), count, rec->offset);
+		break;
+	case FS_TRACE_PWRITE:
+		ret = fs_pwrite(fd, data(count), count, rec->offset);
+		break;
+	case FS_TRACE_MMAP:
+		/* Released right away, the trace does not say when it was */
+		map = fs_mmap(fd, rec->offset, count);
+		ret = map ? 0 : -1;
+		if (map)
+			fs_munmap(map);
+		break;
+	case FS_TRACE_FALLOCATE:
+		ret = fs_fallocate(fd, rec->size);
+		break;
+	case FS_TRACE_TRUNCATE:
+		ret = fs_truncate(fd, rec->size);
+		break;
+	default:
+		die("Cannot replay op %d", rec->op);
+	}
+	*lat = (now() - start) * 1e6;
+	*bytes = 0;
+
+	switch (rec->op) {
+	case FS_TRACE_OPEN:
+		if (ret >= 0 && rec->result >= 0)
+			*fd_slot(rec->result) = ret;
+		break;
+	case FS_TRACE_CLOSE:
+		if (ret == 0)
+			*fd_slot(rec->fd) = -1;
+		break;
+	case FS_TRACE_READ:
+	case FS_TRACE_WRITE:
+	case FS_TRACE_READ_ASYNC:
+	case FS_TRACE_WRITE_ASYNC:
+	case FS_TRACE_EXPORT:
+	case FS_TRACE_IMPORT:
+	case FS_TRACE_PREAD:
+	case FS_TRACE_PWRITE:
+	case FS_TRACE_READV:
+	case FS_TRACE_WRITEV:
+		*bytes = ret > 0 ? ret : 0;
+		break;
+	case FS_TRACE_MMAP:
+		*bytes = ret == 0 ? count : 0;
+		break;
+	}
+
+	return ret;
+}
+
+/* Whether replayed result @ret differs from what was recorded */
+static int mismatch(const struct fs_trace_rec *rec, int ret)
+{
+	switch (rec->op) {
+	case FS_TRACE_OPEN:
+		/* Only success matters, fds are mapped */
+		return (ret < 0) != (rec->result < 0);
+	case FS_TRACE_READ_ASYNC:
+	case FS_TRACE_WRITE_ASYNC:
+		/* The recorded result is that of the submission */
+		return (ret < 0) != (rec->result < 0);
+	default:
+		return ret != rec->result;
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: replay_fs.x <trace> <diskname> [-t]\n");
+	fprintf(stderr, "  -t: keep the recorded time between calls\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct fs_trace_header header;
+	struct fs_trace_rec rec;
+	size_t replayed = 0, skipped = 0, mismatched = 0, total = 0;
+	char name[UINT8_MAX + 1];
+	double start, secs;
+	int timed = 0;
+	FILE *in;
+
+	if (argc < 3 || argc > 4)
+		usage();
+	if (argc == 4) {
+		if (strcmp(argv[3], "-t"))
+			usage();
+		timed = 1;
+	}
+
+	in = fopen(argv[1], "rb");
+	if (!in)
+		die("Cannot open trace %s", argv[1]);
+
+	if (fread(&header, sizeof(header), 1, in) != 1 ||
+	    memcmp(header.magic, FS_TRACE_MAGIC, sizeof(header.magic)) ||
+	    header.rec_size != sizeof(rec))
+		die("%s is not a trace", argv[1]);
+
+	start = now();
+	while (fread(&rec, sizeof(rec), 1, in) == 1) {
+		double lat;
+		size_t bytes;
+		int ret;
+
+		if (fread(name, 1, rec.name_len, in) != rec.name_len)
+			die("Truncated trace");
+		name[rec.name_len] = '\0';
+
+		if (rec.op >= FS_TRACE_OPS)
+			die("Unknown op %d in trace", rec.op);
+
+		switch (rec.op) {
+		case FS_TRACE_INFO:
+		case FS_TRACE_LS:
+		case FS_TRACE_LS_DIR:
+		case FS_TRACE_READDIR:
+		case FS_TRACE_STAT_MANY:
+		case FS_TRACE_ASYNC_FD:
+		case FS_TRACE_ASYNC_REAP:
+		case FS_TRACE_MEMORY:
+		case FS_TRACE_FORMAT:
+		case FS_TRACE_MUNMAP:
+			/* Print, make disks or need state the trace lacks */
+			skipped++;
+			continue;
+		}
+
+		if (timed) {
+			double wait = rec.start / 1e9 - (now() - start);
+
+			if (wait > 0) {
+				struct timespec ts = {
+					.tv_sec = wait,
+					.tv_nsec = (wait - (long)wait) * 1e9,
+				};
+
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		ret = replay(&rec, name, argv[2], &lat, &bytes);
+		if (mismatch(&rec, ret))
+			mismatched++;
+		stats_add(rec.op, lat, bytes);
+		total += bytes;
+		replayed++;
+	}
+	secs = now() - start;
+	fclose(in);
+
+	printf("Replayed %zu calls (%zu skipped, %zu mismatched) in %.3f s\n",
+	       replayed, skipped, mismatched, secs);
+	printf("%-12s %8s %10s %10s %10s %10s %10s\n", "op", "calls", "MiB",
+	       "p50 us", "p90 us", "p99 us", "max us");
+	for (int op = 0; op < FS_TRACE_OPS; op++) {
+		struct op_stats *s = &stats[op];
+
+		if (!s->count)
+			continue;
+
+		qsort(s->lat, s->count, sizeof(*s->lat), cmp_double);
+		printf("%-12s %8zu %10.2f %10.1f %10.1f %10.1f %10.1f\n",
+		       op_names[op], s->count, s->bytes / (1024.0 * 1024.0),
+		       percentile(s, 50), percentile(s, 90), percentile(s, 99),
+		       s->lat[s->count - 1]);
+	}
+	printf("Throughput: %.1f MiB/s\n", total / (1024.0 * 1024.0) / secs);
+
+	return mismatched ? 1 : 0;
+}
@@ -0,0 +1,71 @@
+#!/bin/sh
+# make a fresh virtual disk of nine usable blocks
+./fs_make.x disk.fs 10 >/dev/null
+dd if=/dev/urandom of=one.bin bs=4096 count=1 2>/dev/null
+dd if=/dev/urandom of=three.bin bs=4096 count=3 2>/dev/null
+dd if=/dev/urandom of=six.bin bs=4096 count=6 2>/dev/null
+
+# the last file only fits in the hole and the space after the second one
+./test_fs.x add disk.fs one.bin >/dev/null
+./test_fs.x add disk.fs three.bin >/dev/null
+./test_fs.x rm disk.fs one.bin >/dev/null
+./test_fs.x add disk.fs six.bin >/dev/null
+./test_fs.x frag disk.fs >lib.stdout
+cat >ref.stdout <<END
+FS Fragmentation:
+files=2
+fragmented_files=1
+extents=3
+avg_extent_blocks=3.0
+free_extents=0
+free_largest=0
+END
+./test_fs.x cat disk.fs six.bin | tail -n +3 >six.out
+if cmp -s ref.stdout lib.stdout && cmp -s six.bin six.out; then
+	echo "Fragmentation stats match!"
+else
+	echo "Fragmentation stats don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# interleaved appends still give each file a single run
+./fs_make.x disk.fs 8192 >/dev/null
+./test_fs.x memory disk.fs 0 16 200 >/dev/null
+./test_fs.x frag disk.fs >lib.stdout
+if grep -q "^fragmented_files=0$" lib.stdout &&
+   grep -q "^extents=16$" lib.stdout; then
+	echo "Interleaved layout match!"
+else
+	echo "Interleaved layout don't match..."
+	cat lib.stdout
+fi
+
+# and the first file still starts where the reference starts it
+if ./fs_ref.x ls disk.fs |
+   grep -q "^file: mem0, size: 819200, data_blk: 1$"; then
+	echo "First file layout match!"
+else
+	echo "First file layout don't match..."
+fi
+
+# two open files growing by one block each, the first with a single free
+# block after its tail, do not take each other's next block
+./fs_make.x disk.fs 10 >/dev/null
+for f in a b c; do
+	printf $f >$f.bin
+	./test_fs.x add disk.fs $f.bin >/dev/null
+done
+./test_fs.x rm disk.fs a.bin >/dev/null
+./test_fs.x rm disk.fs b.bin >/dev/null
+./test_fs.x memory disk.fs 0 2 2 >/dev/null
+./test_fs.x frag disk.fs >lib.stdout
+if grep -q "^fragmented_files=0$" lib.stdout; then
+	echo "Single block room layout match!"
+else
+	echo "Single block room layout don't match..."
+	cat lib.stdout
+	./fs_ref.x ls disk.fs
+fi
+
+# clean
+rm disk.fs one.bin three.bin six.bin six.out ref.stdout lib.stdout a.bin b.bin c.bin
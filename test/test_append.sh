@@ -0,0 +1,47 @@
+#!/bin/sh
+# make fresh virtual disk
+./fs_make.x disk.fs 8192
+seq 1 200000 >big.bin
+
+# appends from two descriptors land one after the other, also after a
+# truncation moved the end of the file back
+./test_fs.x append disk.fs big.bin >lib.stdout
+./test_fs.x cat disk.fs big.bin | tail -n +3 >big.out
+if grep -q "^Appended $(wc -c <big.bin) bytes$" lib.stdout &&
+   cmp -s big.bin big.out; then
+	echo "Append match!"
+else
+	echo "Append don't match..."
+	cat lib.stdout
+fi
+
+# the layout is the one of a plain copy
+./fs_make.x ref.fs 8192 >/dev/null
+./fs_ref.x add ref.fs big.bin >/dev/null
+./fs_ref.x ls ref.fs >ref.stdout
+./fs_ref.x ls disk.fs >lib.stdout
+if cmp -s ref.stdout lib.stdout; then
+	echo "Append layout match!"
+else
+	echo "Append layout don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# clients of the daemon append too
+./test_fs.x rm disk.fs big.bin >/dev/null
+../fsd/fsd.x disk.fs &
+daemon=$!
+while [ ! -S disk.fs.sock ]; do sleep 0.1; done
+./test_fs_client.x append disk.fs big.bin >lib.stdout
+./test_fs_client.x cat disk.fs big.bin | tail -n +3 >big.out
+kill -TERM $daemon
+wait $daemon
+if cmp -s big.bin big.out; then
+	echo "Append (daemon) match!"
+else
+	echo "Append (daemon) don't match..."
+	cat lib.stdout
+fi
+
+# clean
+rm disk.fs ref.fs big.bin big.out ref.stdout lib.stdout
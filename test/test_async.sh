@@ -0,0 +1,16 @@
+#!/bin/sh
+# make fresh virtual disk
+./fs_make.x disk.fs 8192
+
+# reads queued asynchronously come back complete and in order
+seq 1 100000 >big.bin
+./test_fs.x add disk.fs big.bin >/dev/null
+./test_fs.x cat_async disk.fs big.bin | tail -n +2 >big.out
+if cmp -s big.bin big.out; then
+	echo "Async file content match!"
+else
+	echo "Async file content don't match..."
+fi
+
+# clean
+rm disk.fs big.bin big.out
@@ -0,0 +1,58 @@
+#!/bin/sh
+# make fresh virtual disk
+./fs_make.x disk.fs 8192
+seq 1 400000 >big.bin
+
+# large reads are split into block runs, whatever maps the blocks
+for mode in fat ext lz; do
+	./test_fs.x add disk.fs big.bin $mode >/dev/null
+	# the readers helping with them end with the mount
+	if ./test_fs.x cat_read disk.fs big.bin >big.out &&
+	   ./test_fs.x cat_read disk.fs big.bin 1234567 >tail.out &&
+	   cmp -s big.bin big.out &&
+	   tail -c +1234568 big.bin | cmp -s - tail.out; then
+		echo "Large read ($mode) match!"
+	else
+		echo "Large read ($mode) don't match..."
+	fi
+	./test_fs.x rm disk.fs big.bin >/dev/null
+done
+
+# a file split around another one reads back in order
+dd if=/dev/urandom of=hole.bin bs=4096 count=40 2>/dev/null
+./test_fs.x add disk.fs hole.bin >/dev/null
+./test_fs.x add disk.fs hello.txt >/dev/null
+./test_fs.x rm disk.fs hole.bin >/dev/null
+./test_fs.x add disk.fs big.bin >/dev/null
+./test_fs.x cat_read disk.fs big.bin 100 >tail.out
+if tail -c +101 big.bin | cmp -s - tail.out; then
+	echo "Large read (fragmented) match!"
+else
+	echo "Large read (fragmented) don't match..."
+fi
+
+# dirty blocks are read from memory
+./test_fs.x rm disk.fs big.bin >/dev/null
+./test_fs.x writeback disk.fs big.bin >lib.stdout 2>&1
+if grep -q "^Dirty before sync: yes$" lib.stdout; then
+	echo "Large read (write-back) match!"
+else
+	echo "Large read (write-back) don't match..."
+	cat lib.stdout
+fi
+
+# a corrupted block cuts the read short
+./fs_make.x disk.fs 8192 >/dev/null
+./test_fs.x feature disk.fs 2 >/dev/null
+./test_fs.x add disk.fs big.bin >/dev/null
+./test_fs.x cat_read disk.fs big.bin >big.out
+printf 'X' | dd of=disk.fs bs=1 seek=$((100 * 4096)) conv=notrunc 2>/dev/null
+if cmp -s big.bin big.out &&
+   ! ./test_fs.x cat_read disk.fs big.bin >/dev/null 2>&1; then
+	echo "Large read (checksums) match!"
+else
+	echo "Large read (checksums) don't match..."
+fi
+
+# clean
+rm disk.fs big.bin big.out tail.out hole.bin lib.stdout
@@ -0,0 +1,49 @@
+#!/bin/sh
+# the default block size makes the same disk as the reference tool
+./fs_make.x ref.fs 8192 >/dev/null
+./test_fs.x format lib.fs 8192 >/dev/null
+if cmp -s ref.fs lib.fs; then
+	echo "Default format match!"
+else
+	echo "Default format don't match..."
+fi
+
+# files of every layout and a large directory read back at every block size
+seq 1 100000 >big.txt
+head -c 3000 big.txt >small.txt
+mkdir -p dir
+cp big.txt dir/packed.txt
+for bs in 1024 4096 16384 65536; do
+	./test_fs.x format disk.fs 2000 $bs >/dev/null
+	./test_fs.x add disk.fs big.txt >/dev/null
+	./test_fs.x add_ext disk.fs small.txt >/dev/null
+	./test_fs.x mkdir disk.fs dir >/dev/null
+	./test_fs.x add_lz disk.fs dir/packed.txt >/dev/null
+	./test_fs.x create_many disk.fs dir 600 >/dev/null
+	./test_fs.x feature disk.fs 3 >/dev/null
+	ok=yes
+	for f in big.txt small.txt dir/packed.txt; do
+		./test_fs.x cat disk.fs $f | tail -n +3 | cmp -s - $f || ok=no
+	done
+	count=$(./test_fs.x ls_dir disk.fs dir | grep -c "^file: ")
+	[ "$count" -eq 601 ] || ok=no
+	./test_fs.x scrub disk.fs | grep -q "Corrupted blocks: 0" || ok=no
+	if [ $ok = yes ]; then
+		echo "Block size $bs match!"
+	else
+		echo "Block size $bs don't match..."
+	fi
+done
+
+# block sizes that are not a power of two from 1 KiB to 64 KiB are refused
+./test_fs.x format disk.fs 100 3000 >lib.stdout 2>&1
+./test_fs.x format disk.fs 100 131072 >>lib.stdout 2>&1
+if [ "$(grep -c "Cannot format" lib.stdout)" -eq 2 ]; then
+	echo "Invalid block size match!"
+else
+	echo "Invalid block size don't match..."
+	cat lib.stdout
+fi
+
+# clean
+rm -rf ref.fs lib.fs disk.fs big.txt small.txt dir lib.stdout
@@ -0,0 +1,58 @@
+#!/bin/sh
+# make fresh virtual disk
+./fs_make.x disk.fs 8192
+
+# compressible file stored in compressed chunks, same file stored plainly
+seq 1 200000 >big.bin
+./test_fs.x add_lz disk.fs big.bin >/dev/null
+./test_fs.x info disk.fs | grep fat_free_ratio >lz.info
+./test_fs.x rm disk.fs big.bin >/dev/null
+./test_fs.x add disk.fs big.bin >/dev/null
+./test_fs.x info disk.fs | grep fat_free_ratio >plain.info
+./test_fs.x rm disk.fs big.bin >/dev/null
+
+# compressed file must use fewer blocks
+lz=$(cut -d/ -f1 lz.info | cut -d= -f2)
+plain=$(cut -d/ -f1 plain.info | cut -d= -f2)
+if [ "$lz" -gt "$plain" ]; then
+	echo "Compressed size match!"
+else
+	echo "Compressed size don't match... ($lz vs $plain free blocks)"
+fi
+
+# read it back through the decompressor
+./test_fs.x add_lz disk.fs big.bin >/dev/null
+./test_fs.x cat disk.fs big.bin | tail -n +3 >big.out
+if cmp -s big.bin big.out; then
+	echo "Compressed file content match!"
+else
+	echo "Compressed file content don't match..."
+fi
+
+# incompressible data is stored raw and still reads back
+head -c 100000 /dev/urandom | od -An -tx1 -v | tr -d ' \n' | head -c 150000 >rand.bin
+./test_fs.x add_lz disk.fs rand.bin >/dev/null
+./test_fs.x cat disk.fs rand.bin | tail -n +3 >rand.out
+if cmp -s rand.bin rand.out; then
+	echo "Raw chunk content match!"
+else
+	echo "Raw chunk content don't match..."
+fi
+
+# removing both files must give every block back
+./test_fs.x rm disk.fs big.bin >/dev/null
+./test_fs.x rm disk.fs rand.bin >/dev/null
+./fs_ref.x info disk.fs >ref.stdout
+./fs_make.x empty.fs 8192 >/dev/null
+./fs_ref.x info empty.fs >lib.stdout
+
+if cmp -s ref.stdout lib.stdout; then
+	echo "Free blocks match!"
+else
+	echo "Free blocks don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# clean
+rm disk.fs empty.fs big.bin big.out rand.bin rand.out lz.info plain.info
+rm ref.stdout lib.stdout
@@ -0,0 +1,48 @@
+#!/bin/sh
+# make fresh virtual disk with block checksums
+./fs_make.x disk.fs 8192
+./test_fs.x feature disk.fs 2 >/dev/null
+
+# files added after the feature read back and scrub clean
+seq 1 100000 >big.bin
+./test_fs.x add disk.fs big.bin >/dev/null
+./test_fs.x add disk.fs hello.txt >/dev/null
+./test_fs.x cat disk.fs big.bin | tail -n +3 >big.out
+if cmp -s big.bin big.out; then
+	echo "Checksummed file content match!"
+else
+	echo "Checksummed file content don't match..."
+fi
+
+./test_fs.x scrub disk.fs >lib.stdout
+echo "Corrupted blocks: 0" >ref.stdout
+if cmp -s ref.stdout lib.stdout; then
+	echo "Clean scrub match!"
+else
+	echo "Clean scrub don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# flip a byte in the first block of big.bin, right after the checksum region
+# (data blocks start at block 6 and the region takes data blocks 1 to 9)
+printf 'X' | dd of=disk.fs bs=1 seek=$((16 * 4096 + 100)) conv=notrunc 2>/dev/null
+./test_fs.x scrub disk.fs 2>/dev/null >lib.stdout
+echo "Corrupted blocks: 1" >ref.stdout
+if cmp -s ref.stdout lib.stdout; then
+	echo "Corrupted scrub match!"
+else
+	echo "Corrupted scrub don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# reading the corrupted block must fail instead of returning bad data
+./test_fs.x cat disk.fs big.bin 2>/dev/null | tail -n +3 >big.out
+if cmp -s big.bin big.out; then
+	echo "Corrupted read don't match..."
+else
+	echo "Corrupted read match!"
+fi
+
+# clean
+rm disk.fs big.bin big.out
+rm ref.stdout lib.stdout
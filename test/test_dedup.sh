@@ -0,0 +1,47 @@
+#!/bin/sh
+# make fresh virtual disks with dedup on
+./fs_make.x disk.fs 8192
+./fs_make.x empty.fs 8192 >/dev/null
+./test_fs.x feature disk.fs 4 >/dev/null
+./test_fs.x feature empty.fs 4 >/dev/null
+
+# two extent files with the same content share their blocks
+seq 1 100000 >big.bin
+cp big.bin copy.bin
+./test_fs.x add_ext disk.fs big.bin >/dev/null
+./test_fs.x info disk.fs | grep fat_free_ratio >one.info
+./test_fs.x add_ext disk.fs copy.bin >/dev/null
+./test_fs.x info disk.fs | grep fat_free_ratio >two.info
+
+# the copy only costs its extent block and its partial last block
+one=$(cut -d/ -f1 one.info | cut -d= -f2)
+two=$(cut -d/ -f1 two.info | cut -d= -f2)
+if [ $((one - two)) -eq 2 ]; then
+	echo "Dedup size match!"
+else
+	echo "Dedup size don't match... ($one vs $two free blocks)"
+fi
+
+# removing one file leaves the other intact
+./test_fs.x rm disk.fs big.bin >/dev/null
+./test_fs.x cat disk.fs copy.bin | tail -n +3 >copy.out
+if cmp -s big.bin copy.out; then
+	echo "Shared file content match!"
+else
+	echo "Shared file content don't match..."
+fi
+
+# removing the last file gives every block back
+./test_fs.x rm disk.fs copy.bin >/dev/null
+./fs_ref.x info disk.fs >lib.stdout
+./fs_ref.x info empty.fs >ref.stdout
+if cmp -s ref.stdout lib.stdout; then
+	echo "Free blocks match!"
+else
+	echo "Free blocks don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# clean
+rm disk.fs empty.fs big.bin copy.bin copy.out one.info two.info
+rm ref.stdout lib.stdout
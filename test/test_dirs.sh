@@ -0,0 +1,63 @@
+#!/bin/sh
+# make fresh virtual disks
+./fs_make.x disk.fs 8192
+./fs_make.x empty.fs 8192 >/dev/null
+
+# files in nested directories read back like files in the root directory
+mkdir -p docs
+seq 1 10000 >docs/notes.txt
+./test_fs.x mkdir disk.fs docs >/dev/null
+./test_fs.x mkdir disk.fs docs/more >/dev/null
+./test_fs.x add disk.fs docs/notes.txt >/dev/null
+./test_fs.x cat disk.fs docs/notes.txt | tail -n +3 >notes.out
+if cmp -s docs/notes.txt notes.out; then
+	echo "Nested file content match!"
+else
+	echo "Nested file content don't match..."
+fi
+
+# a directory grows past the 128 entries of the root directory
+./test_fs.x create_many disk.fs docs/more 3000 >/dev/null
+count=$(./test_fs.x ls_dir disk.fs docs/more | grep -c "^file: ")
+if [ "$count" -eq 3000 ]; then
+	echo "Directory entries match!"
+else
+	echo "Directory entries don't match... ($count entries)"
+fi
+
+# only empty directories can be removed
+./test_fs.x rmdir disk.fs docs 2>/dev/null
+./test_fs.x rm disk.fs docs/notes.txt >/dev/null
+./test_fs.x ls_dir disk.fs docs | cut -d, -f1 >lib.stdout
+cat >ref.stdout <<END
+FS Ls:
+dir: more
+END
+if cmp -s ref.stdout lib.stdout; then
+	echo "Directory listing match!"
+else
+	echo "Directory listing don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# removing everything gives every block back
+for i in $(seq 0 2999); do
+	echo "docs/more/file$i"
+done >names.txt
+while read -r name; do
+	./test_fs.x rm disk.fs "$name" >/dev/null
+done <names.txt
+./test_fs.x rmdir disk.fs docs/more >/dev/null
+./test_fs.x rmdir disk.fs docs >/dev/null
+./fs_ref.x info disk.fs >lib.stdout
+./fs_ref.x info empty.fs >ref.stdout
+if cmp -s ref.stdout lib.stdout; then
+	echo "Free blocks match!"
+else
+	echo "Free blocks don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# clean
+rm -r docs
+rm disk.fs empty.fs notes.out names.txt ref.stdout lib.stdout
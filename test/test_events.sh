@@ -0,0 +1,42 @@
+#!/bin/sh
+# make fresh virtual disk
+./fs_make.x disk.fs 8192
+seq 1 400000 >big.bin
+./test_fs.x add disk.fs big.bin >/dev/null
+
+# every call, walk, allocation and block access begins and ends
+cp big.bin more.bin
+FS_EVENTS=events.json ./test_fs_events.x writeback disk.fs more.bin >/dev/null
+begins=$(grep -c '"ph":"B"' events.json)
+ends=$(grep -c '"ph":"E"' events.json)
+ok=1
+for name in fs_write fs_pread cursorAppend block_write; do
+	grep -q "\"name\":\"$name\"" events.json || ok=0
+done
+if [ $ok -eq 1 ] && [ $begins -eq $ends ] && tail -n 1 events.json | grep -q '^]}$'; then
+	echo "Recorded events match!"
+else
+	echo "Recorded events don't match..."
+fi
+
+# a large read is a run of block reads inside fs_pread
+FS_EVENTS=events.json ./test_fs_events.x cat_read disk.fs big.bin >/dev/null
+if grep -A1 '"name":"fs_pread","ph":"B"' events.json |
+   grep -q '"name":"cursorSeek","ph":"B"' &&
+   [ $(grep -c '"name":"block_read_run","ph":"B"' events.json) -ge 10 ]; then
+	echo "Large read events match!"
+else
+	echo "Large read events don't match..."
+fi
+
+# the default library records nothing
+if ! nm ../libfs/libfs.a | grep -q event_record &&
+   FS_EVENTS=none.json ./test_fs.x cat_read disk.fs big.bin >/dev/null &&
+   [ ! -e none.json ]; then
+	echo "Disabled events match!"
+else
+	echo "Disabled events don't match..."
+fi
+
+# clean
+rm disk.fs big.bin more.bin events.json
@@ -0,0 +1,46 @@
+#!/bin/sh
+# make fresh virtual disk
+./fs_make.x disk.fs 8192
+
+# big file stored as extents, small file stored with the fat
+seq 1 200000 >big.bin
+./test_fs.x add_ext disk.fs big.bin >/dev/null
+./test_fs.x add disk.fs hello.txt >/dev/null
+
+# read both files back
+./test_fs.x cat disk.fs big.bin | tail -n +3 >big.out
+./test_fs.x cat disk.fs hello.txt >lib.stdout
+./fs_ref.x cat disk.fs hello.txt >ref.stdout
+
+# compare extent file content
+if cmp -s big.bin big.out; then
+	echo "Extent file content match!"
+else
+	echo "Extent file content don't match..."
+fi
+
+# compare fat file content with reference
+if cmp -s ref.stdout lib.stdout; then
+	echo "Stdout outputs match!"
+else
+	echo "Stdout outputs don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# removing both files must give every block back
+./test_fs.x rm disk.fs big.bin >/dev/null
+./test_fs.x rm disk.fs hello.txt >/dev/null
+./fs_ref.x info disk.fs >ref.stdout
+./fs_make.x empty.fs 8192 >/dev/null
+./fs_ref.x info empty.fs >lib.stdout
+
+if cmp -s ref.stdout lib.stdout; then
+	echo "Free blocks match!"
+else
+	echo "Free blocks don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# clean
+rm disk.fs empty.fs big.bin big.out
+rm ref.stdout lib.stdout
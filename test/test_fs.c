@@ -1,10 +1,12 @@
 #include <assert.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -29,6 +31,8 @@ do {							\
 } while (0)
 
 
+size_t get_argv(char *argv);
+
 struct thread_arg {
 	int argc;
 	char **argv;
@@ -84,7 +88,7 @@ void thread_fs_stat(void *arg)
 void thread_fs_cat(void *arg)
 {
 	struct thread_arg *t_arg = arg;
-	char *diskname, *filename, *buf;
+	char *diskname, *filename;
 	int fs_fd;
 	int stat, read;
 
@@ -113,17 +117,87 @@ void thread_fs_cat(void *arg)
 		printf("Empty file\n");
 		return;
 	}
-	
-	//stat = 3;
-	//fs_lseek(fs_fd, 1);
-	buf = malloc(stat);
+
+	printf("Read file '%s' (%d/%d bytes)\n", filename, stat, stat);
+	printf("Content of the file:\n");
+	fflush(stdout);
+
+	/* Content goes straight from the disk image to stdout */
+	read = fs_export(fs_fd, STDOUT_FILENO);
+
+	if (fs_close(fs_fd)) {
+		fs_umount();
+		die("Cannot close file");
+	}
+
+	if (fs_umount())
+		die("cannot unmount diskname");
+
+	if (read != stat)
+		die("Read only %d/%d bytes", read, stat);
+}
+
+/* Number of threads of the process */
+static int count_threads(void)
+{
+	DIR *dir = opendir("/proc/self/task");
+	int count = 0;
+
+	if (!dir)
+		die_perror("opendir");
+	while (readdir(dir))
+		count++;
+	closedir(dir);
+
+	/* Minus "." and ".." */
+	return count - 2;
+}
+
+void thread_fs_cat_read(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *filename;
+	char *buf;
+	int fs_fd, stat, offset = 0, read, threads;
+
+	if (t_arg->argc < 2)
+		die("need <diskname> <filename> [<offset>]");
+
+	diskname = t_arg->argv[0];
+	filename = t_arg->argv[1];
+	if (t_arg->argc > 2)
+		offset = atoi(t_arg->argv[2]);
+
+	threads = count_threads();
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	fs_fd = fs_open(filename);
+	if (fs_fd < 0) {
+		fs_umount();
+		die("Cannot open file");
+	}
+
+	stat = fs_stat(fs_fd);
+	if (stat < 0 || offset > stat) {
+		fs_umount();
+		die("Cannot stat file");
+	}
+
+	buf = malloc(stat - offset + 1);
 	if (!buf) {
-		perror("malloc");
 		fs_umount();
-		die("Cannot malloc");
+		die_perror("malloc");
 	}
 
-	read = fs_read(fs_fd, buf, stat);
+	/* The rest of the file in a single call */
+	read = fs_pread(fs_fd, buf, stat - offset, offset);
+	if (read != stat - offset) {
+		fs_umount();
+		die("Read only %d/%d bytes", read, stat - offset);
+	}
+	fwrite(buf, 1, read, stdout);
+	free(buf);
 
 	if (fs_close(fs_fd)) {
 		fs_umount();
@@ -133,17 +207,24 @@ void thread_fs_cat(void *arg)
 	if (fs_umount())
 		die("cannot unmount diskname");
 
-	printf("Read file '%s' (%d/%d bytes)\n", filename, read, stat);
-	printf("Content of the file:\n");
-	printf("%.*s", (int)stat, buf);
-
-	free(buf);
+	/* The threads helping with the read end with the mount */
+	if (count_threads() > threads)
+		die("Threads left after unmounting");
 }
 
-void thread_fs_rm(void *arg)
+/* Chunk size and number of reads kept in flight by cat_async */
+#define ASYNC_CHUNK 4096
+#define ASYNC_DEPTH 8
+
+void thread_fs_cat_async(void *arg)
 {
 	struct thread_arg *t_arg = arg;
 	char *diskname, *filename;
+	char *buf;
+	int fs_fd, stat, chunks, queued = 0, done = 0, next = 0;
+	int *len;
+	struct pollfd pfd;
+	struct fs_completion comps[ASYNC_DEPTH];
 
 	if (t_arg->argc < 2)
 		die("need <diskname> <filename>");
@@ -154,119 +235,1020 @@ void thread_fs_rm(void *arg)
 	if (fs_mount(diskname))
 		die("Cannot mount diskname");
 
-	if (fs_delete(filename)) {
+	fs_fd = fs_open(filename);
+	if (fs_fd < 0) {
 		fs_umount();
-		die("Cannot delete file");
+		die("Cannot open file");
+	}
+
+	stat = fs_stat(fs_fd);
+	chunks = (stat + ASYNC_CHUNK - 1) / ASYNC_CHUNK;
+	buf = malloc((size_t)chunks * ASYNC_CHUNK + 1);
+	len = calloc(chunks + 1, sizeof(int));
+
+	pfd.fd = fs_async_fd();
+	pfd.events = POLLIN;
+
+	/* Keeps a few reads in flight, completions come back through poll */
+	while (done < chunks) {
+		while (queued < chunks && queued - done < ASYNC_DEPTH) {
+			if (fs_read_async(fs_fd, buf + (size_t)queued * ASYNC_CHUNK,
+					  ASYNC_CHUNK, NULL, (void *)(long)queued))
+				die("Cannot queue read");
+			queued++;
+		}
+
+		if (poll(&pfd, 1, -1) < 0)
+			die_perror("poll");
+
+		for (int i = 0, n = fs_async_reap(comps, ASYNC_DEPTH); i < n; i++) {
+			len[(long)comps[i].arg] = comps[i].result;
+			done++;
+		}
+	}
+
+	/* Chunks complete in any order but are printed in file order */
+	printf("Read file '%s' (%d bytes)\n", filename, stat);
+	for (next = 0; next < chunks && len[next] > 0; next++)
+		fwrite(buf + (size_t)next * ASYNC_CHUNK, 1, len[next], stdout);
+
+	free(buf);
+	free(len);
+
+	if (fs_close(fs_fd)) {
+		fs_umount();
+		die("Cannot close file");
 	}
 
 	if (fs_umount())
 		die("Cannot unmount diskname");
-
-	printf("Removed file '%s'\n", filename);
 }
 
-void thread_fs_add(void *arg)
+void thread_fs_open_many(void *arg)
 {
 	struct thread_arg *t_arg = arg;
-	char *diskname, *filename, *buf;
-	int fd, fs_fd;
-	struct stat st;
-	int written;
+	char *diskname, *filename;
+	int count, *fds, stale = 0, i;
 
-	if (t_arg->argc < 2)
-		die("Usage: <diskname> <host filename>");
+	if (t_arg->argc < 3)
+		die("need <diskname> <filename> <count>");
 
 	diskname = t_arg->argv[0];
 	filename = t_arg->argv[1];
+	count = get_argv(t_arg->argv[2]);
+	fds = malloc(count * sizeof(int));
 
-	/* Open file on host computer */
-	fd = open(filename, O_RDONLY);
-	if (fd < 0)
-		die_perror("open");
-	if (fstat(fd, &st))
-		die_perror("fstat");
-	if (!S_ISREG(st.st_mode))
-		die("Not a regular file: %s\n", filename);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
 
-	/* Map file into buffer */
-	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (!buf)
-		die_perror("mmap");
+	if (count > FS_OPEN_MAX_COUNT && fs_set_open_max(count)) {
+		fs_umount();
+		die("Cannot raise open file limit");
+	}
+
+	for (i = 0; i < count; i++) {
+		fds[i] = fs_open(filename);
+		if (fds[i] < 0) {
+			fs_umount();
+			die("Cannot open file %d times", i + 1);
+		}
+	}
+
+	/* One more is over the limit */
+	if (fs_open(filename) >= 0)
+		die("Opened more than %d files", count);
+
+	/* Closed fds must not reach the files opened in their place */
+	for (i = 0; i < count; i += 2)
+		fs_close(fds[i]);
+	for (i = 0; i < count; i += 2)
+		if (fs_open(filename) < 0)
+			die("Cannot reopen file");
+	for (i = 0; i < count; i += 2)
+		if (fs_stat(fds[i]) < 0)
+			stale++;
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	/* Fds left open go stale with the mount, and stay so on the next one */
+	if (fs_stat(fds[1]) != -1 || fs_close(fds[1]) != -1)
+		die("Fd left open reached a file after unmounting");
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	if (fs_stat(fds[1]) != -1) {
+		fs_umount();
+		die("Fd left open reached a file after mounting again");
+	}
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Opened '%s' %d times, %d stale fds rejected\n", filename,
+	       count, stale);
+	free(fds);
+}
+
+void thread_fs_mkdir(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *path;
+
+	if (t_arg->argc < 2)
+		die("need <diskname> <path>");
+
+	diskname = t_arg->argv[0];
+	path = t_arg->argv[1];
 
-	/* Now, deal with our filesystem:
-	 * - mount, create a new file, copy content of host file into this new
-	 *   file, close the new file, and umount
-	 */
 	if (fs_mount(diskname))
 		die("Cannot mount diskname");
 
-	if (fs_create(filename)) {
+	if (fs_mkdir(path)) {
 		fs_umount();
-		die("Cannot create file");
+		die("Cannot create directory");
 	}
 
-	fs_fd = fs_open(filename);
-	if (fs_fd < 0) {
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Created directory '%s'\n", path);
+}
+
+void thread_fs_rmdir(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *path;
+
+	if (t_arg->argc < 2)
+		die("need <diskname> <path>");
+
+	diskname = t_arg->argv[0];
+	path = t_arg->argv[1];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_rmdir(path)) {
 		fs_umount();
-		die("Cannot open file");
+		die("Cannot remove directory");
 	}
 
-	written = fs_write(fs_fd, buf, st.st_size);
+	if (fs_umount())
+		die("Cannot unmount diskname");
 
-	if (fs_close(fs_fd)) {
+	printf("Removed directory '%s'\n", path);
+}
+
+void thread_fs_ls_dir(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *path;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <path>");
+
+	diskname = t_arg->argv[0];
+	path = t_arg->argv[1];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_ls_dir(path)) {
 		fs_umount();
-		die("Cannot close file");
+		die("Cannot list directory");
 	}
 
 	if (fs_umount())
 		die("Cannot unmount diskname");
+}
 
-	printf("Wrote file '%s' (%d/%zu bytes)\n", filename, written,
-		   st.st_size);
+void thread_fs_readdir(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	struct fs_dirent entries[7];
+	char *diskname, *path;
+	unsigned int pos = 0;
+	int count, total = 0;
 
-	munmap(buf, st.st_size);
-	close(fd);
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <path>");
+
+	diskname = t_arg->argv[0];
+	path = t_arg->argv[1];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	/* A small array makes the walk resume many times */
+	while ((count = fs_readdir(path, &pos, entries, 7)) > 0) {
+		for (int i = 0; i < count; i++)
+			printf("%s %s size=%u first=%u blocks=%u\n",
+			       entries[i].is_dir ? "dir" : "file",
+			       entries[i].name, entries[i].size,
+			       entries[i].first_block, entries[i].block_count);
+		total += count;
+	}
+
+	if (count < 0) {
+		fs_umount();
+		die("Cannot read directory");
+	}
+
+	/* Positions past the end of the directory read nothing */
+	pos = 1u << 31;
+	count = fs_readdir(path, &pos, entries, 7);
+	pos = UINT_MAX;
+	if (count || fs_readdir(path, &pos, entries, 7)) {
+		fs_umount();
+		die("Read entries past the end of the directory");
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("%d entries\n", total);
 }
 
-void thread_fs_ls(void *arg)
+void thread_fs_stat_many(void *arg)
 {
 	struct thread_arg *t_arg = arg;
 	char *diskname;
+	int sizes[t_arg->argc];
+	int found;
 
-	if (t_arg->argc < 1)
-		die("Usage: <diskname>");
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <path>...");
 
 	diskname = t_arg->argv[0];
 
 	if (fs_mount(diskname))
 		die("Cannot mount diskname");
-        
-	//fs_create("test");
-	fs_ls();
-	//fs_delete("test");
-	//fs_ls();
+
+	found = fs_stat_many((const char **)t_arg->argv + 1, t_arg->argc - 1,
+			     sizes);
+	if (found < 0) {
+		fs_umount();
+		die("Cannot stat files");
+	}
 
 	if (fs_umount())
 		die("Cannot unmount diskname");
+
+	for (int i = 1; i < t_arg->argc; i++)
+		printf("%s: %d\n", t_arg->argv[i], sizes[i - 1]);
+	printf("%d found\n", found);
 }
 
-void thread_fs_info(void *arg)
+void thread_fs_create_many(void *arg)
 {
 	struct thread_arg *t_arg = arg;
-	char *diskname;
+	char *diskname, *dirname;
+	char path[256];
+	int count, fd, i;
 
-	if (t_arg->argc < 1)
-		die("Usage: <diskname>");
+	if (t_arg->argc < 3)
+		die("need <diskname> <directory> <count>");
 
 	diskname = t_arg->argv[0];
+	dirname = t_arg->argv[1];
+	count = get_argv(t_arg->argv[2]);
 
 	if (fs_mount(diskname))
 		die("Cannot mount diskname");
 
-	fs_info();
+	for (i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "%s/file%d", dirname, i);
+		if (fs_create(path)) {
+			fs_umount();
+			die("Cannot create file '%s'", path);
+		}
+	}
+
+	/* Every file can be found again, with what was written to it */
+	for (i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "%s/file%d", dirname, i);
+		fd = fs_open(path);
+		if (fd < 0 || fs_write(fd, path, strlen(path)) != (int)strlen(path) ||
+		    fs_stat(fd) != (int)strlen(path) || fs_close(fd)) {
+			fs_umount();
+			die("Cannot write file '%s'", path);
+		}
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Created %d files in '%s'\n", count, dirname);
+}
+
+void thread_fs_memory(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	char name[FS_FILENAME_LEN];
+	char buf[4096], check[4096];
+	struct fs_memory usage;
+	int fds[FS_OPEN_MAX_COUNT];
+	int count, blocks, i, b;
+	size_t budget;
+
+	if (t_arg->argc < 4)
+		die("need <diskname> <budget> <files> <blocks>");
+
+	diskname = t_arg->argv[0];
+	budget = get_argv(t_arg->argv[1]);
+	count = get_argv(t_arg->argv[2]);
+	blocks = get_argv(t_arg->argv[3]);
+	if (count > FS_OPEN_MAX_COUNT)
+		die("at most %d files", FS_OPEN_MAX_COUNT);
+
+	if (fs_mount_budget(diskname, 0, budget))
+		die("Cannot mount diskname within %zu bytes", budget);
+
+	/* Interleaved appends keep the chains of several FAT blocks in use */
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "mem%d", i);
+		if (fs_create(name) || (fds[i] = fs_open(name)) < 0) {
+			fs_umount();
+			die("Cannot create file '%s'", name);
+		}
+	}
+	for (b = 0; b < blocks; b++) {
+		for (i = 0; i < count; i++) {
+			memset(buf, 'a' + (i + b) % 26, sizeof(buf));
+			if (fs_write(fds[i], buf, sizeof(buf)) != sizeof(buf)) {
+				fs_umount();
+				die("Cannot write file mem%d", i);
+			}
+		}
+	}
+
+	/* Then each file is read back in turn */
+	for (i = 0; i < count; i++) {
+		fs_lseek(fds[i], 0);
+		for (b = 0; b < blocks; b++) {
+			memset(check, 'a' + (i + b) % 26, sizeof(check));
+			if (fs_read(fds[i], buf, sizeof(buf)) != sizeof(buf) ||
+			    memcmp(buf, check, sizeof(buf))) {
+				fs_umount();
+				die("File mem%d does not read back", i);
+			}
+		}
+	}
+
+	if (fs_memory_usage(&usage)) {
+		fs_umount();
+		die("Cannot get memory usage");
+	}
+
+	for (i = 0; i < count; i++)
+		fs_close(fds[i]);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Wrote and read back %d files\n", count);
+	printf("FAT blocks in memory: %u of %u\n", usage.fat_resident,
+	       usage.fat_blocks);
+	printf("FAT blocks read back: %s\n", usage.fat_faults ? "yes" : "no");
+	printf("Within budget: %s\n", !usage.budget ||
+	       usage.fat + usage.indexes <= usage.budget ? "yes" : "no");
+}
+
+void thread_fs_rm(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *filename;
+	int flags = 0, threads;
+
+	if (t_arg->argc < 2)
+		die("need <diskname> <filename> [punch]");
+
+	diskname = t_arg->argv[0];
+	filename = t_arg->argv[1];
+
+	/* Reclaimed blocks can be given back to the host as well */
+	if (t_arg->argc > 2 && !strcmp(t_arg->argv[2], "punch"))
+		flags = FS_MOUNT_PUNCH;
+
+	threads = count_threads();
+	if (fs_mount_flags(diskname, flags))
+		die("Cannot mount diskname");
+
+	if (fs_delete(filename)) {
+		fs_umount();
+		die("Cannot delete file");
+	}
 
 	if (fs_umount())
 		die("Cannot unmount diskname");
+
+	/* The thread freeing the blocks ends with the mount */
+	if (count_threads() > threads)
+		die("Threads left after unmounting");
+
+	printf("Removed file '%s'\n", filename);
+}
+
+void thread_fs_fallocate(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *filename;
+	size_t size;
+	int fd;
+
+	if (t_arg->argc < 3)
+		die("need <diskname> <filename> <size> [<file deleted first>]");
+
+	diskname = t_arg->argv[0];
+	filename = t_arg->argv[1];
+	size = get_argv(t_arg->argv[2]);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	/* Within the same mount, the deleted blocks may still be queued */
+	if (t_arg->argc > 3 && fs_delete(t_arg->argv[3])) {
+		fs_umount();
+		die("Cannot delete file");
+	}
+
+	if (fs_create(filename) || (fd = fs_open(filename)) < 0) {
+		fs_umount();
+		die("Cannot create file");
+	}
+
+	if (fs_fallocate(fd, size)) {
+		fs_umount();
+		die("Cannot preallocate %zu bytes", size);
+	}
+
+	if (fs_close(fd) || fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Preallocated %zu bytes for '%s'\n", size, filename);
+}
+
+void fs_add(void *arg, int mode)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *filename;
+	int fd, fs_fd;
+	struct stat st;
+	int written;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <host filename>");
+
+	diskname = t_arg->argv[0];
+	filename = t_arg->argv[1];
+
+	/* Open file on host computer */
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		die_perror("open");
+	if (fstat(fd, &st))
+		die_perror("fstat");
+	if (!S_ISREG(st.st_mode))
+		die("Not a regular file: %s\n", filename);
+
+	/* Now, deal with our filesystem:
+	 * - mount, create a new file, copy content of host file into this new
+	 *   file, close the new file, and umount
+	 */
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_create_mode(filename, mode)) {
+		fs_umount();
+		die("Cannot create file");
+	}
+
+	fs_fd = fs_open(filename);
+	if (fs_fd < 0) {
+		fs_umount();
+		die("Cannot open file");
+	}
+
+	/* Content goes straight from the host file to the disk image */
+	written = fs_import(fd, fs_fd);
+
+	if (fs_close(fs_fd)) {
+		fs_umount();
+		die("Cannot close file");
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Wrote file '%s' (%d/%zu bytes)\n", filename, written,
+		   st.st_size);
+
+	close(fd);
+}
+
+/* Splits @len bytes at @buf into segments of uneven sizes */
+static int make_iov(struct iovec *iov, int max, char *buf, size_t len, size_t step)
+{
+	size_t used = 0;
+	int n = 0;
+
+	while (used < len && n < max) {
+		size_t seg = (n * step) % 9001 + 1;
+
+		if (seg > len - used || n == max - 1)
+			seg = len - used;
+		iov[n].iov_base = buf + used;
+		iov[n].iov_len = seg;
+		used += seg;
+		n++;
+	}
+
+	return n;
+}
+
+struct pread_arg {
+	int fd;
+	char *buf;
+	size_t offset;
+	size_t len;
+	size_t size;
+	int ret;
+};
+
+/* Reads its range, with other calls on the same fd around the read */
+static void *pread_worker(void *arg)
+{
+	struct pread_arg *p = arg;
+
+	for (int i = 0; i < 50; i++)
+		if (fs_stat(p->fd) != (int)p->size) {
+			p->ret = -1;
+			return NULL;
+		}
+
+	p->ret = fs_pread(p->fd, p->buf + p->offset, p->len, p->offset);
+	if (fs_stat(p->fd) != (int)p->size)
+		p->ret = -1;
+	return NULL;
+}
+
+void thread_fs_vec(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	struct pread_arg workers[4];
+	pthread_t threads[4];
+	struct iovec iov[256];
+	char *diskname, *filename, *data, *back;
+	struct stat st;
+	int fd, fs_fd, mode = 0, n, i;
+	size_t size;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <host filename> [fat|ext|lz]");
+
+	diskname = t_arg->argv[0];
+	filename = t_arg->argv[1];
+	if (t_arg->argc > 2 && !strcmp(t_arg->argv[2], "ext"))
+		mode = FS_MODE_EXTENT;
+	else if (t_arg->argc > 2 && !strcmp(t_arg->argv[2], "lz"))
+		mode = FS_MODE_COMPRESS;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		die_perror("open");
+	if (fstat(fd, &st))
+		die_perror("fstat");
+	size = st.st_size;
+	data = malloc(size + 1);
+	back = malloc(size + 1);
+	if (!data || !back || read(fd, data, size) != (ssize_t)size)
+		die("Cannot read %s", filename);
+	close(fd);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_create_mode(filename, mode) || (fs_fd = fs_open(filename)) < 0) {
+		fs_umount();
+		die("Cannot create file");
+	}
+
+	/* One gathered write, then the middle rewritten in place */
+	n = make_iov(iov, 256, data, size, 4099);
+	if (fs_writev(fs_fd, iov, n) != (int)size ||
+	    fs_pwrite(fs_fd, data + size / 3, size / 3, size / 3) != (int)(size / 3) ||
+	    fs_pwrite(fs_fd, data, 1, size + 1) != -1) {
+		fs_umount();
+		die("Cannot write file");
+	}
+
+	/* A byte count that doesn't fit the return value is refused */
+	iov[0].iov_base = data;
+	iov[0].iov_len = INT_MAX;
+	iov[1].iov_base = data;
+	iov[1].iov_len = 1;
+	if (fs_writev(fs_fd, iov, 2) != -1 || fs_stat(fs_fd) != (int)size) {
+		fs_umount();
+		die("Oversized gathered write");
+	}
+
+	/* Four threads read a quarter each through the same fd */
+	memset(back, 0, size);
+	for (i = 0; i < 4; i++) {
+		workers[i].fd = fs_fd;
+		workers[i].buf = back;
+		workers[i].offset = size / 4 * i;
+		workers[i].len = i == 3 ? size - size / 4 * 3 : size / 4;
+		workers[i].size = size;
+		pthread_create(&threads[i], NULL, pread_worker, &workers[i]);
+	}
+	for (i = 0; i < 4; i++) {
+		pthread_join(threads[i], NULL);
+		if (workers[i].ret != (int)workers[i].len)
+			die("Short positional read");
+	}
+	if (memcmp(data, back, size))
+		die("Positional reads don't match");
+
+	/* The fd offset was only moved by the gathered write */
+	memset(back, 0, size);
+	n = make_iov(iov, 256, back, size + 1, 1237);
+	if (fs_readv(fs_fd, iov, n) != 0 || fs_lseek(fs_fd, 0) ||
+	    fs_readv(fs_fd, iov, n) != (int)size || memcmp(data, back, size))
+		die("Scattered read doesn't match");
+
+	if (fs_close(fs_fd) || fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Vectored and positional I/O of %zu bytes\n", size);
+	free(data);
+	free(back);
+}
+
+void thread_fs_add(void *arg)
+{
+	fs_add(arg, 0);
+}
+
+void thread_fs_add_ext(void *arg)
+{
+	fs_add(arg, FS_MODE_EXTENT);
+}
+
+void thread_fs_add_lz(void *arg)
+{
+	fs_add(arg, FS_MODE_COMPRESS);
+}
+
+void thread_fs_ls(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = t_arg->argv[0];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+        
+	//fs_create("test");
+	fs_ls();
+	//fs_delete("test");
+	//fs_ls();
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+}
+
+void thread_fs_mmap(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *filename, *data;
+	const char *map, *part;
+	struct stat st;
+	int fd, fs_fd, mode = 0;
+	size_t size, first;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <host filename> [fat|ext|lz]");
+
+	diskname = t_arg->argv[0];
+	filename = t_arg->argv[1];
+	if (t_arg->argc > 2 && !strcmp(t_arg->argv[2], "ext"))
+		mode = FS_MODE_EXTENT;
+	else if (t_arg->argc > 2 && !strcmp(t_arg->argv[2], "lz"))
+		mode = FS_MODE_COMPRESS;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		die_perror("open");
+	if (fstat(fd, &st))
+		die_perror("fstat");
+	size = st.st_size;
+	data = malloc(size + 1);
+	if (!data || read(fd, data, size) != (ssize_t)size)
+		die("Cannot read %s", filename);
+	close(fd);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	/* A block of another file splits the file into two runs */
+	first = size < 10000 ? size : 10000;
+	if (fs_create_mode(filename, mode) || (fs_fd = fs_open(filename)) < 0 ||
+	    fs_write(fs_fd, data, first) != (int)first ||
+	    fs_create("gap") || (fd = fs_open("gap")) < 0 ||
+	    fs_write(fd, data, first) != (int)first || fs_close(fd) ||
+	    fs_write(fs_fd, data + first, size - first) != (int)(size - first)) {
+		fs_umount();
+		die("Cannot write file");
+	}
+
+	map = fs_mmap(fs_fd, 0, size);
+	part = fs_mmap(fs_fd, size / 3 + 1, size / 3);
+	if (!map || !part || fs_mmap(fs_fd, size / 2, size) ||
+	    fs_mmap(fs_fd, 0, 0)) {
+		fs_umount();
+		die("Cannot map file");
+	}
+
+	/* Mappings outlive the fd */
+	if (fs_close(fs_fd) || memcmp(map, data, size) ||
+	    memcmp(part, data + size / 3 + 1, size / 3))
+		die("Mapping doesn't match");
+
+	if (fs_munmap(map) || fs_munmap(map) != -1 || fs_munmap(part))
+		die("Cannot unmap file");
+
+	if (fs_delete("gap") || fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Mapped %zu bytes\n", size);
+	free(data);
+}
+
+/* Size of the appends of the append command, not a multiple of a block */
+#define APPEND_CHUNK 1000
+
+void thread_fs_append(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *filename, *data, byte;
+	struct stat st;
+	int fd, fds[2];
+	size_t size, done, half;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <host filename>");
+
+	diskname = t_arg->argv[0];
+	filename = t_arg->argv[1];
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		die_perror("open");
+	if (fstat(fd, &st))
+		die_perror("fstat");
+	size = st.st_size;
+	data = malloc(size + 1);
+	if (!data || read(fd, data, size) != (ssize_t)size)
+		die("Cannot read %s", filename);
+	close(fd);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_create(filename) ||
+	    (fds[0] = fs_open_flags(filename, FS_OPEN_APPEND)) < 0 ||
+	    (fds[1] = fs_open_flags(filename, FS_OPEN_APPEND)) < 0) {
+		fs_umount();
+		die("Cannot open file for appending");
+	}
+
+	/* Two descriptors take turns, their offsets left at the start */
+	for (done = 0; done < size; done += APPEND_CHUNK) {
+		size_t len = size - done < APPEND_CHUNK ? size - done :
+			APPEND_CHUNK;
+		int i = (done / APPEND_CHUNK) % 2;
+
+		if (fs_lseek(fds[i], 0) ||
+		    fs_write(fds[i], data + done, len) != (int)len) {
+			fs_umount();
+			die("Cannot append to file");
+		}
+
+		/* The write left the fd at the end of file */
+		if (fs_read(fds[i], &byte, 1) != 0) {
+			fs_umount();
+			die("Read past the appended bytes");
+		}
+	}
+
+	/* The end moves back, appends follow it */
+	half = size / 2;
+	if (fs_truncate(fds[0], half) ||
+	    fs_write(fds[1], data + half, size - half) != (int)(size - half)) {
+		fs_umount();
+		die("Cannot append after truncating");
+	}
+
+	if (fs_close(fds[0]) || fs_close(fds[1]) || fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Appended %zu bytes\n", size);
+	free(data);
+}
+
+void thread_fs_writeback(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	struct fs_memory usage;
+	char *diskname, *filename, *data, *back;
+	struct stat st;
+	int fd, fs_fd, dirty;
+	size_t size, done;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <host filename>");
+
+	diskname = t_arg->argv[0];
+	filename = t_arg->argv[1];
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		die_perror("open");
+	if (fstat(fd, &st))
+		die_perror("fstat");
+	size = st.st_size;
+	data = malloc(size + 1);
+	back = malloc(size + 1);
+	if (!data || !back || read(fd, data, size) != (ssize_t)size)
+		die("Cannot read %s", filename);
+	close(fd);
+
+	if (fs_mount_flags(diskname, FS_MOUNT_WRITEBACK))
+		die("Cannot mount diskname");
+
+	if (fs_create(filename) || (fs_fd = fs_open(filename)) < 0) {
+		fs_umount();
+		die("Cannot create file");
+	}
+
+	/* Small writes only dirty blocks in memory */
+	for (done = 0; done < size; done += 4096) {
+		size_t len = size - done < 4096 ? size - done : 4096;
+
+		if (fs_write(fs_fd, data + done, len) != (int)len) {
+			fs_umount();
+			die("Cannot write file");
+		}
+	}
+	if (fs_memory_usage(&usage))
+		die("Cannot get memory usage");
+	dirty = usage.dirty > 0;
+
+	/* Reads see the dirty blocks before they reach the disk */
+	if (fs_pread(fs_fd, back, size, 0) != (int)size ||
+	    memcmp(data, back, size))
+		die("Read back doesn't match");
+
+	if (fs_sync() || fs_memory_usage(&usage))
+		die("Cannot sync diskname");
+
+	if (fs_close(fs_fd) || fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Wrote %zu bytes through write-back\n", size);
+	printf("Dirty before sync: %s\n", dirty ? "yes" : "no");
+	printf("Dirty after sync: %zu\n", usage.dirty);
+	free(data);
+	free(back);
+}
+
+void thread_fs_format(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	struct fs_format_options options = { 0 };
+	char *diskname;
+	size_t data_blocks;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <data block count> [<block size>]");
+
+	diskname = t_arg->argv[0];
+	data_blocks = get_argv(t_arg->argv[1]);
+	if (t_arg->argc > 2)
+		options.block_size = get_argv(t_arg->argv[2]);
+
+	if (fs_format(diskname, data_blocks, &options))
+		die("Cannot format diskname");
+
+	printf("Created virtual disk '%s' with '%zu' data blocks\n",
+	       diskname, data_blocks);
+}
+
+void thread_fs_info(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = t_arg->argv[0];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	fs_info();
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+}
+
+void thread_fs_frag(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	struct fs_fragmentation frag;
+	char *diskname;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = t_arg->argv[0];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_fragmentation(&frag)) {
+		fs_umount();
+		die("Cannot walk files");
+	}
+
+	printf("FS Fragmentation:\n");
+	printf("files=%u\n", frag.files);
+	printf("fragmented_files=%u\n", frag.fragmented);
+	printf("extents=%u\n", frag.extents);
+	printf("avg_extent_blocks=%.1f\n",
+	       frag.extents ? (double)frag.blocks / frag.extents : 0.0);
+	printf("free_extents=%u\n", frag.free_extents);
+	printf("free_largest=%u\n", frag.free_largest);
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+}
+
+void thread_fs_feature(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	size_t features;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <features>");
+
+	diskname = t_arg->argv[0];
+	features = get_argv(t_arg->argv[1]);
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	if (fs_feature_enable(features)) {
+		fs_umount();
+		die("Cannot enable features");
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Enabled features 0x%zx\n", features);
+}
+
+void thread_fs_scrub(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname;
+	int bad;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = t_arg->argv[0];
+
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	bad = fs_scrub();
+	if (bad == -1) {
+		fs_umount();
+		die("Cannot scrub diskname");
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Corrupted blocks: %d\n", bad);
 }
 
 size_t get_argv(char *argv)
@@ -281,12 +1263,33 @@ static struct {
 	const char *name;
 	void(*func)(void *);
 } commands[] = {
+	{ "format",	thread_fs_format },
 	{ "info",	thread_fs_info },
+	{ "frag",	thread_fs_frag },
 	{ "ls",		thread_fs_ls },
 	{ "add",	thread_fs_add },
+	{ "add_ext",	thread_fs_add_ext },
+	{ "add_lz",	thread_fs_add_lz },
 	{ "rm",		thread_fs_rm },
+	{ "fallocate",	thread_fs_fallocate },
+	{ "open_many",	thread_fs_open_many },
+	{ "mkdir",	thread_fs_mkdir },
+	{ "rmdir",	thread_fs_rmdir },
+	{ "ls_dir",	thread_fs_ls_dir },
+	{ "create_many",	thread_fs_create_many },
+	{ "memory",	thread_fs_memory },
+	{ "vec",	thread_fs_vec },
+	{ "mmap",	thread_fs_mmap },
+	{ "writeback",	thread_fs_writeback },
+	{ "append",	thread_fs_append },
+	{ "readdir",	thread_fs_readdir },
+	{ "stat_many",	thread_fs_stat_many },
 	{ "cat",	thread_fs_cat },
-	{ "stat",	thread_fs_stat }
+	{ "cat_async",	thread_fs_cat_async },
+	{ "cat_read",	thread_fs_cat_read },
+	{ "stat",	thread_fs_stat },
+	{ "feature",	thread_fs_feature },
+	{ "scrub",	thread_fs_scrub }
 };
 
 void usage(char *program)
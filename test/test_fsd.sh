@@ -0,0 +1,44 @@
+#!/bin/sh
+# make fresh virtual disk served by the daemon
+./fs_make.x disk.fs 8192
+../fsd/fsd.x disk.fs &
+daemon=$!
+while [ ! -S disk.fs.sock ]; do sleep 0.1; done
+
+# several clients add files at the same time
+clients=""
+for i in 1 2 3 4; do
+	seq $i 50000 >file$i.bin
+	./test_fs_client.x add disk.fs file$i.bin >/dev/null &
+	clients="$clients $!"
+done
+wait $clients
+
+# every file reads back through the daemon
+ok=1
+for i in 1 2 3 4; do
+	./test_fs_client.x cat disk.fs file$i.bin | tail -n +3 >file$i.out
+	cmp -s file$i.bin file$i.out || ok=0
+done
+if [ $ok -eq 1 ]; then
+	echo "Daemon file content match!"
+else
+	echo "Daemon file content don't match..."
+fi
+
+# the daemon writes the image back when it stops
+./test_fs_client.x ls disk.fs >lib.stdout
+kill -TERM $daemon
+wait $daemon
+./fs_ref.x ls disk.fs >ref.stdout
+if cmp -s ref.stdout lib.stdout; then
+	echo "Stdout outputs match!"
+else
+	echo "Stdout outputs don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# clean
+rm disk.fs file1.bin file2.bin file3.bin file4.bin
+rm file1.out file2.out file3.out file4.out
+rm ref.stdout lib.stdout
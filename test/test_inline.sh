@@ -0,0 +1,47 @@
+#!/bin/sh
+# make fresh virtual disk with inline files and tail packing
+./fs_make.x disk.fs 100
+./test_fs.x feature disk.fs 1 >/dev/null
+
+# small file goes inline, larger one gets its tail packed
+seq 1 3000 >tail.txt
+./test_fs.x add disk.fs hello.txt >/dev/null
+./test_fs.x add disk.fs tail.txt >/dev/null
+
+./test_fs.x cat disk.fs hello.txt | tail -n +3 >hello.out
+./test_fs.x cat disk.fs tail.txt | tail -n +3 >tail.out
+
+# compare contents
+if cmp -s hello.txt hello.out && cmp -s tail.txt tail.out; then
+	echo "Packed file contents match!"
+else
+	echo "Packed file contents don't match..."
+fi
+
+# 8 blocks of root extension, 3 full blocks of tail.txt and one tail block
+./test_fs.x info disk.fs | grep fat_free_ratio >lib.stdout
+echo "fat_free_ratio=87/100" >ref.stdout
+
+if cmp -s ref.stdout lib.stdout; then
+	echo "Stdout outputs match!"
+else
+	echo "Stdout outputs don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# removing the files gives back the tail block and data blocks
+./test_fs.x rm disk.fs tail.txt >/dev/null
+./test_fs.x rm disk.fs hello.txt >/dev/null
+./test_fs.x info disk.fs | grep fat_free_ratio >lib.stdout
+echo "fat_free_ratio=91/100" >ref.stdout
+
+if cmp -s ref.stdout lib.stdout; then
+	echo "Stdout outputs match!"
+else
+	echo "Stdout outputs don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# clean
+rm disk.fs tail.txt hello.out tail.out
+rm ref.stdout lib.stdout
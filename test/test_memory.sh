@@ -0,0 +1,44 @@
+#!/bin/sh
+# make fresh virtual disks, four fat blocks each
+./fs_make.x disk.fs 8192
+./fs_make.x budget.fs 8192
+
+# the same files, with the whole fat in memory and with a single fat block
+./test_fs.x memory disk.fs 0 16 200 >/dev/null
+./test_fs.x memory budget.fs 4096 16 200 >lib.stdout
+cat >ref.stdout <<END
+Wrote and read back 16 files
+FAT blocks in memory: 1 of 4
+FAT blocks read back: yes
+Within budget: yes
+END
+if cmp -s ref.stdout lib.stdout; then
+	echo "Budgeted files match!"
+else
+	echo "Budgeted files don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# the fat paged out and back in reaches the disk like the resident one
+./fs_ref.x info disk.fs >ref.stdout
+./fs_ref.x info budget.fs >lib.stdout
+./fs_ref.x ls disk.fs >>ref.stdout
+./fs_ref.x ls budget.fs >>lib.stdout
+if cmp -s ref.stdout lib.stdout; then
+	echo "Budgeted fat match!"
+else
+	echo "Budgeted fat don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# a budget below one fat block is refused
+./test_fs.x memory budget.fs 1000 1 1 >lib.stdout 2>&1
+if grep -q "Cannot mount" lib.stdout; then
+	echo "Small budget match!"
+else
+	echo "Small budget don't match..."
+	cat lib.stdout
+fi
+
+# clean
+rm disk.fs budget.fs ref.stdout lib.stdout
@@ -0,0 +1,57 @@
+#!/bin/sh
+# the native formatter makes the same disks as the reference tool
+./fs_make.x ref.fs 8192 >ref.stdout
+./mkfs_fs.x lib.fs 8192 >lib.stdout
+sed -i 's/lib.fs/ref.fs/' lib.stdout
+if cmp -s ref.fs lib.fs && cmp -s ref.stdout lib.stdout; then
+	echo "Native format match!"
+else
+	echo "Native format don't match..."
+fi
+
+# only the metadata of a large disk takes host space
+./mkfs_fs.x disk.fs 65000 >/dev/null
+kib=$(du -k disk.fs | cut -f1)
+if [ "$kib" -lt 64 ]; then
+	echo "Sparse format match!"
+else
+	echo "Sparse format don't match... ($kib KiB used)"
+fi
+
+# reserving the space allocates every block of the disk
+./mkfs_fs.x -a -b 1024 disk.fs 16384 >/dev/null
+kib=$(du -k disk.fs | cut -f1)
+if [ "$kib" -ge 16384 ]; then
+	echo "Allocated format match!"
+else
+	echo "Allocated format don't match... ($kib KiB used)"
+fi
+
+# pre-created files show up in the reference tool as empty files
+./mkfs_fs.x -n 128 -p f disk.fs 100 >/dev/null
+./fs_ref.x info disk.fs | grep rdir_free >lib.stdout
+./fs_ref.x ls disk.fs | sed -n '2p;129p' >>lib.stdout
+cat >ref.stdout <<END
+rdir_free_ratio=0/128
+file: f0, size: 0, data_blk: 65535
+file: f127, size: 0, data_blk: 65535
+END
+if cmp -s ref.stdout lib.stdout; then
+	echo "Pre-created files match!"
+else
+	echo "Pre-created files don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# too many files, or names that do not fit an entry, are refused
+./mkfs_fs.x -n 129 disk.fs 100 >lib.stdout 2>&1
+./mkfs_fs.x -n 10 -p abcdefghijklmno disk.fs 100 >>lib.stdout 2>&1
+if [ "$(grep -c "Cannot create" lib.stdout)" -eq 2 ]; then
+	echo "Invalid files match!"
+else
+	echo "Invalid files don't match..."
+	cat lib.stdout
+fi
+
+# clean
+rm ref.fs lib.fs disk.fs ref.stdout lib.stdout
@@ -0,0 +1,46 @@
+#!/bin/sh
+# make fresh virtual disk
+./fs_make.x disk.fs 8192
+seq 1 100000 >big.bin
+
+# whole and partial mappings of a file split in two runs
+for mode in fat ext lz; do
+	./test_fs.x mmap disk.fs big.bin $mode >lib.stdout
+	./test_fs.x cat disk.fs big.bin | tail -n +3 >big.out
+	if grep -q "^Mapped $(wc -c <big.bin) bytes$" lib.stdout &&
+	   cmp -s big.bin big.out; then
+		echo "Mapping ($mode) match!"
+	else
+		echo "Mapping ($mode) don't match..."
+		cat lib.stdout
+	fi
+	./test_fs.x rm disk.fs big.bin >/dev/null
+done
+
+# blocks smaller than a page are read into the mapping
+./test_fs.x format disk.fs 2000 1024 >/dev/null
+./test_fs.x mmap disk.fs big.bin >lib.stdout
+if grep -q "^Mapped $(wc -c <big.bin) bytes$" lib.stdout; then
+	echo "Mapping (1K blocks) match!"
+else
+	echo "Mapping (1K blocks) don't match..."
+	cat lib.stdout
+fi
+
+# clients of the daemon get a copy
+./fs_make.x disk.fs 8192 >/dev/null
+../fsd/fsd.x disk.fs &
+daemon=$!
+while [ ! -S disk.fs.sock ]; do sleep 0.1; done
+./test_fs_client.x mmap disk.fs big.bin >lib.stdout
+kill -TERM $daemon
+wait $daemon
+if grep -q "^Mapped $(wc -c <big.bin) bytes$" lib.stdout; then
+	echo "Mapping (daemon) match!"
+else
+	echo "Mapping (daemon) don't match..."
+	cat lib.stdout
+fi
+
+# clean
+rm disk.fs big.bin big.out lib.stdout
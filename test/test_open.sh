@@ -0,0 +1,22 @@
+#!/bin/sh
+# make fresh virtual disk
+./fs_make.x disk.fs 100
+./test_fs.x add disk.fs hello.txt >/dev/null
+
+# default limit and a raised limit both hold, closed fds go stale
+./test_fs.x open_many disk.fs hello.txt 32 >lib.stdout
+./test_fs.x open_many disk.fs hello.txt 5000 >>lib.stdout
+cat >ref.stdout <<END
+Opened 'hello.txt' 32 times, 16 stale fds rejected
+Opened 'hello.txt' 5000 times, 2500 stale fds rejected
+END
+
+if cmp -s ref.stdout lib.stdout; then
+	echo "Open files match!"
+else
+	echo "Open files don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# clean
+rm disk.fs ref.stdout lib.stdout
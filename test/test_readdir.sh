@@ -0,0 +1,47 @@
+#!/bin/sh
+# make fresh virtual disk
+./fs_make.x disk.fs 4096
+./test_fs.x add disk.fs hello.txt >/dev/null
+./test_fs.x add_ext disk.fs check.txt >/dev/null
+./test_fs.x mkdir disk.fs logs >/dev/null
+./test_fs.x create_many disk.fs logs 300 >/dev/null
+
+# the root directory walk gives what fs_ls prints
+./test_fs.x ls disk.fs | tail -n +2 | sed 's/^\([a-z]*\): \([^,]*\), size: \([0-9]*\), data_blk: \([0-9]*\)$/\1 \2 size=\3 first=\4/' >ref.stdout
+./test_fs.x readdir disk.fs / | grep -v entries | sed 's/ blocks=.*//' >lib.stdout
+if cmp -s ref.stdout lib.stdout; then
+	echo "Root entries match!"
+else
+	echo "Root entries don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# a subdirectory is walked in small batches without missing an entry
+./test_fs.x readdir disk.fs logs | grep -c "^file file[0-9]* size=[0-9]* first=[0-9]* blocks=1$" >lib.stdout
+echo 300 >ref.stdout
+if cmp -s ref.stdout lib.stdout; then
+	echo "Directory walk match!"
+else
+	echo "Directory walk don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# sizes of many files in one call
+./test_fs.x stat_many disk.fs hello.txt logs/file7 logs/file42 logs/none check.txt >lib.stdout
+cat >ref.stdout <<END
+hello.txt: $(wc -c <hello.txt)
+logs/file7: 10
+logs/file42: 11
+logs/none: -1
+check.txt: $(wc -c <check.txt)
+4 found
+END
+if cmp -s ref.stdout lib.stdout; then
+	echo "Batched sizes match!"
+else
+	echo "Batched sizes don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# clean
+rm disk.fs ref.stdout lib.stdout
@@ -0,0 +1,57 @@
+#!/bin/sh
+# make fresh virtual disks holding the same large file
+./fs_make.x disk.fs 8192
+dd if=/dev/urandom of=big.bin bs=4096 count=6000 2>/dev/null
+./test_fs.x add disk.fs big.bin >/dev/null
+./test_fs.x add disk.fs hello.txt >/dev/null
+cp disk.fs ref.fs
+
+# deleting gives every block back, and their space to the host when asked
+before=$(du -k disk.fs | cut -f1)
+./test_fs.x rm disk.fs big.bin punch >rm.stdout 2>&1
+after=$(du -k disk.fs | cut -f1)
+./fs_ref.x rm ref.fs big.bin >/dev/null
+./fs_ref.x info ref.fs >ref.stdout
+./fs_ref.x ls ref.fs >>ref.stdout
+./test_fs.x info disk.fs >lib.stdout
+./test_fs.x ls disk.fs >>lib.stdout
+if cmp -s ref.stdout lib.stdout && [ $after -lt $((before - 20000)) ] &&
+   grep -q "^Removed file 'big.bin'$" rm.stdout; then
+	echo "Punched delete match!"
+else
+	echo "Punched delete don't match..."
+	diff -u ref.stdout lib.stdout
+	echo "$before KiB before, $after KiB after"
+	cat rm.stdout
+fi
+
+# space of a file deleted in the same mount can be preallocated right away
+./test_fs.x add disk.fs big.bin >/dev/null
+./test_fs.x fallocate disk.fs big2.bin 28672000 big.bin >lib.stdout 2>&1
+if grep -q "^Preallocated 28672000 bytes for 'big2.bin'$" lib.stdout; then
+	echo "Preallocation after delete match!"
+else
+	echo "Preallocation after delete don't match..."
+	cat lib.stdout
+fi
+./test_fs.x rm disk.fs big2.bin >/dev/null
+
+# a file added right after the deletion gets the blocks still queued
+../fsd/fsd.x disk.fs &
+daemon=$!
+while [ ! -S disk.fs.sock ]; do sleep 0.1; done
+./test_fs_client.x add disk.fs big.bin >/dev/null
+./test_fs_client.x rm disk.fs big.bin >/dev/null
+./test_fs_client.x add disk.fs big.bin >lib.stdout 2>&1
+./test_fs_client.x cat disk.fs big.bin | tail -n +3 >big.out
+kill -TERM $daemon
+wait $daemon
+if cmp -s big.bin big.out; then
+	echo "Reclaimed blocks reuse match!"
+else
+	echo "Reclaimed blocks reuse don't match..."
+	cat lib.stdout
+fi
+
+# clean
+rm disk.fs ref.fs big.bin big.out ref.stdout lib.stdout rm.stdout
@@ -0,0 +1,42 @@
+#!/bin/sh
+# make fresh virtual disks
+./fs_make.x disk.fs 4096
+./fs_make.x replay.fs 4096
+
+# record a workload
+FS_TRACE=add.trace ./test_fs_trace.x add disk.fs check.txt >/dev/null
+FS_TRACE=dir.trace ./test_fs_trace.x mkdir disk.fs logs >/dev/null
+FS_TRACE=many.trace ./test_fs_trace.x create_many disk.fs logs 50 >/dev/null
+FS_TRACE=cat.trace ./test_fs_trace.x cat_async disk.fs check.txt >/dev/null
+seq 1 2000 >log.txt
+FS_TRACE=append.trace ./test_fs_trace.x append disk.fs log.txt >/dev/null
+
+# replaying it on another disk gives the same results
+for trace in add dir many cat append; do
+	./replay_fs.x $trace.trace replay.fs | head -n 1 | sed 's/ in .*//' >>lib.stdout
+done
+grep -c "^Replayed [0-9]* calls ([0-9]* skipped, 0 mismatched)$" lib.stdout >lib.count
+echo 5 >ref.count
+if cmp -s ref.count lib.count; then
+	echo "Replayed results match!"
+else
+	echo "Replayed results don't match..."
+	cat lib.stdout
+fi
+
+# and leaves the same files behind
+./test_fs.x stat disk.fs check.txt >ref.stdout
+./test_fs.x stat replay.fs check.txt >lib.stdout
+./test_fs.x stat_many disk.fs logs/file0 logs/file49 >>ref.stdout
+./test_fs.x stat_many replay.fs logs/file0 logs/file49 >>lib.stdout
+./test_fs.x stat disk.fs log.txt >>ref.stdout
+./test_fs.x stat replay.fs log.txt >>lib.stdout
+if cmp -s ref.stdout lib.stdout; then
+	echo "Replayed files match!"
+else
+	echo "Replayed files don't match..."
+	diff -u ref.stdout lib.stdout
+fi
+
+# clean
+rm disk.fs replay.fs add.trace dir.trace many.trace cat.trace append.trace log.txt ref.stdout lib.stdout ref.count lib.count
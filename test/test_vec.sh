@@ -0,0 +1,37 @@
+#!/bin/sh
+# make fresh virtual disk
+./fs_make.x disk.fs 8192
+seq 1 100000 >big.bin
+
+# gathered and positional writes, scattered and threaded positional reads
+for mode in fat ext lz; do
+	./test_fs.x vec disk.fs big.bin $mode >lib.stdout
+	./test_fs.x cat disk.fs big.bin | tail -n +3 >big.out
+	if grep -q "^Vectored and positional I/O of $(wc -c <big.bin) bytes$" lib.stdout &&
+	   cmp -s big.bin big.out; then
+		echo "Vectored I/O ($mode) match!"
+	else
+		echo "Vectored I/O ($mode) don't match..."
+		cat lib.stdout
+	fi
+	./test_fs.x rm disk.fs big.bin >/dev/null
+done
+
+# threads share the connection of a client of the daemon
+../fsd/fsd.x disk.fs &
+daemon=$!
+while [ ! -S disk.fs.sock ]; do sleep 0.1; done
+./test_fs_client.x vec disk.fs big.bin >lib.stdout
+./test_fs_client.x cat disk.fs big.bin | tail -n +3 >big.out
+kill -TERM $daemon
+wait $daemon
+if grep -q "^Vectored and positional I/O of $(wc -c <big.bin) bytes$" lib.stdout &&
+   cmp -s big.bin big.out; then
+	echo "Vectored I/O (daemon) match!"
+else
+	echo "Vectored I/O (daemon) don't match..."
+	cat lib.stdout
+fi
+
+# clean
+rm disk.fs big.bin big.out lib.stdout
@@ -0,0 +1,28 @@
+#!/bin/sh
+# make fresh virtual disks
+./fs_make.x disk.fs 8192
+./fs_make.x ref.fs 8192
+seq 1 100000 >big.bin
+
+# dirty blocks stay in memory until synced, then land exactly as written
+./test_fs.x writeback disk.fs big.bin >lib.stdout
+./test_fs.x cat disk.fs big.bin | tail -n +3 >big.out
+if grep -q "^Dirty before sync: yes$" lib.stdout &&
+   grep -q "^Dirty after sync: 0$" lib.stdout &&
+   cmp -s big.bin big.out; then
+	echo "Write-back sync match!"
+else
+	echo "Write-back sync don't match..."
+	cat lib.stdout
+fi
+
+# the disk is the one a plain write gives
+./fs_ref.x add ref.fs big.bin >/dev/null
+if cmp -s disk.fs ref.fs; then
+	echo "Write-back disk match!"
+else
+	echo "Write-back disk don't match..."
+fi
+
+# clean
+rm disk.fs ref.fs big.bin big.out lib.stdout